@@ -0,0 +1,34 @@
+/*
+ * ccmram.h
+ *
+ *  Placement of the control loop code and data in the core coupled memory (CCMRAM)
+ *
+ *  The STM32F303K8 has 4K of CCMRAM on the core's own buses. Code runs from it with no wait states (flash needs 2 at
+ *  64MHz) and data in it is never shared with the DMA, so the speed loop in the tick ISR does not stall behind
+ *  UART transfers. Functions marked CCMRAM_CODE and variables marked CCMRAM_DATA go in the .ccmram sections,
+ *  which the linker script loads into flash and the startup code copies to CCMRAM before main() runs.
+ *
+ *  Flash and CCMRAM are too far apart for a direct call, so the linker adds a veneer to calls between them.
+ *  Functions called from a CCMRAM function should be in CCMRAM too (or be inlined into it).
+ *  The DMA cannot reach CCMRAM, so buffers used by the DMA must stay in main RAM.
+ *
+ *  Build with USE_CCMRAM=0 in the compiler defines to leave everything in flash and main RAM
+ *  (e.g. to compare the speed loop probe with and without it).
+ */
+
+#ifndef INC_CCMRAM_H_
+#define INC_CCMRAM_H_
+
+#ifndef USE_CCMRAM
+#define USE_CCMRAM 1
+#endif
+
+#if USE_CCMRAM
+#define CCMRAM_CODE __attribute__((section(".ccmram.text"))) // run the function from CCMRAM
+#define CCMRAM_DATA __attribute__((section(".ccmram.data"))) // keep the variable in CCMRAM (initialized from flash)
+#else
+#define CCMRAM_CODE
+#define CCMRAM_DATA
+#endif
+
+#endif /* INC_CCMRAM_H_ */
@@ -20,14 +20,70 @@
 #define INC_COMS_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include "motors.h"
 
+// Every packet is sent in a frame with a header and a CRC trailer, the whole frame is then SLIP encoded
+//
+//   [seq][ack][packet data ...][crc lo][crc hi]
+//
+//   seq - frame sequence number, incremented for each frame sent in that direction (wraps at 255)
+//   ack - seq of the last good frame received from the other end
+//   crc - CRC-16/CCITT-FALSE of seq, ack and the packet data
+//
+#define COMS_PACKET_SIZE 128 // max size of packet data in a frame
+#define COMS_HDR_SIZE 2
+#define COMS_CRC_SIZE 2
+#define COMS_FRAME_OVERHEAD (COMS_HDR_SIZE+COMS_CRC_SIZE)
 
+#define SLIP_MAX_ENCODED(len) (2*(len)+2) // worst case encoded size of len bytes (every byte escaped, plus START and END)
+
+// Define STATE Variable values for SLIP decoding state machine
+typedef enum SLIP_RX_STATE_t {
+    SRX_IDLE=0,
+    SRX_ESC,
+    SRX_CHAR
+} SLIP_RX_STATE;
+
+// maintain the state of a packet being decoded
+typedef struct SLIP_DECODER_t {
+	SLIP_RX_STATE state; // parser state machine state
+	int idx;             // input buffer offset to store next decoded character
+} SLIP_DECODER;
+
+
+// coms link statistics
+typedef struct COMS_STATS_t {
+	uint32_t rx_bytes;      // total bytes received
+	uint32_t rx_lost;       // bytes lost because the receive ring overflowed or reception was restarted before they were read
+	uint32_t rx_overruns;   // UART overrun errors (receive DMA is restarted after each)
+	uint32_t rx_errors;     // other UART receive errors (framing, noise, parity)
+	uint32_t rx_idle;       // number of idle line periods detected (end of each received burst)
+	uint32_t rx_passes;     // number of doComs() passes that had received data to process
+	uint32_t rx_max_pass;   // most bytes processed in a single doComs() pass
+
+	uint32_t rx_frames;     // good frames received
+	uint32_t rx_crc_errors; // frames rejected because the CRC did not match (or too short to hold one)
+	uint32_t rx_seq_gaps;   // frames missing from the received sequence numbers (includes frames rejected by the CRC)
+
+	uint32_t tx_frames;     // frames sent
+	uint32_t tx_coalesced;  // queued state frames replaced by a newer frame before they could be sent
+	uint32_t tx_dropped;    // frames that could not be sent (too large, no free buffer, or the transmit failed)
+} COMS_STATS;
+
+void comsInit(void); // start receiving on the coms UART
 MotorEvent doComs(void); // handle the coms (called from main loop)
 
-// helpers to encode/decode data packets in slip encoded format
-void slipEncode(uint8_t * buf, int len);
-bool slipDecode(uint8_t c, int size, uint8_t * slipInPacket, int * out_len);
+const COMS_STATS * comsGetStats(void); // get coms link statistics
+
+// send a packet to the host (framed and slip encoded)
+// set coalesce for packets that only hold the latest state, so a newer one can replace one still waiting to be sent
+void slipEncode(uint8_t * buf, int len, bool coalesce);
+
+// helpers to encode/decode frames in slip encoded format
+int slipEncodeFrame(const uint8_t * buf, int len, uint8_t seq, uint8_t ack, uint8_t * out);
+bool slipDecode(SLIP_DECODER * dec, uint8_t c, int size, uint8_t * slipInPacket, int * out_len);
+bool slipCheckFrame(const uint8_t * frame, int len);
 
 #endif /* INC_COMS_H_ */
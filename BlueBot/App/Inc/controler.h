@@ -12,7 +12,42 @@
 
 
 #include "motors.h"
-void updateControler(MotorEvent event); // called from main loop to update the state machine
+#include "fsm.h"
+
+// define states of the state machine
+typedef enum State_t {
+
+	ST_IDLE=0, // stopped , waiting for a command
+
+
+	// states to implement level 1 challenge
+	ST_M1,       // running level 1 (contains all the level 1 states)
+	ST_M1_EDGE,  // moving with the edge sensors on, an edge starts a backup (contains ST_M1_FWD and ST_M1_TURN)
+	ST_M1_FWD,   // drive forward
+	ST_M1_TURN,  // turning
+	ST_M1_BACKUP, // backing up from an edge with the edge sensors off (contains ST_M1_BCK_L and ST_M1_BCK_R)
+	ST_M1_BCK_L, // backup and turn left
+	ST_M1_BCK_R, // backup and turn right
+
+	// states to implement level 2 challenge (not implemented)
+	ST_M2,
+
+	// states to implement level 3 challenge (not implemented)
+	ST_M3,
+
+	// states to implement victory dance at completion of challenge level (not implemented)
+	ST_COMPLETE,
+
+	ST_ROOT,     // contains every state, a STOP event in any state goes to ST_IDLE
+
+	NUM_STATES
+} STATE;
+
+void controlerInit(void);      // start the state machine (call before updateControler)
+void updateControler(void);    // called from main loop to update the state machine with the queued events
+STATE getControlerState(void); // get the current state
+const FSM * getControlerFSM(void);      // get the state machine (for tracing and coverage)
+void setControlerTrace(FSM_TRACE trace); // set a function called for each transition taken (NULL for none)
 
 
 #endif /* INC_CONTROLER_H_ */
@@ -0,0 +1,20 @@
+/*
+ * crc16.h
+ *
+ *  CRC-16/CCITT-FALSE (poly 0x1021, initial value 0xFFFF, no reflection, no final xor)
+ *
+ *  Used to check the integrity of the SLIP frames on the coms link. The check value of the
+ *  ASCII string "123456789" is 0x29B1.
+ */
+
+#ifndef INC_CRC16_H_
+#define INC_CRC16_H_
+
+#include <stdint.h>
+
+#define CRC16_INIT 0xFFFF // initial value for a new CRC
+
+uint16_t crc16(const uint8_t * data, int len); // CRC of a block of data
+uint16_t crc16Update(uint16_t crc, const uint8_t * data, int len); // continue a CRC with more data
+
+#endif /* INC_CRC16_H_ */
@@ -11,6 +11,7 @@
 #define INC_EDGE_SENSOR_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 // flags to indicate each sensor
 #define BUMP_BIT_LEFT 1
@@ -24,10 +25,26 @@ typedef enum EDGE_SENSOR_STATE_t {
 } EDGE_SENSOR_STATE;
 
 
+// fast stop statistics
+typedef struct EDGE_SENSOR_STATS_t {
+	uint32_t trips;           // fast stops
+	uint32_t glitches;        // fast stops released because the debounced state stayed clear
+	uint32_t reaction_us;     // last time from the sensor pin ISR starting to the PWM off (us), the ISR pre-empts the speed
+	                          // loop, so it only starts later than the edge behind other priority 0 ISRs and masked sections
+	uint32_t reaction_max_us; // longest time from the sensor pin ISR starting to the PWM off (us)
+	uint32_t confirm_us;      // last time from a fast stop to the debounced state confirming it (us)
+} EDGE_SENSOR_STATS;
+
+void edgeSensorInit(void); // set up the sensor pin interrupts for the fast stop
+
 void enableEdgeSensors(uint32_t sensor); // enable  a sensor
-void disableEdgeSensors(uint32_t sensor); // disable a sensor
+void disableEdgeSensors(uint32_t sensor); // disable a sensor (releases its fast stop)
 
 void updateEdgeSensors(void); // update sensors states (debounces switch sensor inputs)
 EDGE_SENSOR_STATE getEdgeSensorState(uint32_t sensor); // get state of a sensor
 
+void edgeSensorEdge(uint16_t pin); // ISR for a sensor pin going over an edge (fast stop)
+bool edgeSensorTripped(void);      // true while a fast stop is holding the motors off
+const EDGE_SENSOR_STATS * getEdgeSensorStats(void); // get the fast stop statistics
+
 #endif /* INC_EDGE_SENSOR_H_ */
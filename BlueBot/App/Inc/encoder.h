@@ -11,34 +11,80 @@
 #define INC_ENCODER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "tim.h"
 
 #define ENCODER_DIST_SCALE  (1.0f/5456.740906f) // counts/m
-#define ENCODER_VEL_SCALE 0.2617993878f     // convert encoder velocity value to rad/sec
+#define ENCODER_RAD_PER_COUNT 0.005235987756f // wheel rotation per count (rad)
+#define ENCODER_PERIOD 0.02f                  // default update period (s), set with encoderSetPeriod()
+#define ENCODER_VEL_SCALE (ENCODER_RAD_PER_COUNT/ENCODER_PERIOD) // convert counts per ENCODER_PERIOD to rad/sec
+
+// Counts are extended to 32 bits and accumulated in a 64 bit tick count for each wheel
+//   TIM2 (left) is a 32 bit timer and counts the full range itself (period set to 0xFFFFFFFF in CubeMX)
+//   TIM1 (right) is a 16 bit timer, its update interrupt counts the overflows/underflows to give the high 16 bits
+// The change between updates is the difference of the 32 bit counts, so it is exact for any movement of less
+// than 2^31 counts (~390km) between updates.
+#define ENCODER_COUNT_MAX 0xFFFFFFFFU // timer period of a timer that counts the full 32 bit range
+
+// Velocity is estimated by one of two methods depending on speed
+//   M method - counts in the update averaged with the last update, used at speed when there are enough counts to resolve the velocity
+//   T method - counts between the last edges on the encoder A channel divided by the time between them, used
+//              at low speed where there are only a few counts per update (edges are timed by the EXTI ISR)
+// The M method threshold is a count rate, scaled to counts per update by encoderSetPeriod(). When the update period
+// is too short for that to be ENCODER_MT_MIN_COUNTS (e.g. the 1kHz speed loop, 2 counts) the M method cannot resolve
+// the velocity better than the edge timing, so the T method is used at all speeds
+#define ENCODER_MT_RATE 2000.0f   // count rate (counts/s) at or above which the M method is used (~10 rad/s)
+#define ENCODER_MT_MIN_COUNTS 20  // fewest counts per update at ENCODER_MT_RATE for the M method to be used
+#define ENCODER_STOP_US   100000  // time with no edges after which the wheel is taken as stopped (us)
+#define ENCODER_ACC_HZ 10.0f      // bandwidth of the acceleration filter (lower is less noisy but follows speed changes more slowly)
 
 // encoder state variables
 typedef struct ENCODER_STATE_t {
 	float pos;     // cumulative position (m), signed relative to 0 when robot starts (wheel going forward increments, backwards decrements position)
 	float vel;     // current wheel velocity rad/s.
+	float acc;     // current wheel acceleration rad/s^2 (filtered change in the velocity)
 } ENCODER_STATE;
 
 // define the Encoder config variables
 typedef struct ENC_STATUS_t {
 
-	int16_t last;   // last position register value, used to calculate differences since last update and detect 16bit timer overflow
-	float last_vel;
+	uint32_t last;  // last 32 bit count, used to calculate differences since last update
 	int16_t dir;    // sets the direction reported by the encoder.  Set to +1 or -1 so encoder gives positive vel. when wheel moves forwards
 	const TIM_HandleTypeDef * htim;  // reference to the STM HAL timer used by this encoder
 
 	const char *tag; // Tag (name) of this encoder to show in debug messages
 
 	ENCODER_STATE state; // encoder state info
+
+	int64_t ticks; // cumulative counts since the last reset (signed by dir), the position is derived from this
+	volatile uint16_t overflows; // high 16 bits of the count of a 16 bit timer, counted by encoderOverflow() in the update ISR
+
+	// last edge on the A channel, set by encoderEdge() in the EXTI ISR
+	volatile uint32_t edge_us;    // time of the edge (us)
+	volatile uint16_t edge_count; // timer count at the edge
+	volatile bool edge_seen;      // an edge was seen since the last update
+
+	// edge used by the last T method estimate
+	uint32_t last_edge_us;
+	uint16_t last_edge_count;
+	bool edge_valid; // true once an edge has been seen
+	float last_vel; // M method velocity of the last update
 } ENCODER;
 
 
-// called at PID update rate to update position and velocity data
+void encoderInit(void); // reset the velocity estimates and enable the edge and overflow interrupts used to extend and time the counts
+void encoderReset(ENCODER * enc); // zero the tick count and position
+void encoderSetPeriod(float period); // set the period (s) updateEncoder is called at (resets the acceleration and sets the M method threshold)
+
+// called at the speed loop rate to update position and velocity data
 void updateEncoder(ENCODER * enc);
 
+// record the time of an edge on the encoder A channel (called from the EXTI ISR)
+void encoderEdge(ENCODER * enc);
+
+// count an overflow or underflow of a 16 bit encoder timer (called from the timer update ISR)
+void encoderOverflow(ENCODER * enc);
+
 
 // reference to the state for each encoder
 extern ENCODER enc_left;
@@ -0,0 +1,42 @@
+/*
+ * events.h
+ *
+ *  Event queue
+ *
+ *  Events raised by the motor controller and the UI are queued with the time they were raised, and the
+ *  controller state machine takes them off the queue one at a time. Events raised in the same pass of the
+ *  main loop (e.g. a driveTo ending as an edge is detected) are each handled, in the order they were raised.
+ *
+ *  The queue is a lock free single producer, single consumer ring. Only the producer writes the head and
+ *  only the consumer writes the tail, so either side can run in an ISR without disabling interrupts
+ *  (but events must only be posted from one context).
+ */
+
+#ifndef INC_EVENTS_H_
+#define INC_EVENTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "motors.h"
+
+#define EVENT_QUEUE_SIZE 16 // events the queue holds (must be a power of 2)
+
+// a queued event
+typedef struct EVENT_t {
+	MotorEvent type;  // a single event flag
+	uint32_t time_us; // time the event was posted (schedMicros)
+} EVENT;
+
+// event queue statistics
+typedef struct EVENT_STATS_t {
+	uint32_t posted;    // events put on the queue
+	uint32_t handled;   // events taken off the queue
+	uint32_t dropped;   // events lost because the queue was full
+	uint32_t max_depth; // most events waiting on the queue
+} EVENT_STATS;
+
+bool eventPost(MotorEvent events); // queue each event flag set in events, false if the queue was full
+bool eventGet(EVENT * event);      // take the oldest event off the queue, false if it is empty
+const EVENT_STATS * eventGetStats(void); // get the queue statistics
+
+#endif /* INC_EVENTS_H_ */
@@ -0,0 +1,24 @@
+/*
+ * fast_math.h
+ *
+ *  Fast sin and cos for the odometry and path hot paths
+ *
+ *  newlib's sinf and cosf are accurate to an ulp or so over the whole float range, which costs far more cycles on
+ *  the M4 than the angles the pose and path updates need. fastSinCos gives both from one argument reduction and
+ *  uses only the FPU's add and multiply (no library calls). The max error below was measured against double
+ *  precision libm by the host bench ("fastMath(accuracy)"). The host timings are not a guide to the M4, glibc's
+ *  float functions use the host's double precision hardware, time them on the robot with the probes.
+ */
+
+#ifndef INC_FAST_MATH_H_
+#define INC_FAST_MATH_H_
+
+#include <stdint.h>
+
+#define FM_PI   3.14159265358979324f
+
+// sin and cos of x (rad), |x| < 10000
+// max error 1e-7 for |x| <= 1000 (the error in x itself is larger than this once |x| > 1)
+void fastSinCos(float x, float * s, float * c);
+
+#endif /* INC_FAST_MATH_H_ */
@@ -0,0 +1,87 @@
+/*
+ * fsm.h
+ *
+ *  Table driven hierarchical state machine engine
+ *
+ *  Each state has a parent (or FSM_NO_STATE at the top), optional entry and exit actions, an optional
+ *  timeout and a transition table indexed by event number. An event is looked up in the table of the
+ *  current state, then its parent and so on up, so a transition shared by several states is written once
+ *  in their common parent. A transition with a guard is only taken if the guard returns true (otherwise
+ *  the parent's table is tried). Lookup is a table index per level, so it does not get slower as states
+ *  and transitions are added.
+ *
+ *  Taking a transition runs the exit actions from the current state up to (not including) the closest state
+ *  that contains both it and the target, then the transition action, then the entry actions down to the target.
+ *  A transition to the state it is in exits and re-enters it. An internal transition runs its action only.
+ *
+ *  Event 0 (FSM_EV_TIMEOUT) is raised by fsmUpdate() when a state has been active for its timeout.
+ */
+
+#ifndef INC_FSM_H_
+#define INC_FSM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FSM_MAX_STATES 16   // most states a state machine can have
+#define FSM_NO_STATE   0xFF // no parent, or no target for an internal transition
+#define FSM_EV_TIMEOUT 0    // event raised when the timeout of an active state expires
+
+typedef struct FSM_t FSM;
+
+typedef bool (*FSM_GUARD)(void);  // returns true if the transition may be taken
+typedef void (*FSM_ACTION)(void); // entry, exit or transition action
+
+// called for each transition taken, source is the state whose table held the transition,
+// from and to are the current state before and after it (the same for an internal transition)
+typedef void (*FSM_TRACE)(const FSM * fsm, uint8_t source, uint8_t event, uint8_t from, uint8_t to);
+
+// kind of transition table entry
+typedef enum FSM_KIND_t {
+	FSM_TR_NONE=0,   // no transition for this event (the parent is tried)
+	FSM_TR_GOTO,     // change to the target state
+	FSM_TR_INTERNAL  // run the action and stay in the current state
+} FSM_KIND;
+
+// transition table entry
+typedef struct FSM_TRANSITION_t {
+	FSM_KIND kind;
+	uint8_t target;    // next state (FSM_TR_GOTO)
+	FSM_GUARD guard;   // NULL to always take the transition
+	FSM_ACTION action; // NULL for none
+} FSM_TRANSITION;
+
+#define FSM_GOTO(target,guard,action) { FSM_TR_GOTO, (target), (guard), (action) }
+#define FSM_INTERNAL(guard,action)    { FSM_TR_INTERNAL, FSM_NO_STATE, (guard), (action) }
+
+// definition of a state
+typedef struct FSM_STATE_DEF_t {
+	const char * name;
+	uint8_t parent;                     // containing state (FSM_NO_STATE at the top)
+	FSM_ACTION entry;                   // run when the state is entered (NULL for none)
+	FSM_ACTION exit;                    // run when the state is left (NULL for none)
+	uint32_t timeout_ms;                // time in the state before FSM_EV_TIMEOUT is raised (0 for none)
+	const FSM_TRANSITION * transitions; // indexed by event (num_events entries), NULL if it has none
+} FSM_STATE_DEF;
+
+// a running state machine
+struct FSM_t {
+	const FSM_STATE_DEF * states; // state definitions, indexed by state number
+	uint8_t num_states;
+	uint8_t num_events;
+	uint8_t state;                // current state
+	uint32_t entered_ms[FSM_MAX_STATES]; // time each active state was entered
+	FSM_TRACE trace;              // called for each transition taken (NULL for none)
+	uint32_t transitions;         // count of transitions taken
+};
+
+// start the state machine in the initial state (running the entry actions down to it)
+void fsmInit(FSM * fsm, const FSM_STATE_DEF * states, uint8_t num_states, uint8_t num_events, uint8_t initial, uint32_t now_ms);
+
+// handle an event, returns true if a transition was taken
+bool fsmEvent(FSM * fsm, uint8_t event, uint32_t now_ms);
+
+// raise FSM_EV_TIMEOUT if the timeout of an active state has expired, returns true if a transition was taken
+bool fsmUpdate(FSM * fsm, uint32_t now_ms);
+
+#endif /* INC_FSM_H_ */
@@ -3,6 +3,10 @@
  *
  *  Process distance measurements from teh Sharp IR sensors
  *
+ *  Each sensor's ADC reading is converted to a distance with a calibration table indexed by the ADC code.
+ *  The tables (ir_tables.c) are generated from the calibration curves below, or from a sensor's measured
+ *  calibration points, by the host tool Host/build/ir_table_gen (see Host/Makefile), and are kept in flash.
+ *
  *  Created on: Oct 11, 2020
  *      Author: Ralph Gnauck
  */
@@ -10,15 +14,56 @@
 #ifndef INC_IR_RANGE_H_
 #define INC_IR_RANGE_H_
 
+#include <stdint.h>
+
 #define NUM_IR_SENSORS 2 // Number of sensors
 
 // define sensor IDs
 #define LR_IR 0 // Long range sensor
 #define SR_IR 1 // short range sensor
 
+#define IR_ADC_BITS 12                     // ADC resolution
+#define IR_ADC_SCALE 0.0008056640625f      // ADC to volts (3.3V / 4096)
+
+// Define calibration coefficients for each sensor - raw data has been fit to a * order polynomial approximation function for calibration
+// dist = a * volts^b + c
+
+// Coefficients for short range sensor
+#define SR_A 15.5f
+#define SR_B -0.8647f
+#define SR_C -2.494f
+
+// Coefficients for long range sensor
+#define LR_A 76.98f
+#define LR_B -0.9005f
+#define LR_C -13.04f
+
+// valid range of each sensor (cm), readings outside it are reported as NAN
+#define MAX_LR 150.0f
+#define MIN_LR 20.0f
+
+#define MAX_SR 25.0f
+#define MIN_SR 4.0f
+
+// calibration tables, one entry every 2^IR_TABLE_SHIFT ADC codes with linear interpolation between them
+// (16 codes = 13mV, max interpolation error 0.03cm at 150cm on the long range curve, where it bends most)
+#define IR_TABLE_SHIFT 4
+#define IR_TABLE_SIZE ((1 << (IR_ADC_BITS - IR_TABLE_SHIFT)) + 1) // +1 for the end of the last step
+#define IR_TABLE_MAX_CM 1000.0f // distances are limited to this (the curves go to infinity at 0V)
+
+typedef struct IR_TABLE_t {
+	const char * source;       // what the table was generated from
+	float dist[IR_TABLE_SIZE]; // distance (cm) at ADC code n << IR_TABLE_SHIFT
+} IR_TABLE;
+
+extern const IR_TABLE ir_table_long;  // long range sensor calibration (ir_tables.c)
+extern const IR_TABLE ir_table_short; // short range sensor calibration (ir_tables.c)
+
 // process new sensor readings
 void updateIRSensors(void);
 
+void setIRTable(int sensor, const IR_TABLE * table); // select the calibration table used for a sensor
+float irTableDistance(const IR_TABLE * table, uint32_t code); // distance (cm) for an ADC code from a calibration table
 
 float getLongRangeIR(void); // get latest measurement from long range sensor (distance in cm)
 float getShortRangeIR(void); // get latest measurement from long range sensor (distance in cm)
@@ -13,12 +13,27 @@
 
 #include <stdbool.h>
 #include <math.h>
+#include <stdint.h>
 
 // use float definition of PI
 extern const float M_PI_F;
 
 #define MAX_LIN_VEL 0.5f           //  maximum linear velocity m/s
 #define MAX_ANG_VEL (2.0f*M_PI_F)  //  maximum angular velocity rad/s
+#define STREAM_TIMEOUT_MS 200      //  default time without a streamed setpoint before the robot is stopped (ms)
+#define STREAM_STOP_DECEL 60.0f    //  wheel deceleration when the watchdog stops the robot (rad/s^2)
+
+// The watchdog trips at the first motion update (SG_MOTION, 20ms) after the timeout, then ramps the wheel speed
+// targets down at STREAM_STOP_DECEL and turns the PWM off when they reach 0. From the last setpoint to the PWM off
+// takes up to timeout + 20ms + wheel speed/STREAM_STOP_DECEL: 458ms from MAX_LIN_VEL straight (14.3 rad/s), 588ms
+// from the fastest wheel speed (MAX_LIN_VEL while turning at MAX_ANG_VEL, 22.1 rad/s). The wheels are slowing from the trip.
+
+// The motor control runs at two rates
+//   speed loop  - updates the encoders, runs the wheel speed PIDs and sets the PWM, every SPEED_LOOP_TICKS scheduler
+//                 ticks from the tick ISR (updateSpeedLoop)
+//   motion layer - integrates the pose, runs the driveTo/turnTo/followPath/stream commands that set the wheel speed
+//                 targets and checks the edge sensors, at the SG_MOTION rate from the main loop (updateMotors)
+#define SPEED_LOOP_TICKS 1         //  scheduler ticks (ms) between speed loop updates (1 = 1kHz)
 
 
 // Events that are returned depending on conditions detected in the motor controller
@@ -32,7 +47,9 @@ typedef enum MotorEvents_t {
 
 	CE_M1=32,
 	CE_M2=64,
-	CE_M3=128
+	CE_M3=128,
+
+	ME_DONE_PATH=256  // a followPath command has reached the last waypoint
 
 } MotorEvent;
 
@@ -41,9 +58,48 @@ void drive(float lin_vel, float ang_vel); // run the motors to achieve desired l
 
 void turnTo(float angle, float ang_vel); // make the robot turn a specified angle (rad) at a given angular velocity (rad/s)
 void driveTo(float dist, float lin_vel); // drive the robot forward or backwards the given distance (m) at the given speed(m/s)
+void setMoveLimits(float lin_acc, float lin_jerk, float ang_acc, float ang_jerk); // set driveTo/turnTo acceleration (m/s^2, rad/s^2) and jerk (m/s^3, rad/s^3, 0 = trapezoidal) limits
+void setHeadingHold(float kh, float ky); // set driveTo heading (1/s) and cross track (1/m^2) error steering gains (0 = off)
+void followPath(float lin_vel, float lookahead); // follow the path through the waypoint queue (path.h) at the given speed (m/s), steering to the point lookahead (m) ahead
 
 void setMotorSpeed(float left, float right); // set the individual speed of the left and right wheels (rad/s)
+void motorsOff(void); // turn the PWM outputs off now without cancelling the commands (safe to call from an ISR)
+
+// statistics for the wheel speed loop
+typedef struct SPEED_LOOP_STATS_t {
+	uint32_t runs;        // speed loop updates
+	uint32_t exec_us;     // time taken by the last update (us)
+	uint32_t exec_max_us; // longest update (us)
+} SPEED_LOOP_STATS;
+
+void setSpeedLoopRate(uint32_t ticks); // run the speed loop every ticks scheduler ticks (sets the encoder and PID periods to match, 0 stops it)
+void updateSpeedLoop(void);            // wheel speed loop, called every scheduler tick from the tick ISR
+const SPEED_LOOP_STATS * getSpeedLoopStats(void); // get the speed loop statistics
+
+// robot pose, integrated from the encoder ticks (odometry)
+typedef struct POSE_t {
+	float x;       // position (m) relative to the origin
+	float y;
+	float heading; // heading (rad, +-PI), 0 along the x axis, +ve counter clockwise
+} POSE;
+
+void setPose(float x, float y, float heading); // set the robot pose (set when stopped)
+void resetPose(void);                          // set the pose back to the origin
+void getPose(POSE * pose);                     // get the current robot pose
+
+// statistics for the streaming setpoint mode
+typedef struct STREAM_STATS_t {
+	uint32_t setpoints;      // setpoints received
+	uint32_t applied;        // setpoints applied to the wheels (the rest were replaced by a newer one before the motion update)
+	uint32_t timeouts;       // number of times the watchdog stopped the robot
+	uint32_t latency_us;     // last delay from a setpoint being received to the speed loop writing the PWM for it (us)
+	uint32_t latency_max_us; // longest delay from a setpoint being received to the speed loop writing the PWM for it (us)
+} STREAM_STATS;
+
+void streamVelocity(float lin_vel, float ang_vel); // set robot velocity from a host setpoint stream (applied at next motion update, stopped by watchdog if stream stops)
+void setStreamTimeout(uint32_t ms); // set the stream watchdog timeout
+const STREAM_STATS * getStreamStats(void); // get streaming statistics
 
-MotorEvent updateMotors(bool pid_update, float DT); // update the motor controller and if pid_update is true also update the PID controller
+MotorEvent updateMotors(bool motion_update, float DT); // check the edge sensors and if motion_update is true also update the pose and the running command
 
 #endif /* INC_MOTORS_H_ */
@@ -0,0 +1,39 @@
+/*
+ * path.h
+ *
+ *  Waypoint queue and pure pursuit path tracker
+ *
+ *  Waypoints are held in a fixed size queue and joined by straight segments into a path that starts at
+ *  the robot pose when following begins. Each update the tracker finds the point on the path a lookahead
+ *  distance ahead of the robot and returns the curvature of the arc that takes the robot to it, so the
+ *  robot turns onto the next segment before it reaches a waypoint instead of stopping to turn.
+ *  Waypoints that have been passed are removed from the queue, more can be added while the path is followed.
+ */
+
+#ifndef INC_PATH_H_
+#define INC_PATH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "motors.h"
+
+#define PATH_QUEUE_SIZE 32    // waypoints the queue holds
+#define PATH_GOAL_TOL   0.01f // the path ends when the robot is within this of the last waypoint, or has passed it (m)
+
+// a point on the path (m)
+typedef struct WAYPOINT_t {
+	float x;
+	float y;
+} WAYPOINT;
+
+bool pathAdd(float x, float y); // add a waypoint to the end of the queue, false if the queue is full
+void pathClear(void);           // remove all the waypoints
+uint16_t pathCount(void);       // waypoints in the queue
+
+void pathStart(const POSE * pose); // start the path from the robot pose
+
+// find the curvature (1/m, +ve turns left) to steer to the point lookahead (m) along the path, and the distance left to the
+// end of the path (m), returns true (and empties the queue) once the last waypoint is reached
+bool pathUpdate(const POSE * pose, float lookahead, float * curvature, float * remaining);
+
+#endif /* INC_PATH_H_ */
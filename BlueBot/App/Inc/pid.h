@@ -27,10 +27,14 @@ typedef	struct PID_STATE_t {
 typedef struct PID_t {
 	float kp; // Proportional tuning constant
 	float ki; // Integral tuning constant
+	float kf; // Feed-forward constant, duty per rad/s of setpoint (0 = no feed-forward)
+	float deadband; // duty added to the feed-forward in the direction of the setpoint to overcome the motor deadband
+	float slew;     // max rate of change of the setpoint (rad/s^2), 0 = setpoint changes are applied at once
 
 	float dt;    // time interval for updates
 
 	bool openLoop; // set true PID update is open loop pass through mode
+	bool antiWindup; // set true to hold the integral while the output is saturated (conditional integration)
 	const char * tag; // tag label for debug messages
 
 
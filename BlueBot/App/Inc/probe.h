@@ -0,0 +1,84 @@
+/*
+ * probe.h
+ *
+ *  Cycle count probes for timing the hot paths
+ *
+ *  A probe times a statement with the Cortex-M4 DWT cycle counter (CYCCNT, counting at the 64MHz core clock),
+ *  and keeps the run count, min, max and total cycles and a histogram with a bucket per power of 2 cycles.
+ *  Probes in the main loop include the time of any interrupts taken while they ran.
+ *
+ *  The stats of a probe are sent to the host with the UI_OP_PROBE command, packed into a probe packet:
+ *
+ *   off  size  field
+ *    0    1    type    PROBE_TYPE_STATS
+ *    1    1    probe   PROBE_ID
+ *    2    4    runs    uint32
+ *    6    4    min     uint32, cycles
+ *   10    4    max     uint32, cycles
+ *   14    4    mean    uint32, cycles
+ *   18   4*n   hist    uint32 count of runs in each bucket (n = PROBE_BUCKETS)
+ *
+ *  On the host build the HAL stand-in runs the cycle counter from the host's monotonic clock at the core clock
+ *  rate, so benchmarks report in the same units as the robot.
+ */
+
+#ifndef INC_PROBE_H_
+#define INC_PROBE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+#define PROBE_TYPE_STATS 0x03 // first byte of a probe packet (telemetry frames start with TLM_TYPE_STATUS)
+
+// histogram bucket 0 counts runs of less than 2^(PROBE_BUCKET_SHIFT+1) cycles, bucket n counts runs of
+// 2^(n+PROBE_BUCKET_SHIFT) up to 2^(n+PROBE_BUCKET_SHIFT+1) cycles, and the last bucket counts all the longer runs
+#define PROBE_BUCKETS      16
+#define PROBE_BUCKET_SHIFT 4  // buckets from 0.5us up to 8ms at 64MHz
+
+#define PROBE_PACKET_SIZE (18+4*PROBE_BUCKETS)
+
+// the timed calls
+typedef enum PROBE_ID_t {
+	PROBE_SPEED_LOOP=0, // updateSpeedLoop (tick ISR)
+	PROBE_LOOP,         // a pass of the main loop
+	PROBE_IR,           // updateIRSensors
+	PROBE_MOTORS,       // updateMotors
+	PROBE_COMS,         // doComs
+	PROBE_CONTROLER,    // updateControler
+	PROBE_TELEMETRY,    // sendTelemetry
+
+	NUM_PROBES
+} PROBE_ID;
+
+// timing statistics of a probe
+typedef struct PROBE_STATS_t {
+	uint32_t runs;                // times the probe has run
+	uint32_t min;                 // fewest cycles taken
+	uint32_t max;                 // most cycles taken
+	uint64_t total;               // cycles taken by all the runs
+	uint32_t hist[PROBE_BUCKETS]; // runs in each bucket
+} PROBE_STATS;
+
+// time a statement with probe id
+#define PROBE(id,statement) do { uint32_t probe_start = probeStart(); statement; probeEnd((id),probe_start); } while(0)
+
+// read the cycle counter at the start of a timed statement
+static inline uint32_t probeStart(void) {
+	return DWT->CYCCNT;
+}
+
+void probeInit(void); // start the cycle counter and clear the stats
+void probeEnd(PROBE_ID id, uint32_t start); // add the cycles since start to the stats of probe id
+
+const PROBE_STATS * probeGetStats(PROBE_ID id); // get the stats of probe id
+void probeReset(PROBE_ID id); // clear the stats of probe id
+const char * probeName(PROBE_ID id);
+float probeCyclesToUs(float cycles); // convert cycles to us at the core clock
+
+// pack the stats of probe id into buf (at least PROBE_PACKET_SIZE bytes), returns packet length
+int probeEncode(PROBE_ID id, uint8_t * buf);
+// unpack a probe packet, returns false if it is not a valid probe packet (total is rebuilt from the mean)
+bool probeDecode(const uint8_t * buf, int len, PROBE_ID * id, PROBE_STATS * stats);
+
+#endif /* INC_PROBE_H_ */
@@ -0,0 +1,40 @@
+/*
+ * profile.h
+ *
+ *  Acceleration and jerk limited motion profiles
+ *
+ *  Plans a move of a given distance that starts and ends at rest, without going over the velocity,
+ *  acceleration and jerk limits. The velocity ramps up in up to three phases (jerk up, constant
+ *  acceleration, jerk down), cruises, and ramps down as a mirror image of the ramp up. With the jerk
+ *  set to 0 the ramps are straight (trapezoidal profile). A short move that cannot reach the velocity
+ *  limit (or the acceleration limit) uses a lower peak.
+ *
+ *  Units are those of the distance, so the same profile is used for linear (m) and angular (rad) moves.
+ */
+
+#ifndef INC_PROFILE_H_
+#define INC_PROFILE_H_
+
+#include <stdbool.h>
+
+// Define a planned motion profile
+typedef struct PROFILE_t {
+	float dist;  // distance to move (>= 0)
+	float vel;   // peak velocity
+	float acc;   // peak acceleration
+	float jerk;  // jerk (0 = trapezoidal)
+
+	float tj;    // time of each jerk phase (s)
+	float ta;    // time at constant acceleration (s)
+	float t_acc; // time to ramp up to the peak velocity (and to ramp down) (s)
+	float t_end; // total time of the move (s)
+} PROFILE;
+
+
+// plan a move of dist (magnitude is used) within the limits (max_jerk 0 for a trapezoidal profile)
+void profilePlan(PROFILE * p, float dist, float max_vel, float max_acc, float max_jerk);
+
+// get the position and velocity t seconds into the move, returns true once the move has ended
+bool profileEval(const PROFILE * p, float t, float * pos, float * vel);
+
+#endif /* INC_PROFILE_H_ */
@@ -0,0 +1,56 @@
+/*
+ * scheduler.h
+ *
+ *  Fixed rate task scheduler for the main loop
+ *
+ *  A 1ms timer interrupt (TIM17) releases each rate group at its period. The main loop
+ *  calls schedDue() to find out if a group has been released, and runs the group's tasks
+ *  if it has. Because releases come from the timer, the period of each group does not
+ *  drift with the time taken by the main loop. The wheel speed loop (updateSpeedLoop in motors.c) runs
+ *  in the tick ISR itself, so it runs at a steady 1kHz however long the main loop takes.
+ *
+ *  The scheduler measures the actual period between runs of each group (so the control code can use the
+ *  real DT), and keeps jitter and overrun statistics so the timing can be checked under load.
+ */
+
+#ifndef INC_SCHEDULER_H_
+#define INC_SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_TICK_US 1000 // scheduler timer interrupt period (us)
+#define SCHED_TIM htim17   // timer used to generate the scheduler tick
+
+// rate groups run by the main loop
+typedef enum SCHED_GROUP_t {
+	SG_MOTION=0,   // motion layer, pose, moves and paths (the wheel speed loop runs in the tick ISR)
+	SG_DEBOUNCE,   // edge sensor debounce filter
+	SG_TELEMETRY,  // send telemetry to the host
+	SG_LED,        // blink the status LED
+
+	NUM_SCHED_GROUPS
+} SCHED_GROUP;
+
+// timing statistics for a rate group
+typedef struct SCHED_STATS_t {
+	uint32_t runs;          // number of times the group has run
+	uint32_t overruns;      // releases missed because the group had not run since its last release
+	uint32_t period_us;     // last measured period between runs (us)
+	int32_t  jitter_min_us; // smallest deviation of measured period from nominal period (us)
+	int32_t  jitter_max_us; // largest deviation of measured period from nominal period (us)
+	uint32_t latency_max_us;// longest delay between release and the group running (us)
+} SCHED_STATS;
+
+void schedInit(void);  // start the scheduler timer
+void schedTick(void);  // called from the timer ISR to release rate groups
+
+bool schedDue(SCHED_GROUP group);  // returns true (once per release) if group should run now
+float schedDT(SCHED_GROUP group);  // measured time between the last two runs of group (s)
+
+uint32_t schedMicros(void); // time since scheduler start (us)
+
+const SCHED_STATS * schedGetStats(SCHED_GROUP group); // get timing statistics for group
+void schedResetStats(void); // clear timing statistics for all groups
+
+#endif /* INC_SCHEDULER_H_ */
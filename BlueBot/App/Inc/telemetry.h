@@ -0,0 +1,89 @@
+/*
+ * telemetry.h
+ *
+ *  Wire format for the robot status (telemetry) frame sent to the host
+ *
+ *  The frame is laid out byte by byte (little endian) so it does not depend on compiler padding
+ *  or the in-memory layout of the TELEMETRY struct. Values are packed as fixed point or half
+ *  precision floats where the resolution allows, so the 47 byte frame carries more than the 68 byte
+ *  raw struct the robot used to send (header, sequence number and loop timing included).
+ *  The probe timing stats are not in the frame, the host asks for them with UI_OP_PROBE (see probe.h).
+ *
+ *  Frame layout (TLM_VERSION 3, TLM_FRAME_SIZE bytes):
+ *
+ *   off  size  field
+ *    0    1    type            TLM_TYPE_STATUS
+ *    1    1    version         TLM_VERSION
+ *    2    2    seq             frame sequence number (wraps)
+ *    4    4    ticks           HAL tick (ms) when the frame was built
+ *    8    8    pid_left        ref, fb, u, I as half floats (error = ref - fb is not sent)
+ *   16    8    pid_right
+ *   24    4    enc_left.pos    int32, um
+ *   28    2    enc_left.vel    half float, rad/s
+ *   30    4    enc_right.pos
+ *   34    2    enc_right.vel
+ *   36    2    ir_range_short  uint16, 0.1cm (TLM_IR_NONE if no reading)
+ *   38    2    ir_range_long
+ *   40    1    clifs           edge sensor bits
+ *   41    2    pid_overruns    uint16 (saturates)
+ *   43    2    pid_jitter_min  int16, us (saturates)
+ *   45    2    pid_jitter_max
+ */
+
+#ifndef INC_TELEMETRY_H_
+#define INC_TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pid.h"
+#include "encoder.h"
+
+#define TLM_TYPE_STATUS 0x01 // robot status frame
+#define TLM_VERSION     3    // bump when the frame layout changes
+
+#define TLM_HEADER_SIZE 8
+#define TLM_FRAME_SIZE  47
+
+#define TLM_IR_NONE 0xFFFF // IR range value sent when the sensor has no valid reading
+
+// Data structure holding the robot state (telemetry) to be sent over the coms/wireless link to a host PC
+typedef struct telemetry_t {
+
+  /// PID State
+  PID_STATE pid_left;
+  PID_STATE pid_right;
+
+  // Encoder Status
+  ENCODER_STATE enc_left;
+  ENCODER_STATE enc_right;
+
+  // IR ranges
+  float ir_range_short;
+  float ir_range_long;
+
+  uint32_t clifs; // Bump sensor states
+
+  // motion layer (SG_MOTION) timing, the speed loop PIDs run from the tick ISR so do not jitter
+  uint32_t pid_overruns;   // motion updates missed
+  int32_t pid_jitter_min;  // smallest deviation from nominal motion period (us)
+  int32_t pid_jitter_max;  // largest deviation from nominal motion period (us)
+
+} TELEMETRY;
+
+// frame header
+typedef struct TLM_HEADER_t {
+	uint8_t type;
+	uint8_t version;
+	uint16_t seq;
+	uint32_t ticks;
+} TLM_HEADER;
+
+int tlmEncode(const TELEMETRY * tlm, uint16_t seq, uint32_t ticks, uint8_t * buf); // pack tlm into buf (at least TLM_FRAME_SIZE bytes), returns frame length
+bool tlmDecode(const uint8_t * buf, int len, TLM_HEADER * hdr, TELEMETRY * tlm); // unpack a frame, returns false if it is not a valid status frame
+
+// half precision float conversion
+uint16_t floatToHalf(float f);
+float halfToFloat(uint16_t h);
+
+#endif /* INC_TELEMETRY_H_ */
@@ -5,14 +5,57 @@
  *
  *  Receives and processes input commands and transmits robot status to a client
  *
+ *  A command packet is an opcode byte followed by the command's parameters (little endian):
+ *
+ *   - printable ASCII opcodes are the original single key commands (' ' stop, 'w' forward ...), they
+ *     have no parameters and any bytes after the opcode are ignored
+ *   - the UI_OP_ opcodes below carry typed parameters, and the packet must be exactly the size shown
+ *
+ *  Every command is answered with a response packet [UI_TYPE_RESPONSE][opcode][UI_STATUS]
+ *  UI_OP_PROBE also sends a probe packet (see probe.h) before its response
+ *
  *  Created on: Oct 15, 2020
  *      Author: Ralph Gnauck
  */
 
+#ifndef INC_UI_H_
+#define INC_UI_H_
+
 #include "motors.h"
 #include "encoder.h"
 #include "pid.h"
+#include "scheduler.h"
 
+#define UI_TYPE_RESPONSE 0x02 // first byte of a command response packet (telemetry frames start with TLM_TYPE_STATUS)
+
+// opcodes of commands with parameters
+typedef enum UI_OPCODE_t {
+	UI_OP_DRIVE     = 0x10, // float lin_vel (m/s), float ang_vel (rad/s)   - stream velocity setpoints (robot stops if they stop arriving)
+	UI_OP_DRIVE_TO  = 0x11, // float dist (m), float lin_vel (m/s)          - drive a distance forwards (+) or backwards (-)
+	UI_OP_TURN_TO   = 0x12, // float angle (rad), float ang_vel (rad/s)     - turn an angle left (+) or right (-)
+	UI_OP_GRIPPER   = 0x13, // uint16 pos (GRIPPER_UP - GRIPPER_DOWN)       - set gripper servo position
+	UI_OP_PID_GAINS = 0x14, // float kp, float ki                           - set the wheel PID gains
+	UI_OP_OPEN_LOOP = 0x15, // uint8 open (0 closed loop, 1 open loop)      - set the wheel PID mode
+	UI_OP_STREAM_TIMEOUT = 0x16, // uint16 timeout (ms, 20-5000)            - set the UI_OP_DRIVE stream watchdog timeout
+	UI_OP_PID_FF    = 0x17, // float kf, float deadband, float slew         - set the wheel PID feed-forward and setpoint slew limit
+	UI_OP_SET_POSE  = 0x18, // float x (m), float y (m), float heading (rad) - set the odometry pose (send while stopped)
+	UI_OP_MOVE_LIMITS = 0x19, // float lin_acc, float lin_jerk, float ang_acc, float ang_jerk - set the driveTo/turnTo profile limits (jerk 0 = trapezoidal)
+	UI_OP_HEADING_HOLD = 0x1A, // float kh (1/s), float ky (1/m^2)         - set the driveTo heading and cross track steering gains (0 = off)
+	UI_OP_WAYPOINT  = 0x1B, // float x (m), float y (m)                     - add a waypoint to the path queue (NACK if the queue is full)
+	UI_OP_FOLLOW_PATH = 0x1C, // float lin_vel (m/s), float lookahead (m)   - follow the path through the queued waypoints
+	UI_OP_CLEAR_PATH = 0x1D, //                                             - empty the path queue (a path being followed ends)
+	UI_OP_PROBE     = 0x1E, // uint8 probe (PROBE_ID), uint8 reset (1 to clear the stats once sent) - send the timing stats of a probe
+
+	UI_NUM_OPCODES  = 0x80  // opcodes are 7 bit
+} UI_OPCODE;
+
+// result of a command, returned in the response packet
+typedef enum UI_STATUS_t {
+	UI_ACK=0,          // command accepted
+	UI_NACK_UNKNOWN,   // opcode not recognized
+	UI_NACK_LENGTH,    // wrong parameter size for the opcode
+	UI_NACK_RANGE      // a parameter was out of range, command ignored
+} UI_STATUS;
 
 void doUI(uint8_t * packet, int len, MotorEvent *event); // Process an input packet and respond to commands
 void sendTelemetry(void); // send robot telemetry to client
@@ -22,3 +65,6 @@ void setPIDState(PID_STATE * pid_left, PID_STATE * pid_right);// save current PI
 void setMotorState(void);// save current motor state info
 void setControlerState(void);// save current controller state info
 void setIRRangeState(float range_long, float range_short); // save current ir sensor state info
+void setSchedulerState(const SCHED_STATS * pid_stats); // save current PID loop timing info
+
+#endif /* INC_UI_H_ */
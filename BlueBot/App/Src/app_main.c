@@ -25,41 +25,68 @@
 #include "coms.h"
 #include "ui.h"
 #include "gripper.h"
+#include "scheduler.h"
+#include "events.h"
+#include "probe.h"
+#include "ccmram.h"
 
 
 
-#define TICK_RATE 10 // main timer resolution 10ms
-
-#define LED_BLINK_RATE 50 // 50*10ms = 1/2 second
-#define PID_RATE       2  // 2*10ms = 0.02 second (50Hz)
-
-#define DT (((float)(TICK_RATE*PID_RATE))/1000.0f) // compute sample time for PID in seconds
+#define DT ((float)(SPEED_LOOP_TICKS*SCHED_TICK_US)*1.0e-6f) // sample time for PID in seconds (the speed loop period, set again by setSpeedLoopRate)
 
 // PID Tunings
 #define KP 0.067f // 0.1064// 0.065
 #define KI 1.0f   // 0.1242 //2.0
+#define KF 0.0f   // feed-forward duty per rad/s (0 until measured on the robot)
+#define DEADBAND 0.0f // feed-forward duty to overcome the motor deadband
+#define SLEW 0.0f // setpoint slew limit rad/s^2 (0 = off)
 
 
 
 
 // declare the PID state variables
-PID pid_right = {KP,KI,DT,false,"Right", {0.0f,0.0f,0.0f,0.0f,0.0f}};
-PID pid_left  = {KP,KI,DT,false,"Left", {0.0f,0.0f,0.0f,0.0f,0.0f}};
+CCMRAM_DATA PID pid_right = {KP,KI,KF,DEADBAND,SLEW,DT,false,true,"Right", {0.0f,0.0f,0.0f,0.0f,0.0f}};
+CCMRAM_DATA PID pid_left  = {KP,KI,KF,DEADBAND,SLEW,DT,false,true,"Left", {0.0f,0.0f,0.0f,0.0f,0.0f}};
 
 // declare the encoder state variables
-ENCODER enc_right = {0,0.0f,1,&htim1,"Right",{0.0f,0.0f}};
-ENCODER enc_left  = {0,0.0f,-1,&htim2,"Left",{0.0f,0.0f}};
+CCMRAM_DATA ENCODER enc_right = {0,1,&htim1,"Right",{0.0f,0.0f,0.0f}};
+CCMRAM_DATA ENCODER enc_left  = {0,-1,&htim2,"Left",{0.0f,0.0f,0.0f}};
+
+
 
+// ISR callback when a timer period has elapsed (scheduler tick or encoder timer overflow)
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
+
+	if(htim == &SCHED_TIM) {
+		schedTick();
+		PROBE(PROBE_SPEED_LOOP,updateSpeedLoop()); // run the wheel speed loop from the timer so its period is steady
+	}
+	else if(htim == enc_right.htim) {
+		encoderOverflow(&enc_right);
+	}
+	else if(htim == enc_left.htim) {
+		encoderOverflow(&enc_left);
+	}
+}
 
+// ISR callback for the EXTI lines (encoder A channel edges and edge sensors going over an edge)
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
 
+	if(GPIO_Pin == ENC1_A_Pin) {
+		encoderEdge(&enc_left);
+	}
+	else if(GPIO_Pin == ENC2_A_Pin) {
+		encoderEdge(&enc_right);
+	}
+	else if(GPIO_Pin == CLIFF_1_Pin || GPIO_Pin == CLIFF_2_Pin) {
+		edgeSensorEdge(GPIO_Pin);
+	}
+}
 
 // main app loop - runs forever
 void app_main(void) {
 
-
-    // Setup timers for blinky LED and running the motor control PID loop
-	uint32_t ledTimer=LED_BLINK_RATE;
-	uint32_t pidTimer=PID_RATE;
+	probeInit(); // start the cycle counter that times the hot paths
 
 	// start the PWM outputs
 	HAL_TIM_PWM_Start(&htim3,TIM_CHANNEL_1);
@@ -72,71 +99,65 @@ void app_main(void) {
 	// Start the encoder input timers
 	HAL_TIM_Encoder_Start(&htim2,TIM_CHANNEL_ALL);
 	HAL_TIM_Encoder_Start(&htim1,TIM_CHANNEL_ALL);
+	encoderInit(); // time the encoder edges for the low speed velocity estimate
+	setSpeedLoopRate(SPEED_LOOP_TICKS); // set the encoder and PID periods for the speed loop (it starts with the scheduler)
 
 
 	//printf("E-Carnival Robot Ready\r\n");
 
-	uint32_t tick = HAL_GetTick(); // init the main timer, timing based on HAL_TICKS (1ms) intervals
-
 	setGripper(GRIPPER_UP); // start with gripper in the up position
 
+	edgeSensorInit(); // stop the motors from the sensor pin interrupts as soon as a sensor goes over an edge
 	enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // enable the edge/drop sensors so we don't go over the edge of the table
 	adc_init(); // start the ADC for the IR range sensors
+	comsInit(); // start receiving commands from the host
 
-	// now do this forever
-	while(1) {
-
-		uint32_t tock = HAL_GetTick(); // get timer ticks (1ms per tick)
-
-
-		bool pid_update=false;     // flag to say if we should update the PID this time through the loop
-		bool send_telemetry=false; // flag to say if we should send updated telemetry data to host this time through the loop
-
-		if(tock-tick > TICK_RATE) { // 10ms timer (this 'if' is true once every 10ms)
+	controlerInit(); // start the robot state machine in idle
 
-			ledTimer--; // blink LED at LED_BLINK_RATE
-			if(ledTimer==0) {
-				ledTimer=LED_BLINK_RATE;
-				HAL_GPIO_TogglePin(LED_GPIO_Port,LED_Pin);
+	schedInit(); // start the timer that releases the fixed rate tasks
 
-			}
+	// now do this forever
+	while(1) {
 
-			pidTimer --; // see if we should run the PID update this time through the loop
-			if(pidTimer==0) {
-				pidTimer=PID_RATE; //
-				pid_update=true;     // flag to update PID this time
-                send_telemetry=true; // also send new telemetry after we update the PID
+		uint32_t loop_start = probeStart();
 
-			}
+		if(schedDue(SG_LED)) { // blink LED
+			HAL_GPIO_TogglePin(LED_GPIO_Port,LED_Pin);
+		}
 
+		if(schedDue(SG_DEBOUNCE)) {
 			updateEdgeSensors(); // update de-bounced states of edge sensors (run debounce filter at 10ms rate)
-
-
-			tick=tock; // update main timer for next period
 		}
 
-		updateIRSensors(); // update the IR sensor readings
+		bool motion_update = schedDue(SG_MOTION); // flag to say if we should update the pose and moves this time through the loop
+
+		PROBE(PROBE_IR,updateIRSensors()); // update the IR sensor readings
 
 		setIRRangeState(getLongRangeIR(),getShortRangeIR()); // save IR values to telemetry
 
 		// update the motor controller state (handles driving to distance/turns etc)
-		// will also update the PID controller if the flag is set
-		MotorEvent event = updateMotors(pid_update,DT); // returns events flags if state changed or edge sensor triggered etc
+		// will also update the pose and moves if the flag is set, using the measured time since the last update
+		// (the wheel speed PIDs run from the scheduler tick)
+		// queues any events raised, like the end of a move or an edge sensor trigger
+		PROBE(PROBE_MOTORS,eventPost(updateMotors(motion_update,schedDT(SG_MOTION))));
 
 
-		if(pid_update) {  // if we updated the PID this time round  then update the telemetry with new STATE of PID and encoders
+		if(motion_update) {  // if we updated the motion layer this time round then update the telemetry with new STATE of PID and encoders
 			setPIDState(&pid_left.state,&pid_right.state);
 			setEncoderState(&enc_left.state,&enc_right.state);
+			setSchedulerState(schedGetStats(SG_MOTION));
 		}
 
-		event |= doComs(); // process the input UART and get any events raised by the UI
+		PROBE(PROBE_COMS,eventPost(doComs())); // process the input UART and queue any events raised by the UI
 
-		updateControler(event); // update the main state machine (giving it any events that should be handled)
+		PROBE(PROBE_CONTROLER,updateControler()); // update the main state machine (handling each queued event in turn)
 
-		if(send_telemetry) { // if flag is set send new telemetry data to the host
-			sendTelemetry();
+		if(schedDue(SG_TELEMETRY)) { // if due send new telemetry data to the host
+			PROBE(PROBE_TELEMETRY,sendTelemetry());
 		}
 
+		probeEnd(PROBE_LOOP,loop_start);
+
 	}
 
 }
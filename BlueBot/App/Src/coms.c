@@ -16,12 +16,16 @@
  *      Author: Ralph Gnauck
  */
 
+#include <string.h>
+
 #include "coms.h"
 #include "pid.h"
 #include"encoder.h"
 #include "motors.h"
 #include "usart.h"
 #include "ui.h"
+#include "crc16.h"
+#include "ccmram.h"
 
 // declare special characters used by protocol
 #define SLIP_END 0xC0
@@ -33,38 +37,138 @@
 
 #define COMS_UART huart1 // map the UART to use for the COMS stream
 
-// Define STATE Variable values for SLIP decoding state machine
-typedef enum SLIP_RX_STATE_t {
-    SRX_IDLE=0,
-    SRX_ESC,
-    SRX_CHAR
-} SLIP_RX_STATE;
-
-// mintain the state of the decoded packet
-static SLIP_RX_STATE slip_rx_state=SRX_IDLE; // parser state machine state
-static int rx_idx=0; // input buffer offset to store next decoded character
+static CCMRAM_DATA SLIP_DECODER coms_decoder; // state of the packet being received
 
 // Buffers for the module to use to encode and decode SLIP packets
-#define PACKET_SIZE 128
-static uint8_t coms_in_buffer[PACKET_SIZE];
-static uint8_t coms_out_buffer[PACKET_SIZE];
+#define PACKET_SIZE COMS_PACKET_SIZE
+#define FRAME_SIZE (PACKET_SIZE+COMS_FRAME_OVERHEAD)
+static CCMRAM_DATA uint8_t coms_in_buffer[FRAME_SIZE];
+
+// frame sequence numbers
+static uint8_t tx_seq=0;         // seq of next frame sent
+static uint8_t rx_seq=0;         // seq of last good frame received (sent back as the ack)
+static bool rx_seq_valid=false;  // true once a frame has been received
+
+// Transmit buffers - one is being sent by the DMA while the next frames are encoded into the others and queued
+// a frame can double in size when every byte is escaped, plus the START and END characters
+#define TX_BUF_SIZE SLIP_MAX_ENCODED(FRAME_SIZE)
+#define TX_NUM_BUFS 3
+#define TX_NONE (-1) // no buffer
+#define TX_ALL_FREE ((1 << TX_NUM_BUFS) - 1)
+
+static uint8_t coms_out_buffer[TX_NUM_BUFS][TX_BUF_SIZE];
+static uint16_t coms_out_len[TX_NUM_BUFS];
+static bool coms_out_coalesce[TX_NUM_BUFS]; // frame can be replaced by a newer one while it is queued
+
+static volatile int tx_busy_buf=TX_NONE;         // buffer being sent by the DMA
+static volatile int tx_queue[TX_NUM_BUFS];       // buffers waiting for the DMA, oldest first
+static volatile int tx_queued=0;                 // number of buffers in tx_queue
+static volatile uint32_t tx_free=TX_ALL_FREE;    // bit set for each buffer not in use
+
+// Receive ring buffer - filled by DMA in circular mode
+// must hold all the bytes that can arrive between main loop passes (1024 bytes is ~22ms at 460800 baud, the
+// longest pass is ~15ms, a 5ms pass with a 10ms stall as modelled by the doComs(line rate) benchmark)
+#define RX_RING_SIZE 1024 // must be a power of 2 so the running byte counts stay consistent when they wrap
+static uint8_t rx_ring[RX_RING_SIZE];
+
+static volatile uint32_t rx_laps=0;     // number of times DMA has wrapped around the ring (updated by ISR)
+static volatile uint32_t rx_restarts=0; // number of times DMA reception has been restarted after an error (updated by ISR)
+static volatile uint32_t rx_aborted=0;  // running count of bytes the DMA had written when reception was restarted (updated by ISR)
+static uint32_t rx_seen_restarts=0;     // value of rx_restarts when the ring was last read
+static uint32_t rx_seen_aborted=0;      // value of rx_aborted when the ring was last read
+static uint32_t rx_read_count=0;        // running count of bytes read from the ring
+
+static COMS_STATS coms_stats; // link statistics
 
 // local prototypes
-static int read_uart(void);
+static uint32_t rxWriteCount(uint32_t read_count);
+static void startTx(void);
+static void doFrame(uint8_t * frame, int len, MotorEvent * event);
+static int slipEscape(const uint8_t * buf, int len, uint8_t * out, int tx_idx);
+
+
+// start the DMA receiving into the ring buffer, and reset the transmit queue and link statistics
+void comsInit(void) {
+
+	rx_laps=0;
+	rx_read_count=0;
+	rx_seen_restarts=rx_restarts;
+	rx_seen_aborted=rx_aborted;
+
+	tx_busy_buf=TX_NONE;
+	tx_queued=0;
+	tx_free=TX_ALL_FREE;
 
+	tx_seq=0;
+	rx_seq=0;
+	rx_seq_valid=false;
+	coms_decoder.state=SRX_IDLE;
+
+	memset(&coms_stats,0,sizeof(coms_stats));
+
+	HAL_UART_Receive_DMA(&COMS_UART,rx_ring,RX_RING_SIZE); // circular mode is set up in CubeMX, so this never completes
+}
 
 // called from main loop to process incoming data from the COMS UART
-// when a full input packet is received it is passed to the UI module to be processed
+// all data that has been received since the last call is decoded
+// when a full input frame is received it is checked and the packet it carries is passed to the UI module to be processed
 // If the UI generates an event it is returned from this function
 MotorEvent doComs(void) {
 
 	MotorEvent event=0;
-	int c = read_uart(); // get char from UART (if any)
-	if(c != -1) { // check if valid
 
-		int in_len; // gets set to length of decoded input packet by slipDecode if a complete packet is received
-		if(slipDecode((uint8_t)c,PACKET_SIZE,coms_in_buffer,&in_len)) { // add decoded data to the input buffer
-			doUI(coms_in_buffer,in_len,&event); // got end of packet so pass it to UI module
+	if(__HAL_UART_GET_FLAG(&COMS_UART, UART_FLAG_IDLE)) { // line has gone idle since last pass (end of a burst)
+		__HAL_UART_CLEAR_IDLEFLAG(&COMS_UART);
+		coms_stats.rx_idle++;
+	}
+
+	// take a consistent copy of the restart count and the DMA write position, read again if the error ISR
+	// restarted reception while we were reading them
+	uint32_t restarts;
+	uint32_t aborted;
+	uint32_t write_count;
+	do {
+		restarts = rx_restarts;
+		aborted = rx_aborted;
+		write_count = rxWriteCount((restarts == rx_seen_restarts)?rx_read_count:0);
+	} while(restarts != rx_restarts);
+
+	if(restarts != rx_seen_restarts) { // DMA was restarted after an error, so it is writing from the start of the ring again
+		uint32_t unread = aborted - rx_seen_aborted - rx_read_count; // bytes written before the restart(s) that were not read
+		if((int32_t)unread > 0) {
+			coms_stats.rx_lost += unread;
+		}
+		rx_seen_restarts = restarts;
+		rx_seen_aborted = aborted;
+		rx_read_count = 0;
+	}
+
+	uint32_t avail = write_count - rx_read_count; // bytes waiting in the ring
+
+	if(avail == 0) {
+		return event;
+	}
+
+	if(avail > RX_RING_SIZE) { // DMA has lapped the reader, the oldest data has been overwritten
+		coms_stats.rx_lost += avail - RX_RING_SIZE;
+		rx_read_count += avail - RX_RING_SIZE;
+		avail = RX_RING_SIZE;
+	}
+
+	coms_stats.rx_bytes += avail;
+	coms_stats.rx_passes++;
+	if(avail > coms_stats.rx_max_pass) {
+		coms_stats.rx_max_pass = avail;
+	}
+
+	while(avail--) {
+
+		uint8_t c = rx_ring[rx_read_count % RX_RING_SIZE]; // get next char from the ring
+		rx_read_count++;
+
+		int in_len; // gets set to length of decoded input frame by slipDecode if a complete frame is received
+		if(slipDecode(&coms_decoder,c,FRAME_SIZE,coms_in_buffer,&in_len)) { // add decoded data to the input buffer
+			doFrame(coms_in_buffer,in_len,&event); // got end of frame so check it and pass the packet to the UI module
 		}
 	}
 
@@ -72,54 +176,93 @@ MotorEvent doComs(void) {
 
 }
 
+// check a received frame and pass the packet it carries to the UI module
+static void doFrame(uint8_t * frame, int len, MotorEvent * event) {
+
+	if(!slipCheckFrame(frame,len)) { // corrupted, don't act on it
+		coms_stats.rx_crc_errors++;
+		return;
+	}
+
+	uint8_t seq = frame[0];
+	if(rx_seq_valid) {
+		coms_stats.rx_seq_gaps += (uint8_t)(seq - rx_seq - 1); // frames skipped since the last good one
+	}
+	rx_seq = seq;
+	rx_seq_valid = true;
+	coms_stats.rx_frames++;
+
+	int packet_len = len - COMS_FRAME_OVERHEAD;
+	if(packet_len > 0) { // empty packets just carry the ack
+		doUI(frame+COMS_HDR_SIZE,packet_len,event);
+	}
+}
+
+// check the length and CRC of a decoded frame
+bool slipCheckFrame(const uint8_t * frame, int len) {
+
+	if(len < COMS_FRAME_OVERHEAD) {
+		return false;
+	}
+
+	uint16_t crc = frame[len-2] | (frame[len-1] << 8);
+
+	return crc16(frame,len-COMS_CRC_SIZE) == crc;
+}
+
+// get the link statistics
+const COMS_STATS * comsGetStats(void) {
+	return &coms_stats;
+}
+
 
 // decode the data passed into the function
 // characters (c) from a slip encoded stream should be passed to this function one at a time
-// the function maintains an internal state of the encoded packet.
+// the state of the packet being decoded is kept in dec.
 // When a valid packet is fully parsed it will return true.
 // the decoded characters are stored in the buffer slipInPacket supplied by the caller
 // size should be set to the max length of the buffer pointed to by slipInPacket
 // when a complete input packet is parsed out_len is updated to the length of the decoded packet and the function returns true
 //
-// NOTE - only one packet can be decoded at once as the global variables rx_idx and slip_rx_state are used to maintain the state of the packet being decoded.
+// dec holds the state of the packet being decoded, so separate streams can be decoded at once using different decoders
 //
-bool slipDecode(uint8_t c, int size, uint8_t * slipInPacket, int * out_len) {
+CCMRAM_CODE bool slipDecode(SLIP_DECODER * dec, uint8_t c, int size, uint8_t * slipInPacket, int * out_len) {
 
    *out_len=0;
 
-   if(rx_idx >= size) { // make sure we don't over run the supplied buffer, ignore current packet and reset for new packet if we do
-       slip_rx_state=SRX_IDLE;
-       rx_idx=0;
+   if(dec->idx >= size) { // make sure we don't over run the supplied buffer, ignore current packet and reset for new packet if we do
+       dec->state=SRX_IDLE;
+       dec->idx=0;
    }
 
-   switch(slip_rx_state) {
+   switch(dec->state) {
 
        case SRX_IDLE: // wait till we see a START char to begin decodeing data
-           rx_idx = 0;
+           dec->idx = 0;
            if ( c == SLIP_START) {
-               slip_rx_state = SRX_CHAR;
+               dec->state = SRX_CHAR;
            }
            break;
 
        case SRX_ESC: // if we just got an ESC, decode the character that was sent
 
            if (c == SLIP_ESC_ESC) { // decode escaped ESC
-              slipInPacket[rx_idx++] = SLIP_ESC;
-              slip_rx_state = SRX_CHAR;
+              slipInPacket[dec->idx++] = SLIP_ESC;
+              dec->state = SRX_CHAR;
            }
 
            else if (c == SLIP_ESC_END) {  // decode escaped END
-               slipInPacket[rx_idx++]  = SLIP_END;
-               slip_rx_state = SRX_CHAR;
+               slipInPacket[dec->idx++]  = SLIP_END;
+               dec->state = SRX_CHAR;
            }
 
            else if (c == SLIP_ESC_START) {   // decode escaped START
-               slipInPacket[rx_idx++]  = SLIP_START;
-               slip_rx_state= SRX_CHAR;
+               slipInPacket[dec->idx++]  = SLIP_START;
+               dec->state= SRX_CHAR;
            }
 
            else {
-              slip_rx_state = SRX_IDLE; // unexpected character - ignore packet and wait for next one
+              dec->state = SRX_IDLE; // unexpected character - ignore packet and wait for next one
            }
 
            break;
@@ -127,19 +270,19 @@ bool slipDecode(uint8_t c, int size, uint8_t * slipInPacket, int * out_len) {
        case SRX_CHAR: // got character, check if it is a special character
 
            if (c == SLIP_END) { // found an end char so return true and set out_len
-               *out_len=rx_idx; // return size of packet to caller
-               rx_idx= 0;  // reset for next packet
-               slip_rx_state = SRX_IDLE;
+               *out_len=dec->idx; // return size of packet to caller
+               dec->idx= 0;  // reset for next packet
+               dec->state = SRX_IDLE;
                return true; // return true to say we got a full packet
            }
            else if (c == SLIP_ESC) { // its an ESC so goto the ESC state to decode next character
-               slip_rx_state = SRX_ESC;
+               dec->state = SRX_ESC;
            }
-           else if (c == SLIP_START) { // got unexpected start, ignore packet and wiat till next
-               slip_rx_state = SRX_IDLE;
+           else if (c == SLIP_START) { // got unexpected start, the end of the last packet was lost so start again with this one
+               dec->idx = 0;
            }
            else {
-               slipInPacket[rx_idx++]  = c; // just a normal char- save in the decoded buffer
+               slipInPacket[dec->idx++]  = c; // just a normal char- save in the decoded buffer
            }
 
            break;
@@ -151,17 +294,87 @@ bool slipDecode(uint8_t c, int size, uint8_t * slipInPacket, int * out_len) {
 
 
 // Helper macro to put character in output buffer
-#define SLIP_SEND(c)	coms_out_buffer[tx_idx++] = c
+#define SLIP_SEND(c)	out[tx_idx++] = c
 
-// encodes and transmits a packet of data in slip format.
+// frames and transmits a packet of data in slip format.
 // buf points to the buffer with the raw data
 // len - length in bytes of the data buffer
-// encoded packet is sent out over the COMS uart
-void slipEncode(uint8_t * buf, int len)  {
+// encoded frame is sent out over the COMS uart
+// if the UART is still sending a frame the packet is queued, and sent when the frames ahead of it complete.
+// coalesce should be true for packets that only hold the latest state (telemetry). A newer one of these
+// replaces the last queued frame if that frame can also be coalesced and has not started yet.
+// Other packets (command responses) are always queued, or dropped if there is no free buffer.
+void slipEncode(uint8_t * buf, int len, bool coalesce)  {
+
+    int b=TX_NONE;
+    uint8_t seq;
+
+    __disable_irq(); // stop the TX complete ISR changing the queue while we take a buffer
+
+    if(len > PACKET_SIZE) { // encoded frame may not fit in the buffer
+        coms_stats.tx_dropped++;
+        __enable_irq();
+        return;
+    }
+
+    if(coalesce && tx_queued > 0 && coms_out_coalesce[tx_queue[tx_queued-1]]) { // replace the last queued frame, and reuse its seq
+        b = tx_queue[--tx_queued];
+        seq = tx_seq-1;
+        coms_stats.tx_coalesced++;
+    }
+    else {
+        for(int i=0; i < TX_NUM_BUFS; i++) { // find a free buffer
+            if(tx_free & (1 << i)) {
+                tx_free &= ~(1 << i);
+                b = i;
+                break;
+            }
+        }
+        if(b == TX_NONE) {
+            coms_stats.tx_dropped++;
+            __enable_irq();
+            return;
+        }
+        seq = tx_seq++;
+    }
+
+    __enable_irq();
+
+    coms_out_len[b] = slipEncodeFrame(buf,len,seq,rx_seq,coms_out_buffer[b]);
+    coms_out_coalesce[b] = coalesce;
+
+    __disable_irq();
+    tx_queue[tx_queued++] = b;
+    startTx(); // transmit the encoded frame using DMA if the UART is free
+    __enable_irq();
+}
+
+// build a slip encoded frame holding a packet of data
+// out must hold SLIP_MAX_ENCODED(len+COMS_FRAME_OVERHEAD) bytes
+// returns the length of the encoded frame
+int slipEncodeFrame(const uint8_t * buf, int len, uint8_t seq, uint8_t ack, uint8_t * out) {
 int tx_idx=0;
 
+    uint8_t hdr[COMS_HDR_SIZE] = { seq, ack };
+
+    uint16_t crc = crc16Update(crc16(hdr,COMS_HDR_SIZE),buf,len);
+    uint8_t trailer[COMS_CRC_SIZE] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+
     SLIP_SEND(SLIP_START); // Add Slip start character
 
+    tx_idx = slipEscape(hdr,COMS_HDR_SIZE,out,tx_idx);
+    tx_idx = slipEscape(buf,len,out,tx_idx);
+    tx_idx = slipEscape(trailer,COMS_CRC_SIZE,out,tx_idx);
+
+    SLIP_SEND(SLIP_END); // ADD Slip END to terminate the packet
+
+    return tx_idx;
+}
+
+// add data to an encoded frame, escaping the special characters
+// returns the new length of the frame
+static int slipEscape(const uint8_t * buf, int len, uint8_t * out, int tx_idx) {
+
     for(int idx=0; idx < len; idx++) {
 
         int c = *buf++;
@@ -183,37 +396,98 @@ int tx_idx=0;
         }
     }
 
-    SLIP_SEND(SLIP_END); // ADD Slip END to terminate the packet
+    return tx_idx;
+}
+
+// if the UART is free start the DMA sending the next queued frame (called with the TX complete ISR blocked, or from the ISR)
+static void startTx(void) {
+
+	while(tx_busy_buf == TX_NONE && tx_queued > 0) {
+
+		int b = tx_queue[0];
+		tx_queued--;
+		for(int i=0; i < tx_queued; i++) {
+			tx_queue[i] = tx_queue[i+1];
+		}
 
+		tx_busy_buf = b;
 
-    HAL_UART_Transmit_DMA(&COMS_UART,coms_out_buffer,tx_idx); // transmit the encoded packet using DMA
+		if(HAL_UART_Transmit_DMA(&COMS_UART,coms_out_buffer[b],coms_out_len[b]) != HAL_OK) {
+			tx_busy_buf = TX_NONE;
+			tx_free |= 1 << b;
+			coms_stats.tx_dropped++;
+		}
+	}
 }
 
 
-// Read a character from the COMS Uart
-// returns the character if it can be read
-// returns -1 if no characters have been received
-int read_uart(void) {
+// get running count of bytes written into the ring by the DMA since reception was started
+// the DMA counter (NDTR) counts down the bytes left before it wraps to the start of the ring
+// read_count is the running count of bytes read, used to spot a wrap the ISR has not counted yet
+static uint32_t rxWriteCount(uint32_t read_count) {
 
-	if(__HAL_UART_GET_FLAG(&COMS_UART, UART_FLAG_RXNE)) { // see if UART has a character
-		uint8_t ch=0;
+	uint32_t laps;
+	uint32_t remaining;
 
-		__HAL_UART_CLEAR_FEFLAG(&COMS_UART); // clear status and error flags (ignoring errors !)
-		__HAL_UART_CLEAR_OREFLAG(&COMS_UART);
-		__HAL_UART_CLEAR_PEFLAG(&COMS_UART);
+	do { // re-read if the ISR counted a wrap while we were reading the DMA counter
+		laps = rx_laps;
+		remaining = __HAL_DMA_GET_COUNTER(COMS_UART.hdmarx);
+	} while(laps != rx_laps);
 
-		HAL_StatusTypeDef sts = HAL_UART_Receive(&COMS_UART,&ch,1,1); // read the character
-		if(sts == HAL_OK) {
-			return (int)ch; // if ok return the character
-		}
+	uint32_t count = laps*RX_RING_SIZE + (RX_RING_SIZE - remaining);
+
+	if((int32_t)(count - read_count) < 0) { // DMA has wrapped but the ISR has not run yet
+		count += RX_RING_SIZE;
 	}
-	return -1; // nothing to read or error
+
+	return count;
 }
 
+// UART error - in DMA mode the HAL aborts reception on any receive error, so count it and restart
+// a DMA transmit error aborts the frame being sent, so drop it and send the queued one
 void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
-  // should do something here
+
+	if(huart == &COMS_UART) {
+
+		if(huart->ErrorCode & HAL_UART_ERROR_ORE) {
+			coms_stats.rx_overruns++;
+		}
+		else if(!(huart->ErrorCode & HAL_UART_ERROR_DMA)) {
+			coms_stats.rx_errors++;
+		}
+
+		if(huart->RxState == HAL_UART_STATE_READY) { // reception was aborted, the bytes written so far are left in the ring
+			rx_aborted += rx_laps*RX_RING_SIZE + (RX_RING_SIZE - __HAL_DMA_GET_COUNTER(huart->hdmarx));
+			rx_laps=0;
+			rx_restarts++;
+			HAL_UART_Receive_DMA(&COMS_UART,rx_ring,RX_RING_SIZE);
+		}
+
+		if(huart->gState == HAL_UART_STATE_READY && tx_busy_buf != TX_NONE) { // transmit was aborted, lose that frame and move on
+			coms_stats.tx_dropped++;
+			tx_free |= 1 << tx_busy_buf;
+			tx_busy_buf = TX_NONE;
+			startTx();
+		}
+	}
+}
+
+// DMA has filled the ring and wrapped back to the start
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+
+	if(huart == &COMS_UART) {
+		rx_laps++;
+	}
 }
 
+// DMA has finished sending a frame, start the next queued one (if any)
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
-  // don't need to know if packet has finished being sent
+
+	if(huart == &COMS_UART && tx_busy_buf != TX_NONE) {
+
+		coms_stats.tx_frames++;
+		tx_free |= 1 << tx_busy_buf;
+		tx_busy_buf = TX_NONE;
+		startTx();
+	}
 }
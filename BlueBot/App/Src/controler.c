@@ -3,14 +3,21 @@
  *
  *  Implements the main robot state machine controller
  *
+ *  The behaviours are tables of states and transitions run by the state machine engine (fsm.h).
+ *  Level 1 drives forward until an edge is found, backs up, turns away from the edge and carries on.
+ *  Edges are handled once in ST_M1_EDGE for both the driving and turning states, and the edge sensors are
+ *  switched off on entry to ST_M1_BACKUP and back on when it is left (however it is left).
+ *
  *  Created on: Oct 1, 2020
  *      Author: Ralph Gnauck
  */
 
 
+#include "main.h"
 #include "controler.h"
 #include "edge_sensor.h"
 #include "motors.h"
+#include "events.h"
 
 // define the speeds used to implement robot behaviors
 #define FWD_SPEED 0.1f
@@ -23,150 +30,134 @@ extern const float M_PI_F; // use only float math version of PI
 #define BACK_DIST (-0.04f)
 #define TURN_ANG (M_PI_F/2.0f)
 
-// define states of the state machine
-typedef enum State_t {
+// time allowed for a backup or turn to finish before giving up and stopping (ms)
+#define MOVE_TIMEOUT_MS 5000
+
+// events handled by the state machine, the transition tables are indexed by these
+// (the MotorEvent flags in bit order, after the state timeout)
+typedef enum CTRL_EVENT_t {
+	EV_TIMEOUT=FSM_EV_TIMEOUT, // state timeout expired
+	EV_STOP,       // ME_STOP
+	EV_DONE_TURN,  // ME_DONE_TURN
+	EV_DONE_DRIVE, // ME_DONE_DRIVE
+	EV_BUMP_LEFT,  // ME_BUMP_LEFT
+	EV_BUMP_RIGHT, // ME_BUMP_RIGHT
+	EV_M1,         // CE_M1
+	EV_M2,         // CE_M2
+	EV_M3,         // CE_M3
+	EV_DONE_PATH,  // ME_DONE_PATH
+
+	NUM_EVENTS
+} CTRL_EVENT;
+
+
+// actions
+static void stopMotors(void) {
+	STOP();
+}
 
-	ST_IDLE=0, // stopped , waiting for a command
+static void driveForward(void) {
+	drive(FWD_SPEED,0.0f);
+}
 
+static void startBackup(void) {
+	disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // Disable sensors so we can backup
+	driveTo(BACK_DIST,BACK_SPEED);
+}
 
-	// states to implement level 1 challenge
-	ST_M1_FWD, // drive forward
-	ST_M1_BCK_L, // backup and turn left
-	ST_M1_BCK_R, // backup and turn right
-	ST_M1_TURN,  // turning
+static void endBackup(void) {
+	enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // re-enable edge sensors before we start turning
+}
 
-	// states to implement level 2 challenge (not implemented)
-	ST_M2,
+static void turnLeft(void) {
+	turnTo(TURN_ANG,TURN_SPEED);
+}
 
-	// states to implement level 3 challenge (not implemented)
-	ST_M3,
+static void turnRight(void) {
+	turnTo(-TURN_ANG,TURN_SPEED);
+}
 
-	// states to implement victory dance at completion of challenge level (not implemented)
-	ST_COMPLETE
 
-} STATE;
+// transition tables, indexed by event
+
+static const FSM_TRANSITION root_transitions[NUM_EVENTS] = { // in every state
+	[EV_STOP]       = FSM_GOTO(ST_IDLE,NULL,NULL), // STOP event (motors already stopped) forces FSM to IDLE state
+};
+
+static const FSM_TRANSITION idle_transitions[NUM_EVENTS] = {
+	[EV_M1]         = FSM_GOTO(ST_M1_FWD,NULL,NULL), // starting level 1 - just start driving forward
+};
+
+static const FSM_TRANSITION m1_edge_transitions[NUM_EVENTS] = { // driving forward or turning
+	[EV_BUMP_LEFT]  = FSM_GOTO(ST_M1_BCK_R,NULL,NULL), // left sensor detected edge, backup then turn right
+	[EV_BUMP_RIGHT] = FSM_GOTO(ST_M1_BCK_L,NULL,NULL), // right sensor detected edge, backup then turn left
+};
+
+static const FSM_TRANSITION m1_turn_transitions[NUM_EVENTS] = {
+	[EV_DONE_TURN]  = FSM_GOTO(ST_M1_FWD,NULL,NULL),  // turn complete - just start driving forward again
+	[EV_TIMEOUT]    = FSM_GOTO(ST_IDLE,NULL,stopMotors),
+};
+
+static const FSM_TRANSITION m1_backup_transitions[NUM_EVENTS] = {
+	[EV_TIMEOUT]    = FSM_GOTO(ST_IDLE,NULL,stopMotors),
+};
+
+static const FSM_TRANSITION m1_bck_l_transitions[NUM_EVENTS] = {
+	[EV_DONE_DRIVE] = FSM_GOTO(ST_M1_TURN,NULL,turnLeft), // backup finished, start a turn to the left
+};
+
+static const FSM_TRANSITION m1_bck_r_transitions[NUM_EVENTS] = {
+	[EV_DONE_DRIVE] = FSM_GOTO(ST_M1_TURN,NULL,turnRight), // backup finished, start a turn to the right
+};
+
+// states, indexed by STATE
+static const FSM_STATE_DEF states[NUM_STATES] = {
+	//                  name         parent        entry        exit       timeout_ms       transitions
+	[ST_IDLE]      = { "IDLE",      ST_ROOT,      NULL,        NULL,      0,               idle_transitions },
+	[ST_M1]        = { "M1",        ST_ROOT,      NULL,        NULL,      0,               NULL },
+	[ST_M1_EDGE]   = { "M1_EDGE",   ST_M1,        NULL,        NULL,      0,               m1_edge_transitions },
+	[ST_M1_FWD]    = { "M1_FWD",    ST_M1_EDGE,   driveForward, NULL,     0,               NULL },
+	[ST_M1_TURN]   = { "M1_TURN",   ST_M1_EDGE,   NULL,        NULL,      MOVE_TIMEOUT_MS, m1_turn_transitions },
+	[ST_M1_BACKUP] = { "M1_BACKUP", ST_M1,        startBackup, endBackup, MOVE_TIMEOUT_MS, m1_backup_transitions },
+	[ST_M1_BCK_L]  = { "M1_BCK_L",  ST_M1_BACKUP, NULL,        NULL,      0,               m1_bck_l_transitions },
+	[ST_M1_BCK_R]  = { "M1_BCK_R",  ST_M1_BACKUP, NULL,        NULL,      0,               m1_bck_r_transitions },
+	[ST_M2]        = { "M2",        ST_ROOT,      NULL,        NULL,      0,               NULL }, // (not implemented)
+	[ST_M3]        = { "M3",        ST_ROOT,      NULL,        NULL,      0,               NULL }, // (not implemented)
+	[ST_COMPLETE]  = { "COMPLETE",  ST_ROOT,      NULL,        NULL,      0,               NULL }, // (not implemented)
+	[ST_ROOT]      = { "ROOT",      FSM_NO_STATE, NULL,        NULL,      0,               root_transitions },
+};
+
+static FSM fsm; // the controller state machine
+
+
+// start the state machine (in idle)
+void controlerInit(void) {
+	fsmInit(&fsm,states,NUM_STATES,NUM_EVENTS,ST_IDLE,HAL_GetTick());
+}
 
+// update the state machine with each event waiting on the event queue, oldest first, then check the state timeouts
+void updateControler(void) {
 
-static STATE state = ST_IDLE; // state variable of the FSM (start in idle)
+	EVENT event;
 
+	while(eventGet(&event)) {
+		fsmEvent(&fsm,(uint8_t)(__builtin_ctz((unsigned)event.type) + 1),HAL_GetTick()); // each event is a single flag
+	}
 
-// update the state machine
-// input events to trigger state transitions are in events parameter
-void updateControler(MotorEvent event) {
+	fsmUpdate(&fsm,HAL_GetTick());
+}
 
+// get the current state of the state machine
+STATE getControlerState(void) {
+	return (STATE)fsm.state;
+}
 
-	if(event & ME_STOP) { // regardless of current state - STOP event Stops motors and forces FSM to IDLE state
-		state = ST_IDLE;
-	}
+// get the state machine (for its state definitions and transition count)
+const FSM * getControlerFSM(void) {
+	return &fsm;
+}
 
-	switch(state) {
-
-		case ST_IDLE: // idle - wait for event to start a challenge level
-			switch(event) {
-				case CE_M1:
-					drive(FWD_SPEED,0.0f); // starting level 1 - just start driving forward
-					state= ST_M1_FWD;
-					break;
-
-				case CE_M2: // level 2 (TBD)
-					break;
-
-				case CE_M3: // level 3 (TBD)
-					break;
-
-				default: // ignore other events
-					break;
-			}
-			break;
-
-		case ST_M1_FWD: // driving forward - stop if we reach the edge
-			switch(event) {
-				case ME_BUMP_LEFT: // left sensor detected edge
-					disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // Disable sensors so we can backup
-					driveTo(BACK_DIST,BACK_SPEED); // now backup
-					state= ST_M1_BCK_R;            // next state will turn to right when backup is finished
-					break;
-
-				case ME_BUMP_RIGHT:  // right sensor detected edge
-					disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // Disable sensors so we can backup
-					driveTo(BACK_DIST,BACK_SPEED);  // now backup
-					state= ST_M1_BCK_L; // next state will turn to left when backup is finished
-					break;
-
-				default: // ignore other events
-					break;
-			}
-			break;
-
-		case ST_M1_BCK_L: // currently backing up - will start to turn left when finished
-			switch(event) {
-				case ME_DONE_DRIVE: // backup finished
-					enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // re-enable edge sensors before we start turning
-					turnTo(TURN_ANG,TURN_SPEED); // start a turn to the left
-					state= ST_M1_TURN; // next state will wait till turn is finished
-					break;
-
-				default: // ignore other events
-					break;
-			}
-			break;
-
-		case ST_M1_BCK_R:  // currently backing up - will start to turn right when finished
-			switch(event) {
-				case ME_DONE_DRIVE: // backup finished
-					enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);  // re-enable edge sensors before we start turning
-					turnTo(-TURN_ANG,TURN_SPEED); // start a turn to the right
-					state= ST_M1_TURN; // next state will wait till turn is finished
-					break;
-
-				default: // ignore other events
-					break;
-			}
-			break;
-
-		case ST_M1_TURN: // currently doing a turn, stop when turn completed or we hit an edge again
-			switch(event) {
-				case ME_DONE_TURN: // turn complete - just start driving forward again
-					drive(FWD_SPEED,0.0f);
-					state= ST_M1_FWD;
-					break;
-
-				case ME_BUMP_LEFT:  // left sensor detected edge
-					disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // start backup and turn right sequence again
-					driveTo(BACK_DIST,BACK_SPEED);
-					state= ST_M1_BCK_R;
-					break;
-
-				case ME_BUMP_RIGHT: // right sensor detected edge
-					disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT); // start backup and turn left sequence again
-					driveTo(BACK_DIST,BACK_SPEED);
-					state= ST_M1_BCK_L;
-					break;
-
-				default: // ignore other events
-					break;
-			}
-			break;
-
-
-		case ST_M2: // (TBD)
-			STOP();
-			state= ST_IDLE;
-			break;
-
-		case ST_M3: // (TBD)
-			STOP();
-			state= ST_IDLE;
-			break;
-
-		case ST_COMPLETE: // (TBD)
-			STOP();
-			state= ST_IDLE;
-			break;
-
-		default: // somthings broken - STOP and reset FSM
-			STOP();
-			state= ST_IDLE;
-			break;
-	}
+// set a function to be called for each transition taken (NULL for none)
+void setControlerTrace(FSM_TRACE trace) {
+	fsm.trace = trace;
 }
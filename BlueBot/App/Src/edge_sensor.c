@@ -3,6 +3,12 @@
  *
  * Handle reading the edge sensors
  *
+ * The sensors are polled and debounced every 10ms, and the debounced state raises the bump events. So the robot
+ * does not carry on over the edge for the 30ms deglitch time (and up to a PID period more), each sensor pin also
+ * has an EXTI interrupt that turns the motor PWM off as soon as an enabled sensor goes over an edge (a fast stop).
+ * The fast stop holds the motors off until the sensor is disabled (e.g. to back up) or the pin and debounced state
+ * are both clear again (a glitch, the move carries on).
+ *
  *  Created on: Sep 26, 2020
  *      Author: Ralph Gnauck
  */
@@ -12,29 +18,117 @@
 
 #include "gpio.h"
 #include "edge_sensor.h"
+#include "motors.h"
+#include "scheduler.h"
 
 #define EDGE_SENSOR_ACTIVE GPIO_PIN_SET // define if sensor is active HI or ACTIVE low logic on teh GPIO Pin
+#define EDGE_SENSOR_TRIGGER EXTI_TRIGGER_RISING // pin edge when a sensor goes over an edge (to match EDGE_SENSOR_ACTIVE)
+
+// both sensor pin interrupts pre-empt the speed loop in the scheduler tick ISR, so the time from a sensor edge to the
+// PWM off does not include a speed loop update. CLIFF_1 (PA11) has EXTI15_10 to itself, CLIFF_2 (PA7) shares
+// EXTI9_5 with the right encoder A channel (whose edge time stamps are still consistent, schedMicros counts a pending tick)
+// at the same priority the two do not pre-empt each other
+#define EDGE_SENSOR_EXTI_PRIORITY 0
+
+static EXTI_HandleTypeDef hexti_cliff_1;
+static EXTI_HandleTypeDef hexti_cliff_2;
 
 
 // bitmaps for sensor states (one bit per sensor)
 static uint32_t sensor_state=0;   // debounced state of each sensor (hit(1) or clear(0))
 static uint32_t sensor_changed=0; // each bit is 1 if sensor changes since last update, else 0
-static uint32_t sensor_enabled=0; // bit per sensor 1=sensor enabled, 0= sensor disabled (disabled will be ignored and won't stop motors when sensor is hit)
+static volatile uint32_t sensor_enabled=0; // bit per sensor 1=sensor enabled, 0= sensor disabled (disabled will be ignored and won't stop motors when sensor is hit)
+static volatile uint32_t sensor_tripped=0; // bit per sensor 1=fast stop is holding the motors off
+
+static volatile uint32_t trip_us[2];  // time of the last fast stop of each sensor
+static EDGE_SENSOR_STATS sensor_stats;
 
 static uint32_t debounce(uint32_t sample); // update the debounce filter using the new raw gpio values
 
 static uint32_t readSensors(void); // read gpio input to get raw sensor state
 
+// set up the EXTI interrupts on the sensor pins for the fast stop
+// the pins stay as GPIO inputs, the EXTI line sees the pin input whatever its mode
+void edgeSensorInit(void) {
+
+	EXTI_ConfigTypeDef config = {0};
+
+	config.Mode = EXTI_MODE_INTERRUPT;
+	config.Trigger = EDGE_SENSOR_TRIGGER;
+	config.GPIOSel = EXTI_GPIOA;
+
+	config.Line = EXTI_LINE_11; // CLIFF_1 (PA11), left sensor
+	HAL_EXTI_SetConfigLine(&hexti_cliff_1,&config);
+
+	config.Line = EXTI_LINE_7; // CLIFF_2 (PA7), right sensor
+	HAL_EXTI_SetConfigLine(&hexti_cliff_2,&config);
+
+	HAL_NVIC_SetPriority(EXTI15_10_IRQn,EDGE_SENSOR_EXTI_PRIORITY,0);
+	HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+	HAL_NVIC_SetPriority(EXTI9_5_IRQn,EDGE_SENSOR_EXTI_PRIORITY,0);
+	HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+}
+
 // enable the sensors
 // sensor bits correspond to sensors (1) = enable, 0= don't change
+// a sensor that is already over an edge when it is enabled fast stops straight away (there will be no pin edge)
 void enableEdgeSensors(uint32_t sensor) {
+
+	__disable_irq(); // a sensor pin ISR tripping the other sensor in between would have its bit lost by the trip here
 	sensor_enabled |= sensor;
+
+	uint32_t over = readSensors() & sensor;
+	if(over & BUMP_BIT_LEFT) {
+		edgeSensorEdge(CLIFF_1_Pin);
+	}
+	if(over & BUMP_BIT_RIGHT) {
+		edgeSensorEdge(CLIFF_2_Pin);
+	}
+	__enable_irq();
 }
 
 // disable the sensors
 // sensor bits correspond to sensors (1) = disable, 0= don't change
+// this releases a fast stop of the sensor so the robot can back away from the edge
 void disableEdgeSensors(uint32_t sensor) {
+	__disable_irq(); // the fast stop ISR must not trip the sensor again in between
 	sensor_enabled &= ~sensor;
+	sensor_tripped &= ~sensor;
+	__enable_irq();
+}
+
+// ISR for a sensor pin going over an edge, turn the motors off now if the sensor is enabled
+// runs from the sensor pin ISRs (which do not pre-empt each other) or with interrupts disabled, as its update of
+// sensor_tripped is not atomic
+void edgeSensorEdge(uint16_t pin) {
+
+	uint32_t start_us = schedMicros();
+	uint32_t sensor = (pin == CLIFF_1_Pin)?BUMP_BIT_LEFT:BUMP_BIT_RIGHT;
+
+	if(!(sensor_enabled & sensor) || (sensor_tripped & sensor)) {
+		return;
+	}
+
+	sensor_tripped |= sensor; // set first so the motor update does not turn the PWM back on
+	motorsOff();
+
+	uint32_t reaction_us = schedMicros() - start_us;
+	trip_us[sensor - 1] = start_us;
+	sensor_stats.trips++;
+	sensor_stats.reaction_us = reaction_us;
+	if(reaction_us > sensor_stats.reaction_max_us) {
+		sensor_stats.reaction_max_us = reaction_us;
+	}
+}
+
+// true while a fast stop is holding the motors off
+bool edgeSensorTripped(void) {
+	return sensor_tripped != 0;
+}
+
+// get the fast stop statistics
+const EDGE_SENSOR_STATS * getEdgeSensorStats(void) {
+	return &sensor_stats;
 }
 
 // return the debounced state of selected sensor
@@ -49,7 +143,7 @@ EDGE_SENSOR_STATE getEdgeSensorState(uint32_t sensor) {
 		sensor_changed &= ~sensor;
 	}
 
-	return hit & sensor_enabled; // mask out any disabled sensor status bits;
+	return (sensor_enabled & sensor)?hit:ES_CLEAR; // mask out any disabled sensor status
 }
 
 // update the debounce status of the sensor flags
@@ -60,6 +154,24 @@ void updateEdgeSensors(void) {
 
 	sensor_changed = state ^ sensor_state; // detect which sensors have changed
 	sensor_state = state ; // update debounced state variable
+
+	// time from each fast stop to the debounced state confirming it (when the motors would have stopped without it)
+	uint32_t confirmed = sensor_changed & state & sensor_tripped;
+	for(uint32_t s=0; s < 2; s++) {
+		if(confirmed & (1U << s)) {
+			sensor_stats.confirm_us = schedMicros() - trip_us[s];
+		}
+	}
+
+	// release a fast stop that was a glitch (the pin and the debounced state are both clear)
+	__disable_irq();
+	uint32_t glitches = sensor_tripped & ~(state | new_state);
+	sensor_tripped &= ~glitches;
+	__enable_irq();
+
+	if(glitches) {
+		sensor_stats.glitches++;
+	}
 }
 
 // read raw gpio status for each sensor
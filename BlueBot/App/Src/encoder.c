@@ -8,41 +8,216 @@
  */
 
 #include "encoder.h"
+#include "scheduler.h"
+#include "ccmram.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+
+#define ENCODER_EXTI_PRIORITY 2 // below the scheduler tick, the left encoder edges do not need to pre-empt the speed loop
+#define ENCODER_OVERFLOW_PRIORITY 0 // above the scheduler tick, the speed loop reads the extended count in the tick ISR
+
+static EXTI_HandleTypeDef hexti_enc_left;
+static EXTI_HandleTypeDef hexti_enc_right;
+
+// update period and the scale from counts per update to rad/s (set by encoderSetPeriod)
+static CCMRAM_DATA float enc_period = ENCODER_PERIOD;
+static CCMRAM_DATA float enc_vel_scale = ENCODER_VEL_SCALE;
+
+// M method threshold (counts per update), 0 when the period is too short for the M method
+static CCMRAM_DATA int32_t enc_mt_counts = (int32_t)(ENCODER_MT_RATE*ENCODER_PERIOD + 0.5f);
+static CCMRAM_DATA float enc_acc_gain; // acceleration filter gain per update
+
+static float edgeVelocity(ENCODER * enc, float m_vel, bool edge_seen, uint32_t edge_us, uint16_t edge_count);
+static uint32_t readCount(ENCODER * enc);
+
+
+// reset the velocity estimates, enable the overflow interrupt of the 16 bit encoder timer and the EXTI interrupts on the encoder A channels
+// the pins stay in their timer alternate function mode, the EXTI line sees the pin input whatever its mode
+void encoderInit(void) {
+
+	EXTI_ConfigTypeDef config = {0};
+
+	encoderSetPeriod(enc_period);
+
+	// TIM1 (right) is only 16 bits, count the overflows in the update interrupt (enabled by CubeMX)
+	// the update flag is set by the timer init, clear it so it is not counted as an overflow
+	// CubeMX gives the update interrupt the same priority as the scheduler tick, raise it so a wrap is counted while
+	// the speed loop is reading the count in the tick ISR (readCount would wait for it forever)
+	HAL_NVIC_SetPriority(TIM1_UP_TIM16_IRQn,ENCODER_OVERFLOW_PRIORITY,0);
+	enc_right.overflows = 0;
+	__HAL_TIM_CLEAR_FLAG(enc_right.htim,TIM_FLAG_UPDATE);
+	__HAL_TIM_ENABLE_IT(enc_right.htim,TIM_IT_UPDATE);
+
+	encoderReset(&enc_left);
+	encoderReset(&enc_right);
+
+	config.Mode = EXTI_MODE_INTERRUPT;
+	config.Trigger = EXTI_TRIGGER_RISING_FALLING;
+	config.GPIOSel = EXTI_GPIOA;
+
+	config.Line = EXTI_LINE_0; // ENC1_A (PA0), left encoder on TIM2
+	HAL_EXTI_SetConfigLine(&hexti_enc_left,&config);
+
+	config.Line = EXTI_LINE_9; // ENC2_A (PA9), right encoder on TIM1
+	HAL_EXTI_SetConfigLine(&hexti_enc_right,&config);
+
+	HAL_NVIC_SetPriority(EXTI0_IRQn,ENCODER_EXTI_PRIORITY,0);
+	HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+	HAL_NVIC_EnableIRQ(EXTI9_5_IRQn); // shared with the CLIFF_2 edge sensor, which sets its priority (edgeSensorInit)
+}
+
+// zero the tick count and position, counting from the current timer value
+void encoderReset(ENCODER * enc) {
+	enc->last = readCount(enc);
+	enc->ticks = 0;
+	enc->state.pos = 0.0f;
+}
+
+// set the period updateEncoder is called at (s), and reset the acceleration and the M method threshold for it
+void encoderSetPeriod(float period) {
+	enc_period = period;
+	enc_vel_scale = ENCODER_RAD_PER_COUNT/period;
+
+	enc_mt_counts = (int32_t)(ENCODER_MT_RATE*period + 0.5f);
+	if(enc_mt_counts < ENCODER_MT_MIN_COUNTS) {
+		enc_mt_counts = 0; // T method only
+	}
+
+	float w = 2.0f*3.14159265f*ENCODER_ACC_HZ*period;
+	enc_acc_gain = w/(1.0f + w); // first order low pass
+
+	enc_left.state.acc = 0.0f;
+	enc_right.state.acc = 0.0f;
+}
+
+// count an overflow or underflow of a 16 bit encoder timer
+// in encoder mode the timer sets its direction bit from the last count, so it tells which way the count wrapped
+CCMRAM_CODE void encoderOverflow(ENCODER * enc) {
+	if(__HAL_TIM_IS_TIM_COUNTING_DOWN(enc->htim)) {
+		enc->overflows--;
+	}
+	else {
+		enc->overflows++;
+	}
+}
+
+// read the timer count extended to 32 bits
+// must be called with the update interrupt enabled (not from a higher priority ISR) or it will wait for it forever
+CCMRAM_CODE static uint32_t readCount(ENCODER * enc) {
+
+	if(__HAL_TIM_GET_AUTORELOAD(enc->htim) == ENCODER_COUNT_MAX) { // 32 bit timer counts the full range itself
+		return __HAL_TIM_GET_COUNTER(enc->htim);
+	}
+
+	// 16 bit timer, read again if the high half changed while reading the count, or if the timer has
+	// wrapped but the update ISR has not run yet to count it
+	uint16_t high;
+	uint16_t low;
+	do {
+		high = enc->overflows;
+		low = (uint16_t)__HAL_TIM_GET_COUNTER(enc->htim);
+	} while(high != enc->overflows || __HAL_TIM_GET_FLAG(enc->htim,TIM_FLAG_UPDATE));
+
+	return ((uint32_t)high << 16) | low;
+}
+
+// record the time of an edge on the encoder A channel
+CCMRAM_CODE void encoderEdge(ENCODER * enc) {
+	enc->edge_count = (uint16_t)__HAL_TIM_GET_COUNTER(enc->htim);
+	enc->edge_us = schedMicros();
+	enc->edge_seen = true;
+}
 
 // update encoder state variables with new position and velocity
-void updateEncoder(ENCODER * enc) {
+CCMRAM_CODE void updateEncoder(ENCODER * enc) {
 
 	ENCODER_STATE * state = &enc->state;
 
-	int16_t pos16 = enc->dir*(int16_t) __HAL_TIM_GET_COUNTER(enc->htim); // treat timers as signed 16 bit
-	int32_t pos32 = (int32_t)pos16; // sign extend to 32 bit
+	uint32_t count = readCount(enc);
+	int32_t diff = enc->dir*(int32_t)(count - enc->last); // change in pos (vel), the 32 bit difference is right across a wrap
 
-    int16_t last = enc->last; // get last raw timer value
+	enc->ticks += diff;
 
-    int32_t diff = pos32-last; // change in pos (vel)
+	// take a consistent copy of the last edge
+	__disable_irq();
+	bool edge_seen = enc->edge_seen;
+	uint32_t edge_us = enc->edge_us;
+	uint16_t edge_count = enc->edge_count;
+	enc->edge_seen = false;
+	__enable_irq();
 
-	if (abs(last) > 20000) { // is timer likely to have over/underflowed (sign changes near 0 are ok)
-		if(pos16 < 0 && last >= 0) { // overflow forward
-			diff += (int32_t)0x10000;
-		}
-		else if(pos16 >= 0 && last < 0) { // underflow backwards
-			diff -= (int32_t)0x10000;
-		}
+	// update state
+
+	float vel =  enc_vel_scale*(float)diff;   // output velocity as rad/sec
+
+	float last_vel = state->vel;
+
+	if(enc_mt_counts > 0 && (abs(diff) >= enc_mt_counts || !enc->edge_valid)) { // M method, average with the last update
+		state->vel = (vel + enc->last_vel)/2.0f;
 	}
+	else if(enc->edge_valid) { // T method
+		state->vel = edgeVelocity(enc,vel,edge_seen,edge_us,edge_count);
+	}
+	else { // T method only and no edge seen yet
+		state->vel = vel;
+	}
+	enc->last_vel = vel;
 
-	// update state
+	// the acceleration is the filtered change in the velocity
+	state->acc += enc_acc_gain*((state->vel - last_vel)/enc_period - state->acc);
+	if(fabsf(state->acc) < 1.0e-6f) { // at a steady speed it decays towards 0, stop it before the floats go denormal
+		state->acc = 0.0f;
+	}
 
-	float vel =  ENCODER_VEL_SCALE*(float)diff;   // output velocity as rad/sec
-	state->vel = (vel+enc->last_vel)/2.0f;
-	enc->last_vel=vel;
+	if(edge_seen) { // keep the edge for the next T method estimate
+		enc->last_edge_us = edge_us;
+		enc->last_edge_count = edge_count;
+		enc->edge_valid = true;
+	}
 
-	state->pos += diff*ENCODER_DIST_SCALE;  // position is integral of raw velocity
+	state->pos = (float)enc->ticks*ENCODER_DIST_SCALE;  // position from the exact tick count, so float rounding does not build up
 
 	// output debug messages
-	//printf("Enc %s: pos=%5.2f, vel=%5.2f last=%d\r\n",enc->tag,enc->pos,enc->vel,enc->last);
+	//printf("Enc %s: pos=%5.2f, vel=%5.2f last=%lu\r\n",enc->tag,enc->pos,enc->vel,enc->last);
+
+	enc->last = count; // save counter value for next time so we can calculate differences
+
+}
+
+// estimate the velocity from the time between encoder edges (T method)
+// m_vel is the M method velocity, used when the wheel starts moving again after a stop
+CCMRAM_CODE static float edgeVelocity(ENCODER * enc, float m_vel, bool edge_seen, uint32_t edge_us, uint16_t edge_count) {
+
+	float vel = enc->state.vel;
+
+	if(edge_seen) {
+		int16_t counts = enc->dir*(int16_t)(edge_count - enc->last_edge_count); // counts between the edges (wraps like the timer)
+		uint32_t dt_us = edge_us - enc->last_edge_us;
 
-	enc->last = pos16; // save counter value for next time so we can calculate differences
+		if(dt_us == 0 || dt_us > ENCODER_STOP_US) { // last edge was from before the wheel stopped
+			vel = m_vel;
+		}
+		else {
+			vel = ENCODER_RAD_PER_COUNT*1.0e6f*(float)counts/(float)dt_us;
+		}
+	}
+	else { // no edge this period, the wheel has moved less than one edge in the time since the last one
+		uint32_t since_us = schedMicros() - enc->last_edge_us;
+
+		if(since_us > ENCODER_STOP_US) {
+			vel = 0.0f;
+		}
+		else {
+			float max_vel = ENCODER_RAD_PER_COUNT*1.0e6f*2.0f/(float)since_us; // 2 counts per A edge
+			if(vel > max_vel) {
+				vel = max_vel;
+			}
+			else if(vel < -max_vel) {
+				vel = -max_vel;
+			}
+		}
+	}
 
+	return vel;
 }
@@ -0,0 +1,79 @@
+/*
+ * events.c
+ *
+ *  Event queue
+ */
+
+#include "main.h"
+#include "events.h"
+#include "scheduler.h"
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE-1)
+
+static EVENT event_queue[EVENT_QUEUE_SIZE];
+static volatile uint32_t event_head=0; // count of events posted, written only by the producer
+static volatile uint32_t event_tail=0; // count of events taken, written only by the consumer
+static EVENT_STATS event_stats;
+
+
+// queue each event flag set in events (lowest first) with the current time
+// returns false if any were dropped because the queue was full
+bool eventPost(MotorEvent events) {
+
+	uint32_t flags = events;
+	uint32_t now = schedMicros();
+	bool ok = true;
+
+	while(flags != 0) {
+
+		uint32_t flag = flags & -flags; // lowest flag set
+		flags &= ~flag;
+
+		uint32_t head = event_head;
+		uint32_t depth = head - event_tail;
+
+		if(depth >= EVENT_QUEUE_SIZE) {
+			event_stats.dropped++;
+			ok = false;
+			continue;
+		}
+
+		EVENT * event = &event_queue[head & EVENT_QUEUE_MASK];
+		event->type = (MotorEvent)flag;
+		event->time_us = now;
+
+		__DMB(); // the event must be written before it is published to the consumer
+		event_head = head + 1;
+
+		event_stats.posted++;
+		if(depth + 1 > event_stats.max_depth) {
+			event_stats.max_depth = depth + 1;
+		}
+	}
+
+	return ok;
+}
+
+// take the oldest event off the queue, returns false if there are none
+bool eventGet(EVENT * event) {
+
+	uint32_t tail = event_tail;
+
+	if(tail == event_head) {
+		return false;
+	}
+
+	__DMB(); // read the event after seeing it published
+	*event = event_queue[tail & EVENT_QUEUE_MASK];
+	__DMB(); // and before handing its slot back to the producer
+	event_tail = tail + 1;
+
+	event_stats.handled++;
+
+	return true;
+}
+
+// get the queue statistics
+const EVENT_STATS * eventGetStats(void) {
+	return &event_stats;
+}
@@ -0,0 +1,52 @@
+/*
+ * fast_math.c
+ *
+ *  Fast sin and cos for the odometry and path hot paths
+ */
+
+#include "fast_math.h"
+#include "ccmram.h"
+
+// pi/2 split in 3 parts for the sin/cos argument reduction, the first two have few enough bits
+// that k*part is exact for the multiples of pi/2 used (|k| < 2^13)
+#define PIO2_1 1.5703125f
+#define PIO2_2 4.837512969970703125e-4f
+#define PIO2_3 7.54978995489188216e-8f
+#define TWO_OVER_PI 0.636619772367581343f
+
+// round to the nearest integer (|x| < 2^22), adding 1.5*2^23 leaves no fraction bits
+// (rintf is a library call on the M4, it has no round instruction)
+static float roundNearest(float x) {
+	return (x + 12582912.0f) - 12582912.0f;
+}
+
+// sin and cos of x (rad)
+// x is reduced to r in +-pi/4 and a quadrant, then sin(r) and cos(r) are found with polynomials (cephes sinf/cosf)
+CCMRAM_CODE void fastSinCos(float x, float * s, float * c) {
+
+	float k = roundNearest(x*TWO_OVER_PI); // nearest multiple of pi/2
+	float r = ((x - k*PIO2_1) - k*PIO2_2) - k*PIO2_3;
+	float z = r*r;
+
+	float sr = r + r*z*(-1.6666654611e-1f + z*(8.3321608736e-3f + z*-1.9515295891e-4f));
+	float cr = 1.0f - 0.5f*z + z*z*(4.166664568298827e-2f + z*(-1.388731625493765e-3f + z*2.443315711809948e-5f));
+
+	switch((int32_t)k & 3) {
+	case 0:
+		*s = sr;
+		*c = cr;
+		break;
+	case 1:
+		*s = cr;
+		*c = -sr;
+		break;
+	case 2:
+		*s = -sr;
+		*c = -cr;
+		break;
+	default:
+		*s = -cr;
+		*c = sr;
+		break;
+	}
+}
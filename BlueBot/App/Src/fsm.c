@@ -0,0 +1,137 @@
+/*
+ * fsm.c
+ *
+ *  Table driven hierarchical state machine engine
+ */
+
+#include <stddef.h>
+#include "fsm.h"
+
+static bool dispatch(FSM * fsm, uint8_t source, uint8_t event, uint32_t now_ms);
+static bool contains(const FSM * fsm, uint8_t parent, uint8_t state);
+static void enterStates(FSM * fsm, uint8_t top, uint8_t target, uint32_t now_ms);
+
+
+// start the state machine in the initial state (running the entry actions down to it)
+void fsmInit(FSM * fsm, const FSM_STATE_DEF * states, uint8_t num_states, uint8_t num_events, uint8_t initial, uint32_t now_ms) {
+
+	fsm->states = states;
+	fsm->num_states = num_states;
+	fsm->num_events = num_events;
+	fsm->state = initial;
+	fsm->trace = NULL;
+	fsm->transitions = 0;
+
+	enterStates(fsm,FSM_NO_STATE,initial,now_ms);
+}
+
+// handle an event, returns true if a transition was taken
+bool fsmEvent(FSM * fsm, uint8_t event, uint32_t now_ms) {
+
+	if(event >= fsm->num_events) {
+		return false;
+	}
+
+	return dispatch(fsm,fsm->state,event,now_ms);
+}
+
+// raise FSM_EV_TIMEOUT for the innermost active state whose timeout has expired (looked up from that state)
+// the timeout restarts if no transition handles it
+bool fsmUpdate(FSM * fsm, uint32_t now_ms) {
+
+	for(uint8_t s=fsm->state; s != FSM_NO_STATE; s = fsm->states[s].parent) {
+		uint32_t timeout = fsm->states[s].timeout_ms;
+		if(timeout > 0 && now_ms - fsm->entered_ms[s] >= timeout) {
+			fsm->entered_ms[s] = now_ms;
+			return dispatch(fsm,s,FSM_EV_TIMEOUT,now_ms);
+		}
+	}
+
+	return false;
+}
+
+// look up the event from the source state up through its parents and take the first transition found whose guard is true
+static bool dispatch(FSM * fsm, uint8_t source, uint8_t event, uint32_t now_ms) {
+
+	const FSM_TRANSITION * tr = NULL;
+
+	for(; source != FSM_NO_STATE; source = fsm->states[source].parent) {
+		const FSM_TRANSITION * table = fsm->states[source].transitions;
+		if(table != NULL && table[event].kind != FSM_TR_NONE && (table[event].guard == NULL || table[event].guard())) {
+			tr = &table[event];
+			break;
+		}
+	}
+
+	if(tr == NULL) { // event is not handled in this state
+		return false;
+	}
+
+	uint8_t from = fsm->state;
+
+	if(tr->kind == FSM_TR_GOTO) {
+
+		// closest state containing both the current state and the target (not counting the target itself,
+		// so a transition to the current state or one of its parents exits and re-enters the target)
+		uint8_t top = fsm->states[tr->target].parent;
+		while(top != FSM_NO_STATE && !contains(fsm,top,from)) {
+			top = fsm->states[top].parent;
+		}
+
+		for(uint8_t s=from; s != top; s = fsm->states[s].parent) {
+			if(fsm->states[s].exit != NULL) {
+				fsm->states[s].exit();
+			}
+		}
+
+		fsm->state = tr->target;
+
+		if(tr->action != NULL) {
+			tr->action();
+		}
+
+		enterStates(fsm,top,tr->target,now_ms);
+	}
+	else if(tr->action != NULL) { // internal transition
+		tr->action();
+	}
+
+	fsm->transitions++;
+	if(fsm->trace != NULL) {
+		fsm->trace(fsm,source,event,from,fsm->state);
+	}
+
+	return true;
+}
+
+// true if state is parent or is inside it
+static bool contains(const FSM * fsm, uint8_t parent, uint8_t state) {
+
+	for(; state != FSM_NO_STATE; state = fsm->states[state].parent) {
+		if(state == parent) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// run the entry actions of the states inside top, outermost first, down to the target
+// (top is FSM_NO_STATE to enter from the top level)
+static void enterStates(FSM * fsm, uint8_t top, uint8_t target, uint32_t now_ms) {
+
+	uint8_t path[FSM_MAX_STATES];
+	int n=0;
+
+	for(uint8_t s=target; s != top; s = fsm->states[s].parent) {
+		path[n++] = s;
+	}
+
+	while(n > 0) {
+		uint8_t s = path[--n];
+		fsm->entered_ms[s] = now_ms;
+		if(fsm->states[s].entry != NULL) {
+			fsm->states[s].entry();
+		}
+	}
+}
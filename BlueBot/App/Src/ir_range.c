@@ -17,35 +17,16 @@
 #define LR_ADC ADC_1
 #define SR_ADC ADC_2
 
-
-#define SCALE 0.0008056640625f // ADC to volts
-
-// Define calibration coefficients for each sensor - raw data has been fit to a * order polynomial approximation function for calibration
-// dist = a * volts^b + c
-
-// Coefficients for short range sensor
-#define SR_A 15.5f
-#define SR_B -0.8647f
-#define SR_C -2.494f
-
-// Coefficients for long range sensor
-#define LR_A 76.98f
-#define LR_B -0.9005f
-#define LR_C -13.04f
+#define IR_ADC_MAX ((1u << IR_ADC_BITS) - 1)
+#define IR_STEP_MASK ((1u << IR_TABLE_SHIFT) - 1)
 
 #define alpha 0.95f // eponential averaging filter coefficient
 
-#define MAX_LR 150.0f
-#define MIN_LR 20.0f
-
-#define MAX_SR 25.0f
-#define MIN_SR 4.0f
-
 // current distance reading for each sensor
 static float dist[NUM_IR_SENSORS]={-1.0f,-1.0f}; // distance in cm
 
-// calculate calibrated distance from raw reading
-static float calibrate(float v,float a,float b, float c) ;
+// calibration table used for each sensor
+static const IR_TABLE * ir_table[NUM_IR_SENSORS] = { &ir_table_long, &ir_table_short };
 
 
 // update current readings if new ADC values are avaialble
@@ -54,10 +35,10 @@ void updateIRSensors(void) {
 
 	uint32_t value;
 	if(get_adc(LR_ADC,&value)) { // get new ADC reading for long range sensor (if any)
-		dist[LR_IR]=(dist[LR_IR]*alpha)+((1-alpha)*calibrate(value*SCALE, LR_A, LR_B, LR_C)); // calculate distance from raw ADC value
+		dist[LR_IR]=(dist[LR_IR]*alpha)+((1-alpha)*irTableDistance(ir_table[LR_IR],value)); // calculate distance from raw ADC value
 	}
 	if(get_adc(SR_ADC,&value)) { // get new ADC reading for short range sensor (if any)
-		dist[SR_IR]=(dist[SR_IR]*alpha)+((1-alpha)*calibrate(value*SCALE, SR_A, SR_B, SR_C)); // calculate distance from raw ADC value
+		dist[SR_IR]=(dist[SR_IR]*alpha)+((1-alpha)*irTableDistance(ir_table[SR_IR],value)); // calculate distance from raw ADC value
 	}
 }
 
@@ -93,9 +74,24 @@ float sr=getShortRangeIR();
 
 }
 
+// select the calibration table used for a sensor (e.g. a table made from that unit's measured calibration points)
+void setIRTable(int sensor, const IR_TABLE * table) {
+	if(sensor >= 0 && sensor < NUM_IR_SENSORS) {
+		ir_table[sensor] = table;
+	}
+}
+
 // calculate calibrated distance from raw reading
-// v : raw reading
-// a,b,c : calibration coefficients for the sensor type
-float calibrate(float v, float a, float b, float c) {
-	return a * powf(v,b) +c;
+// code : raw ADC reading
+// interpolates between the table entries either side of the code
+float irTableDistance(const IR_TABLE * table, uint32_t code) {
+
+	if(code > IR_ADC_MAX) {
+		code = IR_ADC_MAX;
+	}
+
+	const float * d = &table->dist[code >> IR_TABLE_SHIFT];
+	float f = (float)(code & IR_STEP_MASK)*(1.0f/(1 << IR_TABLE_SHIFT)); // fraction of the way to the next entry
+
+	return d[0] + (d[1] - d[0])*f;
 }
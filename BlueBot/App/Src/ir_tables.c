@@ -0,0 +1,90 @@
+/*
+ * ir_tables.c
+ *
+ *  Sharp IR sensor calibration tables, distance (cm) every 16 ADC codes
+ *
+ *  Generated by Host/Src/ir_table_gen.c, do not edit
+ *  (run make ir_tables in Host/ to regenerate)
+ */
+
+#include "ir_range.h"
+
+// long range sensor: 76.98 * v^-0.9005 -13.04
+const IR_TABLE ir_table_long = {
+	"76.98 * v^-0.9005 -13.04",
+	{
+		1000.000f, 1000.000f, 1000.000f, 1000.000f, 1000.000f, 896.1481f, 758.4868f, 658.4900f,
+		582.4078f, 522.4863f, 474.0130f, 433.9544f, 400.2677f, 371.5254f, 346.6993f, 325.0295f,
+		305.9420f, 288.9948f, 273.8420f, 260.2090f, 247.8748f, 236.6595f, 226.4154f, 217.0196f,
+		208.3694f, 200.3781f, 192.9721f, 186.0884f, 179.6727f, 173.6783f, 168.0642f, 162.7949f,
+		157.8390f, 153.1690f, 148.7603f, 144.5915f, 140.6430f, 136.8976f, 133.3398f, 129.9556f,
+		126.7323f, 123.6587f, 120.7243f, 117.9198f, 115.2365f, 112.6667f, 110.2031f, 107.8393f,
+		105.5692f, 103.3873f, 101.2883f, 99.26763f, 97.32089f, 95.44403f, 93.63328f, 91.88515f,
+		90.19641f, 88.56402f, 86.98517f, 85.45722f, 83.97771f, 82.54433f, 81.15492f, 79.80747f,
+		78.50005f, 77.23089f, 75.99831f, 74.80071f, 73.63661f, 72.50460f, 71.40335f, 70.33159f,
+		69.28814f, 68.27188f, 67.28173f, 66.31669f, 65.37580f, 64.45815f, 63.56287f, 62.68914f,
+		61.83618f, 61.00325f, 60.18963f, 59.39465f, 58.61768f, 57.85808f, 57.11528f, 56.38872f,
+		55.67785f, 54.98218f, 54.30120f, 53.63445f, 52.98148f, 52.34187f, 51.71519f, 51.10106f,
+		50.49909f, 49.90892f, 49.33020f, 48.76260f, 48.20579f, 47.65946f, 47.12332f, 46.59707f,
+		46.08045f, 45.57318f, 45.07501f, 44.58569f, 44.10499f, 43.63267f, 43.16851f, 42.71231f,
+		42.26385f, 41.82294f, 41.38938f, 40.96299f, 40.54359f, 40.13100f, 39.72506f, 39.32561f,
+		38.93249f, 38.54554f, 38.16463f, 37.78960f, 37.42032f, 37.05666f, 36.69848f, 36.34567f,
+		35.99810f, 35.65565f, 35.31821f, 34.98567f, 34.65791f, 34.33485f, 34.01636f, 33.70236f,
+		33.39275f, 33.08744f, 32.78633f, 32.48934f, 32.19639f, 31.90738f, 31.62225f, 31.34090f,
+		31.06327f, 30.78928f, 30.51886f, 30.25193f, 29.98843f, 29.72830f, 29.47146f, 29.21786f,
+		28.96743f, 28.72011f, 28.47584f, 28.23457f, 27.99624f, 27.76079f, 27.52818f, 27.29835f,
+		27.07125f, 26.84683f, 26.62504f, 26.40585f, 26.18919f, 25.97503f, 25.76332f, 25.55402f,
+		25.34709f, 25.14249f, 24.94018f, 24.74011f, 24.54226f, 24.34658f, 24.15304f, 23.96160f,
+		23.77222f, 23.58489f, 23.39955f, 23.21618f, 23.03475f, 22.85522f, 22.67757f, 22.50177f,
+		22.32778f, 22.15558f, 21.98513f, 21.81643f, 21.64942f, 21.48410f, 21.32043f, 21.15839f,
+		20.99796f, 20.83910f, 20.68180f, 20.52604f, 20.37178f, 20.21901f, 20.06772f, 19.91786f,
+		19.76943f, 19.62241f, 19.47676f, 19.33248f, 19.18955f, 19.04794f, 18.90764f, 18.76863f,
+		18.63088f, 18.49439f, 18.35914f, 18.22510f, 18.09227f, 17.96062f, 17.83014f, 17.70082f,
+		17.57263f, 17.44556f, 17.31961f, 17.19474f, 17.07096f, 16.94824f, 16.82657f, 16.70594f,
+		16.58633f, 16.46773f, 16.35013f, 16.23352f, 16.11788f, 16.00319f, 15.88946f, 15.77666f,
+		15.66478f, 15.55382f, 15.44376f, 15.33459f, 15.22630f, 15.11888f, 15.01231f, 14.90660f,
+		14.80172f, 14.69766f, 14.59443f, 14.49200f, 14.39037f, 14.28953f, 14.18947f, 14.09018f,
+		13.99165f, 13.89387f, 13.79683f, 13.70053f, 13.60496f, 13.51010f, 13.41596f, 13.32251f,
+		13.22976f,
+	}
+};
+
+// short range sensor: 15.5 * v^-0.8647 -2.494
+const IR_TABLE ir_table_short = {
+	"15.5 * v^-0.8647 -2.494",
+	{
+		1000.000f, 664.8931f, 364.0087f, 255.6197f, 198.7748f, 163.4565f, 139.2519f, 121.5631f,
+		108.0349f, 97.33215f, 88.63945f, 81.42988f, 75.34725f, 70.14185f, 65.63326f, 61.68777f,
+		58.20412f, 55.10416f, 52.32659f, 49.82261f, 47.55290f, 45.48540f, 43.59369f, 41.85581f,
+		40.25335f, 38.77074f, 37.39474f, 36.11402f, 34.91880f, 33.80062f, 32.75210f, 31.76679f,
+		30.83902f, 29.96378f, 29.13664f, 28.35366f, 27.61131f, 26.90644f, 26.23622f, 25.59810f,
+		24.98978f, 24.40918f, 23.85439f, 23.32370f, 22.81554f, 22.32847f, 21.86117f, 21.41243f,
+		20.98116f, 20.56632f, 20.16697f, 19.78224f, 19.41133f, 19.05348f, 18.70800f, 18.37426f,
+		18.05164f, 17.73958f, 17.43757f, 17.14512f, 16.86177f, 16.58709f, 16.32067f, 16.06216f,
+		15.81118f, 15.56741f, 15.33053f, 15.10026f, 14.87630f, 14.65840f, 14.44632f, 14.23981f,
+		14.03865f, 13.84263f, 13.65156f, 13.46524f, 13.28350f, 13.10617f, 12.93308f, 12.76407f,
+		12.59901f, 12.43775f, 12.28017f, 12.12612f, 11.97550f, 11.82818f, 11.68407f, 11.54304f,
+		11.40500f, 11.26986f, 11.13752f, 11.00789f, 10.88090f, 10.75645f, 10.63447f, 10.51489f,
+		10.39763f, 10.28263f, 10.16982f, 10.05913f, 9.950510f, 9.843896f, 9.739232f, 9.636465f,
+		9.535541f, 9.436411f, 9.339026f, 9.243339f, 9.149305f, 9.056881f, 8.966024f, 8.876695f,
+		8.788854f, 8.702463f, 8.617487f, 8.533889f, 8.451635f, 8.370694f, 8.291032f, 8.212619f,
+		8.135425f, 8.059422f, 7.984580f, 7.910874f, 7.838278f, 7.766764f, 7.696310f, 7.626890f,
+		7.558483f, 7.491064f, 7.424614f, 7.359109f, 7.294531f, 7.230858f, 7.168072f, 7.106154f,
+		7.045085f, 6.984847f, 6.925424f, 6.866799f, 6.808954f, 6.751875f, 6.695546f, 6.639952f,
+		6.585078f, 6.530910f, 6.477434f, 6.424637f, 6.372506f, 6.321027f, 6.270188f, 6.219977f,
+		6.170383f, 6.121393f, 6.072997f, 6.025184f, 5.977942f, 5.931261f, 5.885132f, 5.839543f,
+		5.794487f, 5.749952f, 5.705930f, 5.662412f, 5.619389f, 5.576853f, 5.534794f, 5.493206f,
+		5.452079f, 5.411406f, 5.371179f, 5.331391f, 5.292035f, 5.253103f, 5.214588f, 5.176484f,
+		5.138784f, 5.101481f, 5.064570f, 5.028042f, 4.991894f, 4.956118f, 4.920708f, 4.885660f,
+		4.850967f, 4.816623f, 4.782624f, 4.748964f, 4.715639f, 4.682642f, 4.649969f, 4.617615f,
+		4.585576f, 4.553846f, 4.522421f, 4.491297f, 4.460469f, 4.429933f, 4.399684f, 4.369720f,
+		4.340034f, 4.310624f, 4.281486f, 4.252616f, 4.224009f, 4.195663f, 4.167573f, 4.139737f,
+		4.112150f, 4.084809f, 4.057712f, 4.030853f, 4.004231f, 3.977843f, 3.951684f, 3.925752f,
+		3.900044f, 3.874557f, 3.849288f, 3.824235f, 3.799394f, 3.774762f, 3.750338f, 3.726117f,
+		3.702099f, 3.678279f, 3.654656f, 3.631228f, 3.607991f, 3.584943f, 3.562082f, 3.539405f,
+		3.516911f, 3.494598f, 3.472461f, 3.450501f, 3.428714f, 3.407099f, 3.385653f, 3.364374f,
+		3.343261f, 3.322311f, 3.301523f, 3.280894f, 3.260423f, 3.240108f, 3.219947f, 3.199938f,
+		3.180080f, 3.160370f, 3.140807f, 3.121390f, 3.102116f, 3.082985f, 3.063994f, 3.045142f,
+		3.026427f,
+	}
+};
@@ -18,6 +18,11 @@
 #include "encoder.h"
 #include "pid.h"
 #include "edge_sensor.h"
+#include "scheduler.h"
+#include "profile.h"
+#include "path.h"
+#include "ccmram.h"
+#include "fast_math.h"
 
 // define robot geometry to calculate kinematics
 #define WHEEL_BASE   0.087f              // robot wheel base (distance between the wheels) m
@@ -27,30 +32,118 @@
 const float M_PI_F = (3.141592653589793f);
 const float M_2PI_F = (2.0f*3.141592653589793f);
 
+// odometry heading from the difference of the wheel ticks
+#define POSE_RAD_PER_TICK (ENCODER_DIST_SCALE/WHEEL_BASE)      // heading change per tick of difference (rad)
+#define POSE_TURN_TICKS   (2.0*3.141592653589793/((double)ENCODER_DIST_SCALE/(double)WHEEL_BASE)) // ticks of difference in a turn
+#define POSE_TURN_TICKS_INT  ((int32_t)POSE_TURN_TICKS)                           // whole ticks in a turn
+#define POSE_TURN_TICKS_FRAC ((float)(POSE_TURN_TICKS - (double)POSE_TURN_TICKS_INT)) // and the fraction of a tick (folded at compile time)
+
+// default motion profile limits for driveTo and turnTo (set with setMoveLimits)
+#define MOVE_LIN_ACC   1.0f    // linear acceleration (m/s^2)
+#define MOVE_LIN_JERK  20.0f   // linear jerk (m/s^3), 0 for a trapezoidal profile
+#define MOVE_ANG_ACC   12.0f   // angular acceleration (rad/s^2)
+#define MOVE_ANG_JERK  240.0f  // angular jerk (rad/s^3), 0 for a trapezoidal profile
+
+// landing on the target of a driveTo or turnTo
+#define MOVE_KP        8.0f    // gain (1/s) of the position error added to the profile velocity
+#define MOVE_LIN_TOL   0.002f  // a driveTo is done when the profile has ended and it is within this of the target (m)
+#define MOVE_ANG_TOL   0.01f   // a turnTo is done when the profile has ended and it is within this of the target (rad)
+#define MOVE_REST_VEL  0.5f    // and both wheels are slower than this (rad/s), so the robot does not coast past the target after the STOP
+#define MOVE_SETTLE_S  0.5f    // time after the end of the profile to get within the tolerance before the move is ended anyway (s)
+
+// heading hold during a driveTo (set with setHeadingHold), steers back to the starting heading and line
+//   ang_vel = -MOVE_HOLD_KH*heading error - MOVE_HOLD_KY*lin_vel*cross track error
+#define MOVE_HOLD_KH   6.0f    // heading error gain (1/s)
+#define MOVE_HOLD_KY   40.0f   // cross track error gain (1/m^2), 0 to hold the heading only
+#define MOVE_HOLD_MAX  (MAX_ANG_VEL/4.0f) // largest steering correction (rad/s)
+
+// following a path of waypoints (followPath)
+#define PATH_MAX_ANG   (MAX_ANG_VEL/2.0f) // fastest turn while following a path, the robot slows down on tight curves to stay within it (rad/s)
+#define PATH_MIN_VEL   0.03f   // slowest speed while following a path, so it still gets to the end (m/s)
+
 // local prototypes
 static void setMtrSpeed(uint32_t ch_a, uint32_t ch_b, float duty);
-static void updatePose(float DT);
-
-
-static float speed_l=0.0f; // desired left wheel speed (rad/sec)
-static float speed_r=0.0f; // desired right wheel speed (rad/sec)
-
-static float target_dist_2=0.0f;  // how far to drive (squared) when running a driveTo command - in meters
-static float target_heading=0.0f; // how far to turn when running a turnTo command - in rad
+static void updatePose(void);
+static void readTicks(int64_t * left, int64_t * right);
+static float wrapAngle(float angle);
+static float wrapStep(float angle);
+static float poseHeading(int64_t ticks_diff);
+static void kahanAdd(float * sum, float * c, float v);
+static void updateStream(float DT);
+static MotorEvent updateMove(float DT);
+static MotorEvent updatePath(float DT);
+static void setRobotVel(float lin_vel, float ang_vel);
+static float rampToZero(float speed, float step);
+
+
+// wheel speed targets, set by the motion layer and read by the speed loop in the tick ISR
+static CCMRAM_DATA volatile float speed_l=0.0f; // desired left wheel speed (rad/sec)
+static CCMRAM_DATA volatile float speed_r=0.0f; // desired right wheel speed (rad/sec)
+
+// wheel speed loop
+static CCMRAM_DATA volatile uint32_t speed_loop_ticks=SPEED_LOOP_TICKS; // scheduler ticks between updates
+static CCMRAM_DATA uint32_t speed_loop_count=0;                         // ticks since the last update
+static CCMRAM_DATA SPEED_LOOP_STATS speed_loop_stats;
 
 // reference starting pose of robot when beginning a turnTo or driveTo command
 static float start_pose_x=0.0f;
 static float start_pose_y=0.0f;
-static float start_heading=0.0f;
-
-// current robot pose
-static float pose_x=0.0f;
-static float pose_y=0.0f;
-static float heading=0.0f;
+static int64_t start_ticks_diff=0; // right - left ticks at the start, the heading turned is measured from it
+static float start_cos=1.0f; // direction of a driveTo
+static float start_sin=0.0f;
+
+// current robot pose, integrated from the encoder ticks
+// x and y are float sums that carry their rounding error (Kahan summation) so it does not build up on long runs
+static CCMRAM_DATA float pose_x=0.0f;
+static CCMRAM_DATA float pose_y=0.0f;
+static CCMRAM_DATA float pose_x_c=0.0f; // rounding error of the sums
+static CCMRAM_DATA float pose_y_c=0.0f;
+static CCMRAM_DATA float heading=0.0f;  // heading wrapped to +-PI (rad)
+
+// encoder ticks the pose was last updated from
+static CCMRAM_DATA int64_t pose_ticks_l=0;
+static CCMRAM_DATA int64_t pose_ticks_r=0;
+
+// the heading is computed from the difference of the wheel ticks since it was last set, so it
+// returns to the same value whenever the wheels return to the same ticks
+static CCMRAM_DATA int64_t pose_ticks_diff0=0; // right - left ticks when the heading was set
+static CCMRAM_DATA float pose_theta0=0.0f;     // heading set (rad, wrapped to +-PI)
+static CCMRAM_DATA int32_t pose_turns=0;       // whole turns taken off the ticks difference to give the wrapped heading
+
+// state of the streaming setpoint mode
+static bool streaming=false;               // true while the host is streaming setpoints
+static bool stream_stopping=false;         // true while the watchdog is ramping the wheels to a stop
+static volatile bool stream_pending=false; // new setpoint waiting to be applied at the next motion update
+static float stream_lin_vel=0.0f;          // latest setpoint
+static float stream_ang_vel=0.0f;
+static uint32_t stream_rx_us=0;            // time the latest setpoint was received
+static uint32_t stream_timeout_us=STREAM_TIMEOUT_MS*1000;
+static CCMRAM_DATA volatile bool stream_pwm_pending=false; // a setpoint was applied, the next speed loop update measures its latency
+static CCMRAM_DATA uint32_t stream_pwm_rx_us=0;            // receive time of the setpoint applied
+static CCMRAM_DATA STREAM_STATS stream_stats;
 
 // flags to control the driveTo and turnTo commands
 static bool driving=false; // true if currently performing a driveTo or turnTo command
-static bool turn_ccw=false; // set direction of turn in a turnTo, true = counter clock wise (to the left)
+static bool turning=false; // true if the move is a turnTo, false for a driveTo
+static float move_dir=1.0f; // direction of the move, +1 forwards/left, -1 backwards/right
+static float move_t=0.0f;   // time since the move started (s)
+static PROFILE move_profile; // velocity profile of the move
+
+// motion profile limits
+static float move_lin_acc=MOVE_LIN_ACC;
+static float move_lin_jerk=MOVE_LIN_JERK;
+static float move_ang_acc=MOVE_ANG_ACC;
+static float move_ang_jerk=MOVE_ANG_JERK;
+
+// heading hold gains
+static float hold_kh=MOVE_HOLD_KH;
+static float hold_ky=MOVE_HOLD_KY;
+
+// state of a followPath command
+static bool following=false;       // true while following the path in the waypoint queue
+static float path_vel=0.0f;        // speed to follow the path at (m/s)
+static float path_lookahead=0.0f;  // distance ahead on the path to steer to (m)
+static float path_lin_vel=0.0f;    // current speed along the path (m/s)
 
 //
 // Set PWM output for a motor for desired power
@@ -60,7 +153,7 @@ static bool turn_ccw=false; // set direction of turn in a turnTo, true = counter
 // Duty of active PWM is abs(duty)
 //
 // duty:  -1 >= duty <= 1
-void setMtrSpeed(uint32_t ch_a, uint32_t ch_b, float duty) {
+CCMRAM_CODE void setMtrSpeed(uint32_t ch_a, uint32_t ch_b, float duty) {
 
 	uint16_t duty_a=0;
 	uint16_t duty_b=0;
@@ -99,6 +192,17 @@ void STOP(void) {
 
 	// Cancel driving commands
 	driving = false;
+	following = false;
+	streaming = false;
+	stream_stopping = false;
+	stream_pending = false;
+	stream_pwm_pending = false;
+}
+
+// set both PWM outputs to 0 now, leaving the commands and target speeds as they are (called from the edge sensor fast stop ISR)
+void motorsOff(void) {
+	setMtrSpeed(TIM_CHANNEL_1,TIM_CHANNEL_2,0.0f);
+	setMtrSpeed(TIM_CHANNEL_4,TIM_CHANNEL_3,0.0f);
 }
 
 // set target velocity for each wheel (in rad/s)
@@ -108,95 +212,120 @@ void setMotorSpeed(float left, float right) {
 }
 
 
-// set target velocities for each wheel based on desired robot dynamics
+// set target velocities for each wheel based on desired robot dynamics, cancelling any driveTo or turnTo
 // lin_vel : desired linear velocity of robot center (m/s)
 // ang_vel : desired angular velocity of robot (rad/s)
 void drive(float lin_vel, float ang_vel) {
+	driving = false;
+	following = false;
+	setRobotVel(lin_vel,ang_vel);
+}
+
+// set target velocities for each wheel from the robot velocities
+static void setRobotVel(float lin_vel, float ang_vel) {
 
 	// calculate individual wheel speeds from differential drive kinematics equations
 	speed_l =  (lin_vel - ang_vel * WHEEL_BASE/2.0f)/WHEEL_RADIUS;
 	speed_r =  (lin_vel + ang_vel * WHEEL_BASE/2.0f)/WHEEL_RADIUS;
 }
 
-// update the motor controller and robot driving status
-// if pid_update is true will update the PID controller also (and associated state like the encoders and output the speeds to the wheels)
-// also updates the internal robot pose
-// DT is the update period (sec) used for teh inverse kinematics to update the internal pose estimate
-//
-// Returns any events that are trigered like end of driveTo or turnTo command or is a bump sensor is detected
-//
-// If at any time the motors are driving and an enabled bumb sensor detects a hit both motors are imediatly stopped.
-//
-MotorEvent updateMotors(bool pid_update, float DT) {
+// set how often the wheel speed loop runs (in scheduler ticks), the encoder and PID periods are set to match
+// (the PID gains are continuous time so they do not change with the rate)
+// 0 stops the speed loop, leaving the PWM as it is (e.g. to call updateEncoder directly)
+void setSpeedLoopRate(uint32_t ticks) {
 
+	if(ticks == 0) {
+		speed_loop_ticks = 0;
+		return;
+	}
 
-	MotorEvent event = ME_NONE;
+	float dt = (float)(ticks*SCHED_TICK_US)*1.0e-6f;
 
-	if(pid_update) { // see if we should update the PID this time through
+	__disable_irq(); // the speed loop must not run while its periods change
+	speed_loop_ticks = ticks;
+	speed_loop_count = 0;
+	pid_left.dt = dt;
+	pid_right.dt = dt;
+	encoderSetPeriod(dt);
+	__enable_irq();
+}
 
-		float duty_l=0.0f; // left wheel output duty cycle  (-1.0 -- 1.0)
-		float duty_r=0.0f; // right wheel output duty cycle (-1.0 -- 1.0)
+// run the wheel speed loop, called every scheduler tick from the tick ISR and runs every speed_loop_ticks
+// updates the encoders, runs the PIDs to the wheel speed targets and sets the PWM
+// running it from the timer rather than the main loop keeps the period steady, so it can run fast enough for a stiff speed loop
+CCMRAM_CODE void updateSpeedLoop(void) {
 
-		// get latest speed and position estimates from encoders
-		updateEncoder(&enc_left);
-		updateEncoder(&enc_right);
+	if(speed_loop_ticks == 0 || ++speed_loop_count < speed_loop_ticks) {
+		return;
+	}
+	speed_loop_count = 0;
 
-		// run PID for speed control
-		duty_l = pidUpdate(speed_l,enc_left.state.vel,&pid_left);
-		duty_r = pidUpdate(speed_r,enc_right.state.vel,&pid_right);
+	uint32_t start_us = schedMicros();
 
-		// set output PWM duty for both motors
-		setMtrSpeed(TIM_CHANNEL_1,TIM_CHANNEL_2,duty_l);
-		setMtrSpeed(TIM_CHANNEL_4,TIM_CHANNEL_3,duty_r);
+	// get latest speed and position estimates from encoders
+	updateEncoder(&enc_left);
+	updateEncoder(&enc_right);
 
-		updatePose(DT); // calculate updated pose
+	// run PID for speed control
+	float duty_l = pidUpdate(speed_l,enc_left.state.vel,&pid_left);  // left wheel output duty cycle  (-1.0 -- 1.0)
+	float duty_r = pidUpdate(speed_r,enc_right.state.vel,&pid_right); // right wheel output duty cycle (-1.0 -- 1.0)
 
-		// now test if we have complted a turn to or driveTo command (if one is running)
-		float ref_heading = heading; // get current heading
+	// set output PWM duty for both motors
+	setMtrSpeed(TIM_CHANNEL_1,TIM_CHANNEL_2,duty_l);
+	setMtrSpeed(TIM_CHANNEL_4,TIM_CHANNEL_3,duty_r);
 
-		if(driving && (target_heading != 0.0f)) { // if doing a turnTo command
+	if(edgeSensorTripped()) { // an edge sensor fast stop is holding the motors off (checked after setting them in case it tripped while doing so)
+		motorsOff();
+	}
 
-            // see if we will turn through 0 heading and handle wrap around of angles if needed
-			if (((ref_heading < 0.0f) && (start_heading >=0.0f)) || ((ref_heading >= 0.0f) && (start_heading < 0.0f))) {
+	if(stream_pwm_pending) { // the PWM now follows the targets of a new streamed setpoint, measure its time from arrival
+		stream_pwm_pending = false;
+		uint32_t latency = schedMicros() - stream_pwm_rx_us;
+		stream_stats.latency_us = latency;
+		if(latency > stream_stats.latency_max_us) {
+			stream_stats.latency_max_us = latency;
+		}
+	}
 
+	uint32_t exec_us = schedMicros() - start_us;
+	speed_loop_stats.runs++;
+	speed_loop_stats.exec_us = exec_us;
+	if(exec_us > speed_loop_stats.exec_max_us) {
+		speed_loop_stats.exec_max_us = exec_us;
+	}
+}
 
-				// handle wrapping around target from + to - angles
-				if(ref_heading < 0.0f ) {
-					if(turn_ccw) {
-					   ref_heading += M_2PI_F;
-					}
-				}
-				else {
-					if(!turn_ccw) {
-					   ref_heading -= M_2PI_F;
-					}
-				}
-			}
+// get the speed loop statistics
+const SPEED_LOOP_STATS * getSpeedLoopStats(void) {
+	return &speed_loop_stats;
+}
 
-			// now see if we have turned far enough
-			if(fabsf(ref_heading-start_heading) >= target_heading) {
-				STOP(); // turn completed so stop and refurn event
-				event = ME_DONE_TURN;
-			}
-		}
+// update the motion layer and robot driving status
+// if motion_update is true updates the internal robot pose and runs the driveTo, turnTo, followPath or streaming
+// command, which set the wheel speed targets the speed loop drives the wheels to
+// DT is the update period (sec) of the motion layer
+//
+// Returns any events that are trigered like end of driveTo, turnTo or followPath command or is a bump sensor is detected
+//
+// If at any time the motors are driving and an enabled bumb sensor detects a hit both motors are imediatly stopped.
+//
+MotorEvent updateMotors(bool motion_update, float DT) {
+
+
+	MotorEvent event = ME_NONE;
 
-		// check if doing a driveTo command and stop if we have gone far enough
-		if(driving && (target_dist_2 != 0.0f)) {
+	if(motion_update) { // see if we should update the motion layer this time through
 
-			// calculate squared magnitude of distance we have moved
-			float dx=pose_x-start_pose_x;
-			float dy=pose_y-start_pose_y;
+		updateStream(DT); // apply the latest streamed setpoint, or stop if the stream has timed out
 
-			if (( dx*dx+dy*dy) >= target_dist_2) { // compare to square magnatude of target distance
-				STOP(); // got htere so stop
-				event = ME_DONE_DRIVE; // return done event
+		updatePose(); // calculate updated pose from the encoder ticks counted by the speed loop
 
-			}
+		if(driving) { // set the wheel speeds from the motion profile of a driveTo or turnTo, and end it if it has landed on the target
+			event = updateMove(DT);
 		}
-		if(driving) {
-			//printf("sh=%5.2f, th=%5.2f, h=%5.2f, rh=%5.2f\n",start_heading,target_heading,heading,ref_heading);
+		else if(following) { // steer along the path, and end it once the last waypoint is reached
+			event = updatePath(DT);
 		}
-
 	}
 
 	// check if either bumper has a hit (if enabled)
@@ -205,7 +334,12 @@ MotorEvent updateMotors(bool pid_update, float DT) {
 
 	if(leftClif || rightClif) {
 		STOP(); // stop if bumper hit
-		event = leftClif?ME_BUMP_LEFT:ME_BUMP_RIGHT; // return event that bumper is hit
+		if(leftClif) { // return event that bumper is hit (as well as any move that ended)
+			event |= ME_BUMP_LEFT;
+		}
+		if(rightClif) {
+			event |= ME_BUMP_RIGHT;
+		}
 	}
 
 	return event; // return any events that were generated
@@ -213,76 +347,371 @@ MotorEvent updateMotors(bool pid_update, float DT) {
 
 // start a turnTo command
 // make robot turn through an angle in radians (angle can be +ve or -ve)
-// turn at ang_vel angular velocity (rad/s)(ang_vel shuold always be positive)
+// turn at up to ang_vel angular velocity (rad/s)(ang_vel shuold always be positive), accelerating and slowing down
+// within the move limits to land on the target angle
 void turnTo(float angle, float ang_vel) {
 
-	start_heading = heading;       // get starting heading
-	target_heading = fabsf(angle); // get magnitude of target angle to turn through
+	start_ticks_diff = pose_ticks_r - pose_ticks_l; // get starting heading
 
-	target_dist_2=0.0f; // target distance is 0 when turning
-	driving=true;       // flag that we are making a turn
+	turning=true;     // flag that we are making a turn
+	move_dir = (angle < 0.0f)?-1.0f:1.0f; // -ve angle turns to the right
+	move_t = 0.0f;
+	profilePlan(&move_profile,angle,fabsf(ang_vel),move_ang_acc,move_ang_jerk);
 
-	if(angle<0.0f) {
-		turn_ccw=false;  // set flag saying we are turning right
-		drive(0.0f,-fabsf(ang_vel)); // desired turn is -ve angle so command robot to start turning to the right
-	}
-	else {
-		turn_ccw=true; // set flag saying we are turning left
-		drive(0.0f,fabsf(ang_vel));  //  desired turn is +ve angle so command robot to start turning to the left
-	}
+	driving=true;     // start the move at the next motion update
+	following=false;  // a move cancels following a path
+	streaming=false;  // a move cancels the setpoint stream
 }
 
 
 // start a driveTo command
-// make the robot drive forward or backwards in a straight line at given distance( dist in m) at a given speed(lin_vel in m/s)
+// make the robot drive forward or backwards in a straight line at given distance( dist in m) at up to a given speed(lin_vel in m/s),
+// accelerating and slowing down within the move limits to land on the target distance
 // to drive backwards make dist -ve, velocity should always be +ve
 void driveTo(float dist, float lin_vel) {
 
 	// get current pose as starting point
 	start_pose_x = pose_x;
 	start_pose_y = pose_y;
+	start_ticks_diff = pose_ticks_r - pose_ticks_l;
+	fastSinCos(heading,&start_sin,&start_cos);
+
+	turning=false;
+	move_dir = (dist < 0.0f)?-1.0f:1.0f; // -ve distance drives backwards
+	move_t = 0.0f;
+	profilePlan(&move_profile,dist,fabsf(lin_vel),move_lin_acc,move_lin_jerk);
+
+	driving=true; // start the move at the next motion update
+	following=false; // a move cancels following a path
+	streaming=false; // a move cancels the setpoint stream
+}
+
+// run the motion profile of a driveTo or turnTo
+// the wheel speeds are set from the profile velocity, plus a correction for the difference between where the profile
+// says the robot should be and how far it has moved, so it lands on the target when the profile ends
+// a driveTo also steers to hold the starting heading and line, so it drives straight when the motors do not match
+// returns ME_DONE_DRIVE or ME_DONE_TURN (and stops) once the move is within tolerance of the target after the profile has ended
+static MotorEvent updateMove(float DT) {
+
+	float pos;
+	float vel;
 
-	lin_vel = fabsf(lin_vel); // make sure velocity is positive
+	move_t += DT;
+	bool ended = profileEval(&move_profile,move_t,&pos,&vel);
 
-	target_dist_2 = dist*dist; // use squared distance to save abs and sqrt when testing if move done
-	target_heading= 0.0f;  // target turn is 0 when driving straight
+	// heading turned since the start, from the ticks so it is not wrapped
+	float turned = (float)(int32_t)((pose_ticks_r - pose_ticks_l) - start_ticks_diff)*POSE_RAD_PER_TICK;
 
-	driving=true; // set flag to say we are driving
+	// distance moved towards the target (along the starting heading for a driveTo)
+	float moved;
+	if(turning) {
+		moved = move_dir*turned;
+	}
+	else {
+		moved = move_dir*((pose_x - start_pose_x)*start_cos + (pose_y - start_pose_y)*start_sin);
+	}
+
+	if(ended) {
+		float tol = turning?MOVE_ANG_TOL:MOVE_LIN_TOL;
+		bool at_rest = fabsf(enc_left.state.vel) < MOVE_REST_VEL && fabsf(enc_right.state.vel) < MOVE_REST_VEL;
+		if((fabsf(move_profile.dist - moved) <= tol && at_rest) || move_t > move_profile.t_end + MOVE_SETTLE_S) {
+			STOP(); // landed on the target (or could not get there) so stop and return event
+			return turning?ME_DONE_TURN:ME_DONE_DRIVE;
+		}
+	}
 
-	if(dist < 0.0f) {
-	   drive(-lin_vel,0.0f); // target distance is -ve so start driving backwards
+	float cmd = vel + MOVE_KP*(pos - moved);
+	if(cmd > move_profile.vel) { // do not go faster than the profile to catch up
+		cmd = move_profile.vel;
+	}
+	else if(cmd < -move_profile.vel) {
+		cmd = -move_profile.vel;
+	}
 
+	if(turning) {
+		setRobotVel(0.0f,move_dir*cmd);
 	}
 	else {
-	   drive(lin_vel,0.0f); // target distance is +ve so start driving forwards
+		float lin_vel = move_dir*cmd;
+		float heading_err = turned;
+		float cross_err = (pose_y - start_pose_y)*start_cos - (pose_x - start_pose_x)*start_sin; // +ve to the left of the line
+
+		float ang_vel = -hold_kh*heading_err - hold_ky*lin_vel*cross_err; // steering reverses when backing up
+		if(ang_vel > MOVE_HOLD_MAX) {
+			ang_vel = MOVE_HOLD_MAX;
+		}
+		else if(ang_vel < -MOVE_HOLD_MAX) {
+			ang_vel = -MOVE_HOLD_MAX;
+		}
+
+		setRobotVel(lin_vel,ang_vel);
+	}
+
+	return ME_NONE;
+}
+
+// start a followPath command
+// follow the path through the waypoints in the queue (from the current pose) at up to lin_vel (m/s), steering to the
+// point lookahead (m) ahead on the path. A longer lookahead gives a smoother path that cuts the corners more.
+// Waypoints can be added while the path is followed, ME_DONE_PATH is returned once the last one is reached
+void followPath(float lin_vel, float lookahead) {
+
+	POSE pose;
+	getPose(&pose);
+	pathStart(&pose);
+
+	path_vel = fabsf(lin_vel);
+	path_lookahead = lookahead;
+	path_lin_vel = 0.0f;
+
+	following=true;   // start at the next motion update
+	driving=false;    // cancels a driveTo or turnTo
+	streaming=false;  // and the setpoint stream
+}
+
+// steer along the path (pure pursuit)
+// the speed is limited so the robot can stop at the end of the path and keep the turn rate within PATH_MAX_ANG
+// on tight curves, and it accelerates within the driveTo acceleration limit
+// returns ME_DONE_PATH (and stops) once the last waypoint is reached
+static MotorEvent updatePath(float DT) {
+
+	POSE pose;
+	getPose(&pose);
+
+	float curvature;
+	float remaining;
+	if(pathUpdate(&pose,path_lookahead,&curvature,&remaining)) {
+		STOP(); // got to the end of the path so stop and return event
+		return ME_DONE_PATH;
+	}
+
+	float lin_vel = path_vel;
+
+	float stop_vel = sqrtf(2.0f*move_lin_acc*remaining); // speed to stop at the end
+	if(lin_vel > stop_vel) {
+		lin_vel = stop_vel;
+	}
+	if(lin_vel*fabsf(curvature) > PATH_MAX_ANG) {
+		lin_vel = PATH_MAX_ANG/fabsf(curvature);
+	}
+	if(lin_vel < PATH_MIN_VEL) {
+		lin_vel = (path_vel < PATH_MIN_VEL)?path_vel:PATH_MIN_VEL;
+	}
+	if(lin_vel > path_lin_vel + move_lin_acc*DT) {
+		lin_vel = path_lin_vel + move_lin_acc*DT;
+	}
+	path_lin_vel = lin_vel;
+
+	float ang_vel = lin_vel*curvature;
+	if(ang_vel > PATH_MAX_ANG) { // pointing away from the path at PATH_MIN_VEL
+		ang_vel = PATH_MAX_ANG;
+	}
+	else if(ang_vel < -PATH_MAX_ANG) {
+		ang_vel = -PATH_MAX_ANG;
+	}
+
+	setRobotVel(lin_vel,ang_vel);
+
+	return ME_NONE;
+}
+
+// set the heading hold gains used by driveTo (0,0 turns it off, ky 0 holds the heading only)
+void setHeadingHold(float kh, float ky) {
+	hold_kh = kh;
+	hold_ky = ky;
+}
+
+// set the motion profile limits used by driveTo and turnTo (jerk 0 for trapezoidal profiles)
+void setMoveLimits(float lin_acc, float lin_jerk, float ang_acc, float ang_jerk) {
+	move_lin_acc = lin_acc;
+	move_lin_jerk = lin_jerk;
+	move_ang_acc = ang_acc;
+	move_ang_jerk = ang_jerk;
+}
+
+// set the robot velocity from a setpoint streamed by the host
+// the setpoint is applied at the next motion update. If no new setpoint arrives within the watchdog
+// timeout the wheels are ramped down and the robot is stopped (so it does not run away if the link drops)
+void streamVelocity(float lin_vel, float ang_vel) {
+
+	stream_lin_vel = lin_vel;
+	stream_ang_vel = ang_vel;
+	stream_rx_us = schedMicros();
+	stream_pending = true;
+
+	if(!streaming) { // starting a stream cancels any driveTo, turnTo or followPath
+		driving = false;
+		following = false;
+		streaming = true;
+	}
+	stream_stopping = false;
+
+	stream_stats.setpoints++;
+}
+
+// set the streaming setpoint watchdog timeout (ms)
+void setStreamTimeout(uint32_t ms) {
+	stream_timeout_us = ms*1000;
+}
+
+// get the streaming setpoint statistics
+const STREAM_STATS * getStreamStats(void) {
+	return &stream_stats;
+}
+
+// apply a new streamed setpoint, and run the watchdog (called at each motion update)
+static void updateStream(float DT) {
+
+	if(!streaming) {
+		return;
+	}
+
+	if(stream_pending) {
+		stream_pending = false;
+		drive(stream_lin_vel,stream_ang_vel);
+		stream_stats.applied++;
+		stream_pwm_rx_us = stream_rx_us; // latency is measured when the speed loop writes the PWM for the new targets
+		stream_pwm_pending = true;
+	}
+	else if(!stream_stopping && (schedMicros() - stream_rx_us) > stream_timeout_us) { // no setpoint in time
+		stream_stopping = true;
+		stream_stats.timeouts++;
+	}
+
+	if(stream_stopping) { // ramp both wheels down, then stop
+		float step = STREAM_STOP_DECEL*DT;
+		speed_l = rampToZero(speed_l,step);
+		speed_r = rampToZero(speed_r,step);
+		if(speed_l == 0.0f && speed_r == 0.0f) {
+			STOP();
+		}
+	}
+}
+
+// move speed towards 0 by step
+static float rampToZero(float speed, float step) {
+	if(speed > step) {
+		return speed - step;
+	}
+	if(speed < -step) {
+		return speed + step;
 	}
+	return 0.0f;
 }
 
 // update the internal robot pose estimate
-// use the inverse kinematics to calculate the new robot pose based on how farst each wheel is rotating
-void updatePose(float DT) {
+// use the inverse kinematics to calculate the new robot pose from the encoder ticks each wheel has moved since the last update
+// each wheel is taken to turn at a constant speed during the update, so the robot moves along an arc. The arc's chord is
+// along the heading half way through the turn, and is shorter than the arc by sin(dtheta/2)/(dtheta/2)
+CCMRAM_CODE void updatePose(void) {
+
+	int64_t ticks_l;
+	int64_t ticks_r;
+	readTicks(&ticks_l,&ticks_r);
+
+	// wheel ticks moved
+	int32_t dl = (int32_t)(ticks_l - pose_ticks_l);
+	int32_t dr = (int32_t)(ticks_r - pose_ticks_r);
+	pose_ticks_l = ticks_l;
+	pose_ticks_r = ticks_r;
+
+	float d = (float)(dl+dr)*(ENCODER_DIST_SCALE/2.0f); // robot linear distance moved (m)
+	float half = (float)(dr-dl)*(POSE_RAD_PER_TICK/2.0f); // half the angle turned in this update (rad)
+
+	float sin_half;
+	float cos_half;
+	fastSinCos(half,&sin_half,&cos_half);
+	float chord = (fabsf(half) < 1.0e-3f)?(1.0f - half*half/6.0f):(sin_half/half); // chord/arc length (series for small angles)
+	float mid = wrapStep(heading + half); // heading half way through the turn
+
+	// compute new x,y pose from the chord of the arc
+	float sin_mid;
+	float cos_mid;
+	fastSinCos(mid,&sin_mid,&cos_mid);
+	kahanAdd(&pose_x,&pose_x_c,d*chord*cos_mid);
+	kahanAdd(&pose_y,&pose_y_c,d*chord*sin_mid);
+
+	// new heading from the ticks difference since the heading was set, it has moved less than a turn since the
+	// last update so at most one turn is taken off
+	float h = poseHeading(ticks_r - ticks_l);
+	if(h > M_PI_F) {
+		pose_turns++;
+		h = poseHeading(ticks_r - ticks_l);
+	}
+	else if(h < -M_PI_F) {
+		pose_turns--;
+		h = poseHeading(ticks_r - ticks_l);
+	}
+	heading = h;
+}
 
-	float dl = enc_left.state.vel*DT*WHEEL_RADIUS; // compute left wheel distance moved from encoder angular velocity and update period
-	float dr = enc_right.state.vel*DT*WHEEL_RADIUS;// compute right wheel distance moved from encoder angular velocity and update period
+// heading (rad) at a right - left ticks difference, less pose_turns whole turns
+// the turns are taken off the ticks (a whole number of ticks and the fraction left over) before they are scaled, so
+// the heading has the resolution of the ticks in the turn however far the robot has turned, and returns to the same
+// value whenever the wheels return to the same ticks
+CCMRAM_CODE static float poseHeading(int64_t ticks_diff) {
+	int32_t ticks = (int32_t)(ticks_diff - pose_ticks_diff0 - (int64_t)pose_turns*POSE_TURN_TICKS_INT);
+	return pose_theta0 + ((float)ticks - (float)pose_turns*POSE_TURN_TICKS_FRAC)*POSE_RAD_PER_TICK;
+}
 
-	float d = (dl+dr)/2.0f; // robot linear distance moved (m)
+// add v to a float sum, carrying the rounding error of the sum in c so it is added back in with the next value
+CCMRAM_CODE static void kahanAdd(float * sum, float * c, float v) {
+	float y = v - *c;
+	float t = *sum + y;
+	*c = (t - *sum) - y;
+	*sum = t;
+}
 
-	float dt = (dr-dl)/WHEEL_BASE; // robot angle turned (rad)
+// take a consistent copy of the wheel ticks (they are counted by the speed loop in the tick ISR)
+CCMRAM_CODE static void readTicks(int64_t * left, int64_t * right) {
+	__disable_irq();
+	*left = enc_left.ticks;
+	*right = enc_right.ticks;
+	__enable_irq();
+}
 
-    heading += dt; // update heading from angle turned
+// wrap an angle to +-PI
+static float wrapAngle(float angle) {
+	return remainderf(angle,M_2PI_F);
+}
 
-    // clamp heading between +-PI
-	if(heading > M_PI_F) {
-		heading -= M_2PI_F;
+// wrap an angle that is within a turn of +-PI to +-PI (no library call, for the odometry update)
+CCMRAM_CODE static float wrapStep(float angle) {
+	if(angle > M_PI_F) {
+		return angle - M_2PI_F;
 	}
-	else if(heading <= -M_PI_F) {
-		heading += M_2PI_F;
+	if(angle < -M_PI_F) {
+		return angle + M_2PI_F;
 	}
+	return angle;
+}
+
+// set the robot pose (m, m, rad), the pose is integrated from here as the wheels move
+// a running driveTo or turnTo measures from the pose at its start, so set the pose while the robot is stopped
+void setPose(float x, float y, float theta) {
+
+	readTicks(&pose_ticks_l,&pose_ticks_r);
+	pose_ticks_diff0 = pose_ticks_r - pose_ticks_l;
 
-	// compute new x,y pose from distance moved and new heading
-    pose_x += d * cosf(heading);
-	pose_y += d * sinf(heading);
+	pose_x = x;
+	pose_y = y;
+	pose_x_c = 0.0f;
+	pose_y_c = 0.0f;
+	pose_theta0 = wrapAngle(theta);
+	pose_turns = 0;
+	heading = pose_theta0;
+}
+
+// set the pose back to the origin
+void resetPose(void) {
+	setPose(0.0f,0.0f,0.0f);
+}
 
+// get the current robot pose
+void getPose(POSE * pose) {
+	pose->x = pose_x;
+	pose->y = pose_y;
+	pose->heading = heading;
 }
 
 
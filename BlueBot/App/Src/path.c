@@ -0,0 +1,162 @@
+/*
+ * path.c
+ *
+ *  Waypoint queue and pure pursuit path tracker
+ */
+
+#include <math.h>
+#include "path.h"
+#include "fast_math.h"
+
+static const WAYPOINT * getWaypoint(uint16_t n);
+static void popWaypoint(void);
+
+
+// queue of waypoints (ring buffer), the first is the end of the segment being followed
+static WAYPOINT path_queue[PATH_QUEUE_SIZE];
+static uint16_t path_head=0;  // index of the first waypoint
+static uint16_t path_count=0; // waypoints in the queue
+
+static WAYPOINT path_from; // start of the segment being followed (the last waypoint passed)
+
+
+// add a waypoint to the end of the queue, false if the queue is full
+bool pathAdd(float x, float y) {
+
+	if(path_count == PATH_QUEUE_SIZE) {
+		return false;
+	}
+
+	WAYPOINT * wp = &path_queue[(path_head + path_count)%PATH_QUEUE_SIZE];
+	wp->x = x;
+	wp->y = y;
+	path_count++;
+
+	return true;
+}
+
+// remove all the waypoints
+void pathClear(void) {
+	path_head = 0;
+	path_count = 0;
+}
+
+// waypoints in the queue
+uint16_t pathCount(void) {
+	return path_count;
+}
+
+// start the path from the robot pose, the first segment runs from here to the first waypoint
+void pathStart(const POSE * pose) {
+	path_from.x = pose->x;
+	path_from.y = pose->y;
+}
+
+// find the curvature to steer to the point lookahead along the path (pure pursuit)
+// the arc from the robot to the lookahead point has curvature 2*y/d^2, where y is the distance of the point to the
+// left of the robot and d is the distance to the point. The robot follows the arc for one update then a new point is found
+//
+// returns true once the last waypoint is reached (or passed), the queue is then empty
+bool pathUpdate(const POSE * pose, float lookahead, float * curvature, float * remaining) {
+
+	*curvature = 0.0f;
+	*remaining = 0.0f;
+
+	// find how far the robot is along the segment to the first waypoint, dropping the waypoints it has passed
+	// a waypoint is passed once the robot is level with it, or is within the lookahead of it (goal tolerance of the last one)
+	float along;
+	float len;
+	while(true) {
+
+		if(path_count == 0) {
+			return true;
+		}
+
+		const WAYPOINT * to = getWaypoint(0);
+		float dx = to->x - path_from.x;
+		float dy = to->y - path_from.y;
+		float rx = to->x - pose->x;
+		float ry = to->y - pose->y;
+
+		len = sqrtf(dx*dx + dy*dy);
+		along = (len > 0.0f)?len - (rx*dx + ry*dy)/len:0.0f; // a 0 length segment is passed straight away
+
+		float reached = (path_count == 1)?PATH_GOAL_TOL:lookahead;
+		if(along < len && rx*rx + ry*ry > reached*reached) {
+			break;
+		}
+		popWaypoint();
+	}
+
+	// walk the lookahead distance along the path from the robot's place on the segment (stopping at the last waypoint)
+	// and add up the length of the path left
+	float ahead = ((along > 0.0f)?along:0.0f) + lookahead;
+	float gx = path_from.x;
+	float gy = path_from.y;
+	bool found = false;
+	float fx = path_from.x;
+	float fy = path_from.y;
+
+	*remaining = len - along;
+
+	for(uint16_t n=0; n < path_count; n++) {
+
+		const WAYPOINT * to = getWaypoint(n);
+		float dx = to->x - fx;
+		float dy = to->y - fy;
+		float seg = (n == 0)?len:sqrtf(dx*dx + dy*dy);
+
+		if(n > 0) {
+			*remaining += seg;
+		}
+
+		if(!found) {
+			if(ahead < seg) {
+				gx = fx + dx*ahead/seg;
+				gy = fy + dy*ahead/seg;
+				found = true;
+			}
+			else {
+				gx = to->x;
+				gy = to->y;
+				ahead -= seg;
+			}
+		}
+
+		fx = to->x;
+		fy = to->y;
+	}
+
+	// lookahead point relative to the robot, x along the heading and y to the left
+	float s;
+	float c;
+	fastSinCos(pose->heading,&s,&c);
+	float dx = gx - pose->x;
+	float dy = gy - pose->y;
+	float x = c*dx + s*dy;
+	float y = c*dy - s*dx;
+	float d2 = x*x + y*y;
+
+	if(d2 > 1.0e-6f) {
+		if(x > 0.0f) {
+			*curvature = 2.0f*y/d2;
+		}
+		else { // the point is behind, turn towards it as tightly as when it is level with the robot
+			*curvature = ((y < 0.0f)?-2.0f:2.0f)/sqrtf(d2);
+		}
+	}
+
+	return false;
+}
+
+// get the n'th waypoint in the queue
+static const WAYPOINT * getWaypoint(uint16_t n) {
+	return &path_queue[(path_head + n)%PATH_QUEUE_SIZE];
+}
+
+// remove the first waypoint, the next segment starts from it
+static void popWaypoint(void) {
+	path_from = path_queue[path_head];
+	path_head = (path_head + 1)%PATH_QUEUE_SIZE;
+	path_count--;
+}
@@ -9,15 +9,52 @@
 
 #include <stdio.h>
 #include "pid.h"
+#include "ccmram.h"
 
+// limit the rate of change of the setpoint, a stop (0 setpoint) is always applied at once
+CCMRAM_CODE static float slewSetpoint(float target, float last_ref, const PID * pid) {
 
-// implement basic parallel PID (PI) controller
-float pidUpdate(float target, float current, PID * pid)  {
+	if(pid->slew <= 0.0f || target == 0.0f) {
+		return target;
+	}
+
+	float step = pid->slew*pid->dt;
+
+	if(target > last_ref + step) {
+		return last_ref + step;
+	}
+	if(target < last_ref - step) {
+		return last_ref - step;
+	}
+	return target;
+}
+
+// static feed-forward, the duty expected to hold the motor at the setpoint speed
+CCMRAM_CODE static float feedForward(float ref, const PID * pid) {
 
-	float error = target - current; // compute error
+	float ff = pid->kf*ref;
+
+	if(ref > 0.0f) {
+		ff += pid->deadband;
+	}
+	else if(ref < 0.0f) {
+		ff -= pid->deadband;
+	}
+	return ff;
+}
+
+
+// implement basic parallel PID (PI) controller, with feed-forward
+CCMRAM_CODE float pidUpdate(float target, float current, PID * pid)  {
 
 	PID_STATE * pid_state = &pid->state; // get pointer to PID state info in PID structure
 
+	float ref = slewSetpoint(target,pid_state->ref,pid); // setpoint the controller tracks this update
+
+	float error = ref - current; // compute error
+
+	float ff = feedForward(ref,pid);
+
 	// compute integral
     float I = pid_state->I + error*pid->dt;
 
@@ -26,11 +63,18 @@ float pidUpdate(float target, float current, PID * pid)  {
     	I=0.0f;
     }
 
-    // compute output as Kp * error + Ki * dT * Integral(error)
-	float duty = pid->kp * error + pid->ki * I;
+    // compute output as FF + Kp * error + Ki * dT * Integral(error)
+	float duty = ff + pid->kp * error + pid->ki * I;
+
+	// anti-windup, don't integrate an error that pushes the output further into saturation
+	if(pid->antiWindup && ((duty > 1.0f && error > 0.0f) || (duty < -1.0f && error < 0.0f))) {
+		I = pid_state->I;
+		duty = ff + pid->kp * error + pid->ki * I;
+	}
 
 	if(pid->openLoop) { // if in open loop bypass code and just pass input to output
 		duty= target;
+		ref = target;
 	}
 
 	// clamp output to +-1
@@ -52,10 +96,11 @@ float pidUpdate(float target, float current, PID * pid)  {
 	pid_state->error = error;
 	pid_state->I = I;
 
-	pid_state->ref=target;
+	pid_state->ref=ref;
 	pid_state->fb=current;
 	pid_state->u=duty;
 
 	// return desired output
 	return duty;
 }
+
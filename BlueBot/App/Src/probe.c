@@ -0,0 +1,134 @@
+/*
+ * probe.c
+ *
+ *  Cycle count probes for timing the hot paths
+ */
+
+#include <string.h>
+#include "probe.h"
+
+static PROBE_STATS probe_stats[NUM_PROBES];
+
+static const char * const probe_names[NUM_PROBES] = {
+	"speed loop", "main loop", "IR sensors", "motors", "coms", "controler", "telemetry"
+};
+
+
+// start the cycle counter and clear the stats
+void probeInit(void) {
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // enable the DWT
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;            // start the cycle counter (it runs on from where it is, probes only use differences)
+
+	for(int id=0; id < NUM_PROBES; id++) {
+		probeReset(id);
+	}
+}
+
+// add the cycles since start to the stats of probe id
+void probeEnd(PROBE_ID id, uint32_t start) {
+
+	uint32_t cycles = DWT->CYCCNT - start; // wraps every 67s at 64MHz, so a single run must take less than that
+	PROBE_STATS * st = &probe_stats[id];
+
+	if(cycles < st->min) {
+		st->min = cycles;
+	}
+	if(cycles > st->max) {
+		st->max = cycles;
+	}
+	st->total += cycles;
+	st->runs++;
+
+	// bucket from the position of the highest set bit
+	int bucket = (cycles == 0)?0:31 - __builtin_clz(cycles) - PROBE_BUCKET_SHIFT;
+	if(bucket < 0) {
+		bucket = 0;
+	}
+	else if(bucket >= PROBE_BUCKETS) {
+		bucket = PROBE_BUCKETS-1;
+	}
+	st->hist[bucket]++;
+}
+
+// get the stats of probe id
+const PROBE_STATS * probeGetStats(PROBE_ID id) {
+	return &probe_stats[id];
+}
+
+// clear the stats of probe id
+void probeReset(PROBE_ID id) {
+
+	__disable_irq(); // the speed loop probe is updated from the tick ISR
+	memset(&probe_stats[id],0,sizeof(probe_stats[id]));
+	probe_stats[id].min = UINT32_MAX;
+	__enable_irq();
+}
+
+const char * probeName(PROBE_ID id) {
+	return (id < NUM_PROBES)?probe_names[id]:"?";
+}
+
+// convert cycles to us at the core clock
+float probeCyclesToUs(float cycles) {
+	return cycles*(1.0e6f/(float)SystemCoreClock);
+}
+
+// little endian field access
+static uint8_t * putU32(uint8_t * p, uint32_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+	return p+4;
+}
+
+static uint32_t getU32(const uint8_t * p) {
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// pack the stats of probe id into buf, returns packet length
+int probeEncode(PROBE_ID id, uint8_t * buf) {
+
+	PROBE_STATS st;
+
+	__disable_irq(); // take a consistent copy (the speed loop probe is updated from the tick ISR)
+	st = probe_stats[id];
+	__enable_irq();
+
+	uint8_t * p = buf;
+
+	*p++ = PROBE_TYPE_STATS;
+	*p++ = (uint8_t)id;
+	p = putU32(p,st.runs);
+	p = putU32(p,(st.runs > 0)?st.min:0);
+	p = putU32(p,st.max);
+	p = putU32(p,(st.runs > 0)?(uint32_t)(st.total/st.runs):0);
+	for(int n=0; n < PROBE_BUCKETS; n++) {
+		p = putU32(p,st.hist[n]);
+	}
+
+	return (int)(p-buf);
+}
+
+// unpack a probe packet, returns false if it is not a valid probe packet
+bool probeDecode(const uint8_t * buf, int len, PROBE_ID * id, PROBE_STATS * stats) {
+
+	if(len != PROBE_PACKET_SIZE || buf[0] != PROBE_TYPE_STATS || buf[1] >= NUM_PROBES) {
+		return false;
+	}
+
+	*id = (PROBE_ID)buf[1];
+	stats->runs = getU32(buf+2);
+	stats->min = getU32(buf+6);
+	stats->max = getU32(buf+10);
+	stats->total = (uint64_t)getU32(buf+14)*stats->runs;
+
+	const uint8_t * p = buf+18;
+	for(int n=0; n < PROBE_BUCKETS; n++) {
+		stats->hist[n] = getU32(p);
+		p += 4;
+	}
+
+	return true;
+}
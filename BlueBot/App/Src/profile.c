@@ -0,0 +1,120 @@
+/*
+ * profile.c
+ *
+ *  Acceleration and jerk limited motion profiles
+ */
+
+#include <math.h>
+#include "profile.h"
+
+static void planRamp(PROFILE * p, float vel, float max_acc, float max_jerk);
+static void rampEval(const PROFILE * p, float t, float * pos, float * vel);
+
+
+// plan a move of dist within the limits
+void profilePlan(PROFILE * p, float dist, float max_vel, float max_acc, float max_jerk) {
+
+	float d = fabsf(dist);
+
+	p->dist = d;
+	planRamp(p,max_vel,max_acc,max_jerk);
+
+	// the ramps up and down take vel*t_acc, too far to reach max_vel so find the peak velocity that
+	// just covers the distance with no cruise (d = vel*t_acc)
+	if(p->vel*p->t_acc > d) {
+		float vel;
+		if(max_jerk > 0.0f) {
+			vel = 0.5f*max_acc*(sqrtf(max_acc*max_acc/(max_jerk*max_jerk) + 4.0f*d/max_acc) - max_acc/max_jerk);
+			if(vel < max_acc*max_acc/max_jerk) { // max_acc is not reached either, d = 2*vel*sqrt(vel/jerk)
+				vel = powf(0.5f*d*sqrtf(max_jerk),2.0f/3.0f);
+			}
+		}
+		else {
+			vel = sqrtf(max_acc*d);
+		}
+		planRamp(p,vel,max_acc,max_jerk);
+	}
+
+	float t_cruise = (p->vel > 0.0f)?(d - p->vel*p->t_acc)/p->vel:0.0f;
+	if(t_cruise < 0.0f) { // rounding
+		t_cruise = 0.0f;
+	}
+	p->t_end = 2.0f*p->t_acc + t_cruise;
+}
+
+// get the position and velocity t seconds into the move
+// the ramp down is the ramp up backwards in time from the end
+bool profileEval(const PROFILE * p, float t, float * pos, float * vel) {
+
+	if(t <= 0.0f) {
+		*pos = 0.0f;
+		*vel = 0.0f;
+	}
+	else if(t >= p->t_end) {
+		*pos = p->dist;
+		*vel = 0.0f;
+		return true;
+	}
+	else if(t < p->t_acc) { // ramp up
+		rampEval(p,t,pos,vel);
+	}
+	else if(t <= p->t_end - p->t_acc) { // cruise
+		*pos = 0.5f*p->vel*p->t_acc + p->vel*(t - p->t_acc);
+		*vel = p->vel;
+	}
+	else { // ramp down
+		float s;
+		rampEval(p,p->t_end - t,&s,vel);
+		*pos = p->dist - s;
+	}
+
+	return false;
+}
+
+// plan the ramp from rest up to vel
+static void planRamp(PROFILE * p, float vel, float max_acc, float max_jerk) {
+
+	p->vel = vel;
+	p->jerk = max_jerk;
+
+	if(max_jerk <= 0.0f) { // trapezoidal
+		p->acc = max_acc;
+		p->tj = 0.0f;
+	}
+	else if(vel < max_acc*max_acc/max_jerk) { // vel is reached before the acceleration reaches max_acc
+		p->acc = sqrtf(vel*max_jerk);
+		p->tj = p->acc/max_jerk;
+	}
+	else {
+		p->acc = max_acc;
+		p->tj = max_acc/max_jerk;
+	}
+
+	p->ta = (p->acc > 0.0f)?vel/p->acc - p->tj:0.0f;
+	if(p->ta < 0.0f) { // rounding
+		p->ta = 0.0f;
+	}
+	p->t_acc = 2.0f*p->tj + p->ta;
+}
+
+// position and velocity t seconds into the ramp up (0 <= t <= t_acc)
+// the ramp is symmetric about its mid point, so it covers vel*t_acc/2
+static void rampEval(const PROFILE * p, float t, float * pos, float * vel) {
+
+	if(t < p->tj) { // jerk up
+		*vel = 0.5f*p->jerk*t*t;
+		*pos = p->jerk*t*t*t/6.0f;
+	}
+	else if(t < p->tj + p->ta) { // constant acceleration
+		float v1 = 0.5f*p->jerk*p->tj*p->tj;
+		float s1 = p->jerk*p->tj*p->tj*p->tj/6.0f;
+		float dt = t - p->tj;
+		*vel = v1 + p->acc*dt;
+		*pos = s1 + v1*dt + 0.5f*p->acc*dt*dt;
+	}
+	else { // jerk down, mirror of the jerk up from the end of the ramp
+		float dt = p->t_acc - t;
+		*vel = p->vel - 0.5f*p->jerk*dt*dt;
+		*pos = 0.5f*p->vel*p->t_acc - (p->vel*dt - p->jerk*dt*dt*dt/6.0f);
+	}
+}
@@ -0,0 +1,177 @@
+/*
+ * scheduler.c
+ *
+ *  Fixed rate task scheduler for the main loop
+ *
+ *  TIM17 is set up (in CubeMX) to interrupt every 1ms. Each interrupt counts down the
+ *  period of every rate group and releases the group when it reaches zero. The main loop
+ *  polls schedDue() and runs the group. If a group is released again before the main loop
+ *  has run it the release is counted as an overrun.
+ */
+
+#include <limits.h>
+
+#include "tim.h"
+#include "scheduler.h"
+#include "ccmram.h"
+
+// period of each rate group in scheduler ticks (ms), indexed by SCHED_GROUP
+static const uint32_t sched_period[NUM_SCHED_GROUPS] = {
+	20,  // SG_MOTION    - 50Hz
+	10,  // SG_DEBOUNCE  - 100Hz (gives 30ms deglitch with the 2 bit debounce filter)
+	20,  // SG_TELEMETRY - 50Hz
+	500  // SG_LED       - toggle every 1/2 second
+};
+
+// run time state of each rate group
+typedef struct SCHED_GROUP_STATE_t {
+	uint32_t countdown;           // ticks until next release (only used by the ISR)
+	volatile bool pending;        // set by ISR when group is released, cleared when group runs
+	volatile uint32_t release_us; // time of last release
+	uint32_t last_run_us;         // time group last ran
+	uint32_t dt_us;               // measured time between last two runs
+	SCHED_STATS stats;            // timing statistics
+} SCHED_GROUP_STATE;
+
+static CCMRAM_DATA SCHED_GROUP_STATE groups[NUM_SCHED_GROUPS];
+
+static CCMRAM_DATA volatile uint32_t sched_ticks=0; // count of scheduler ticks since start
+
+
+// start the scheduler
+void schedInit(void) {
+
+	sched_ticks=0;
+
+	for(int g=0; g < NUM_SCHED_GROUPS; g++) {
+		groups[g].countdown = sched_period[g];
+		groups[g].pending = false;
+		groups[g].release_us = 0;
+		groups[g].last_run_us = 0;
+		groups[g].dt_us = sched_period[g]*SCHED_TICK_US;
+	}
+
+	schedResetStats();
+
+	HAL_TIM_Base_Start_IT(&SCHED_TIM); // start the tick interrupt
+}
+
+// update the scheduler - called every SCHED_TICK_US from the timer ISR
+CCMRAM_CODE void schedTick(void) {
+
+	uint32_t ticks = ++sched_ticks;
+
+	for(int g=0; g < NUM_SCHED_GROUPS; g++) {
+
+		SCHED_GROUP_STATE * grp = &groups[g];
+
+		if(--grp->countdown == 0) {
+			grp->countdown = sched_period[g];
+
+			if(grp->pending) { // main loop did not get to this group in time
+				grp->stats.overruns++;
+			}
+			else {
+				grp->release_us = ticks*SCHED_TICK_US;
+				grp->pending = true;
+			}
+		}
+	}
+}
+
+// see if a rate group has been released
+// returns true once for each release, and records the timing for the run
+bool schedDue(SCHED_GROUP group) {
+
+	SCHED_GROUP_STATE * grp = &groups[group];
+
+	if(!grp->pending) {
+		return false;
+	}
+
+	uint32_t now = schedMicros();
+	SCHED_STATS * stats = &grp->stats;
+
+	uint32_t latency = now - grp->release_us; // delay from release to run
+	if(latency > stats->latency_max_us) {
+		stats->latency_max_us = latency;
+	}
+
+	if(stats->runs > 0) { // need two runs to measure a period
+		uint32_t period = now - grp->last_run_us;
+		int32_t jitter = (int32_t)period - (int32_t)(sched_period[group]*SCHED_TICK_US);
+
+		grp->dt_us = period;
+		stats->period_us = period;
+
+		if(jitter < stats->jitter_min_us) {
+			stats->jitter_min_us = jitter;
+		}
+		if(jitter > stats->jitter_max_us) {
+			stats->jitter_max_us = jitter;
+		}
+	}
+
+	grp->last_run_us = now;
+	stats->runs++;
+
+	grp->pending = false;
+
+	return true;
+}
+
+// measured time between the last two runs of a group in seconds
+// limited to twice the nominal period so a stalled loop does not cause a large step in the controllers
+float schedDT(SCHED_GROUP group) {
+
+	uint32_t dt = groups[group].dt_us;
+	uint32_t max_dt = 2*sched_period[group]*SCHED_TICK_US;
+
+	if(dt > max_dt) {
+		dt = max_dt;
+	}
+
+	return (float)dt*1.0e-6f;
+}
+
+// get current time since scheduler start in us
+// combines the tick count with the timer counter (which counts us between ticks)
+// callable from ISRs that pre-empt the tick and with interrupts masked: if the counter has wrapped but the tick ISR
+// has not run yet (update flag still set) the tick it has not counted is added
+CCMRAM_CODE uint32_t schedMicros(void) {
+
+	uint32_t ticks;
+	uint32_t us;
+	uint32_t pending;
+
+	do { // re-read if the tick interrupt happened while reading the timer
+		ticks = sched_ticks;
+		us = __HAL_TIM_GET_COUNTER(&SCHED_TIM);
+		pending = 0;
+		if(__HAL_TIM_GET_FLAG(&SCHED_TIM,TIM_FLAG_UPDATE)) { // wrapped, read the counter again in case it was read before the wrap
+			us = __HAL_TIM_GET_COUNTER(&SCHED_TIM);
+			pending = 1;
+		}
+	} while(ticks != sched_ticks);
+
+	return (ticks + pending)*SCHED_TICK_US + us;
+}
+
+// get timing statistics for a group
+const SCHED_STATS * schedGetStats(SCHED_GROUP group) {
+	return &groups[group].stats;
+}
+
+// clear the timing statistics
+void schedResetStats(void) {
+
+	for(int g=0; g < NUM_SCHED_GROUPS; g++) {
+		SCHED_STATS * stats = &groups[g].stats;
+		stats->runs = 0;
+		stats->overruns = 0;
+		stats->period_us = 0;
+		stats->jitter_min_us = INT32_MAX;
+		stats->jitter_max_us = INT32_MIN;
+		stats->latency_max_us = 0;
+	}
+}
@@ -0,0 +1,226 @@
+/*
+ * telemetry.c
+ *
+ *  Pack and unpack the robot status (telemetry) frame
+ *
+ *  See telemetry.h for the frame layout. The decoder is not used by the robot, it is here so the
+ *  host tools (and the host build) use the same definition of the layout as the encoder.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "telemetry.h"
+
+// scale factors for the fixed point fields
+#define POS_SCALE 1.0e6f // m -> um
+#define IR_SCALE  10.0f  // cm -> 0.1cm
+#define POS_MAX   2.0e9f // limit of encoder position field (um), +/-2000m
+
+// little endian field access
+static uint8_t * putU16(uint8_t * p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	return p+2;
+}
+
+static uint8_t * putU32(uint8_t * p, uint32_t v) {
+	p = putU16(p,(uint16_t)v);
+	return putU16(p,(uint16_t)(v >> 16));
+}
+
+static uint16_t getU16(const uint8_t * p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t * p) {
+	return getU16(p) | ((uint32_t)getU16(p+2) << 16);
+}
+
+// round to nearest and limit to the range of the field
+static int32_t toFixed(float v, float scale, float min, float max) {
+
+	v *= scale;
+	if(!(v >= min)) { // also catches NaN
+		v = min;
+	}
+	if(v > max) {
+		v = max;
+	}
+	return (int32_t)lrintf(v);
+}
+
+static int16_t satI16(int32_t v) {
+	if(v > INT16_MAX) {
+		return INT16_MAX;
+	}
+	if(v < INT16_MIN) {
+		return INT16_MIN;
+	}
+	return (int16_t)v;
+}
+
+static uint8_t * putPID(uint8_t * p, const PID_STATE * pid) {
+	p = putU16(p,floatToHalf(pid->ref));
+	p = putU16(p,floatToHalf(pid->fb));
+	p = putU16(p,floatToHalf(pid->u));
+	return putU16(p,floatToHalf(pid->I));
+}
+
+static const uint8_t * getPID(const uint8_t * p, PID_STATE * pid) {
+	pid->ref = halfToFloat(getU16(p));
+	pid->fb  = halfToFloat(getU16(p+2));
+	pid->u   = halfToFloat(getU16(p+4));
+	pid->I   = halfToFloat(getU16(p+6));
+	pid->error = pid->ref - pid->fb;
+	return p+8;
+}
+
+static uint8_t * putEncoder(uint8_t * p, const ENCODER_STATE * enc) {
+	p = putU32(p,(uint32_t)toFixed(enc->pos,POS_SCALE,-POS_MAX,POS_MAX));
+	return putU16(p,floatToHalf(enc->vel));
+}
+
+static const uint8_t * getEncoder(const uint8_t * p, ENCODER_STATE * enc) {
+	enc->pos = (float)(int32_t)getU32(p)/POS_SCALE;
+	enc->vel = halfToFloat(getU16(p+4));
+	return p+6;
+}
+
+static uint8_t * putIR(uint8_t * p, float range) {
+	if(isnan(range)) {
+		return putU16(p,TLM_IR_NONE);
+	}
+	return putU16(p,(uint16_t)toFixed(range,IR_SCALE,0.0f,(float)(TLM_IR_NONE-1)));
+}
+
+static float getIR(const uint8_t * p) {
+	uint16_t v = getU16(p);
+	return (v == TLM_IR_NONE)?NAN:(float)v/IR_SCALE;
+}
+
+// pack tlm into buf, returns frame length
+int tlmEncode(const TELEMETRY * tlm, uint16_t seq, uint32_t ticks, uint8_t * buf) {
+
+	uint8_t * p = buf;
+
+	*p++ = TLM_TYPE_STATUS;
+	*p++ = TLM_VERSION;
+	p = putU16(p,seq);
+	p = putU32(p,ticks);
+
+	p = putPID(p,&tlm->pid_left);
+	p = putPID(p,&tlm->pid_right);
+
+	p = putEncoder(p,&tlm->enc_left);
+	p = putEncoder(p,&tlm->enc_right);
+
+	p = putIR(p,tlm->ir_range_short);
+	p = putIR(p,tlm->ir_range_long);
+
+	*p++ = (uint8_t)tlm->clifs;
+
+	p = putU16(p,(tlm->pid_overruns > UINT16_MAX)?UINT16_MAX:(uint16_t)tlm->pid_overruns);
+	p = putU16(p,(uint16_t)satI16(tlm->pid_jitter_min));
+	p = putU16(p,(uint16_t)satI16(tlm->pid_jitter_max));
+
+	return (int)(p-buf);
+}
+
+// unpack a frame, returns false if it is not a status frame of this version
+bool tlmDecode(const uint8_t * buf, int len, TLM_HEADER * hdr, TELEMETRY * tlm) {
+
+	if(len != TLM_FRAME_SIZE || buf[0] != TLM_TYPE_STATUS || buf[1] != TLM_VERSION) {
+		return false;
+	}
+
+	hdr->type = buf[0];
+	hdr->version = buf[1];
+	hdr->seq = getU16(buf+2);
+	hdr->ticks = getU32(buf+4);
+
+	const uint8_t * p = buf + TLM_HEADER_SIZE;
+
+	memset(tlm,0,sizeof(*tlm));
+
+	p = getPID(p,&tlm->pid_left);
+	p = getPID(p,&tlm->pid_right);
+
+	p = getEncoder(p,&tlm->enc_left);
+	p = getEncoder(p,&tlm->enc_right);
+
+	tlm->ir_range_short = getIR(p);
+	tlm->ir_range_long = getIR(p+2);
+	p += 4;
+
+	tlm->clifs = *p++;
+
+	tlm->pid_overruns = getU16(p);
+	tlm->pid_jitter_min = (int16_t)getU16(p+2);
+	tlm->pid_jitter_max = (int16_t)getU16(p+4);
+
+	return true;
+}
+
+// convert float to IEEE half precision (round to nearest, overflows to infinity)
+uint16_t floatToHalf(float f) {
+
+	uint32_t x;
+	memcpy(&x,&f,sizeof(x));
+
+	uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+	int32_t exp = (int32_t)((x >> 23) & 0xFF) - 127 + 15;
+	uint32_t mant = x & 0x7FFFFF;
+
+	if((x & 0x7FFFFFFF) > 0x7F800000) { // NaN
+		return sign | 0x7E00;
+	}
+
+	if(exp >= 31) { // too big (or infinity)
+		return sign | 0x7C00;
+	}
+
+	if(exp <= 0) { // half subnormal (or too small, becomes 0)
+		if(exp < -10) {
+			return sign;
+		}
+		mant |= 0x800000; // add the implied leading 1
+		int shift = 14 - exp;
+		uint16_t h = (uint16_t)(mant >> shift);
+		if((mant >> (shift-1)) & 1) { // round
+			h++;
+		}
+		return sign | h;
+	}
+
+	uint16_t h = (uint16_t)((exp << 10) | (mant >> 13));
+	if(mant & 0x1000) { // round, a carry into the exponent gives the correct result
+		h++;
+	}
+	return sign | h;
+}
+
+// convert IEEE half precision to float
+float halfToFloat(uint16_t h) {
+
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1F;
+	uint32_t mant = h & 0x3FF;
+	uint32_t x;
+
+	if(exp == 0) { // zero or subnormal
+		float f = (float)mant * 5.9604645e-8f; // 2^-24
+		return sign?-f:f;
+	}
+
+	if(exp == 31) { // infinity or NaN
+		x = sign | 0x7F800000 | (mant << 13);
+	}
+	else {
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	}
+
+	float f;
+	memcpy(&f,&x,sizeof(f));
+	return f;
+}
@@ -10,177 +10,443 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "gripper.h"
 #include "ui.h"
 #include "motors.h"
+#include "path.h"
 #include "coms.h"
+#include "telemetry.h"
+#include "probe.h"
 #include <stdlib.h>
 #include "main.h"
 
 #define MAX_RAND_SPEED 0.5f // Max speed for random step command generation (for PID Tuning)
 
-// Data structure for sending robot state (telemetry) over the coms/wireless link to a host PC
-typedef struct telemetry_t {
+static TELEMETRY telemetry; // Variable to hold the current telementry status
+static uint16_t telemetry_seq=0; // sequence number of the next telemetry frame
 
-  /// PID State
-  PID_STATE pid_left;
-  PID_STATE pid_right;
 
-  // Encoder Status
-  ENCODER_STATE enc_left;
-  ENCODER_STATE enc_right;
+static float randf(float max); // generate random float (0.0-max)
 
-  // IR ranges
-  float ir_range_short;
-  float ir_range_long;
 
-  uint32_t clifs; // Bump sensor states
+#define UI_ARGS_ANY (-1) // command ignores any parameter bytes (single key commands)
 
-} TELEMETRY;
+#define STREAM_TIMEOUT_MIN_MS 20   // limits of the stream watchdog timeout (one PID period to 5s)
+#define STREAM_TIMEOUT_MAX_MS 5000
 
-static TELEMETRY telemetry; // Variable to hold the current telementry status
+// command handler, args points to the parameters after the opcode
+typedef UI_STATUS (*UI_HANDLER)(const uint8_t * args, MotorEvent * event);
 
+// entry in the command dispatch table
+typedef struct UI_COMMAND_t {
+	int8_t args_len;    // size of the parameters (or UI_ARGS_ANY)
+	UI_HANDLER handler; // NULL if opcode is not used
+} UI_COMMAND;
 
-static float randf(float max); // generate random float (0.0-max)
+// get little endian parameters
+static float getFloat(const uint8_t * p) {
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	float f;
+	memcpy(&f,&v,sizeof(f));
+	return f;
+}
 
+static uint16_t getU16(const uint8_t * p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
 
-#define SPEED_CHANGE 0.1f // input speed step for manual wheel speed commands
+// check a parameter is a number in the range min-max
+static bool inRange(float v, float min, float max) {
+	return v >= min && v <= max; // false for NaN
+}
 
 
-// called from main loop to process UI commands
-//
-// packet :  pointer to input command received from UART (only first char used for now)
-// len    :  length of input packet
-// event  : pointer to MotorEvent to return to be sent to the Controller State Machine
-void doUI(uint8_t * packet, int len, MotorEvent *event) {
+// single key commands
+
+static UI_STATUS cmdStop(const uint8_t * args, MotorEvent * event) { // stop both motors
+	STOP();
+	*event |= ME_STOP;
+	return UI_ACK;
+}
+
+static UI_STATUS cmdStepFwd(const uint8_t * args, MotorEvent * event) { // generate step command for PID tuning (open loop) (step  wheels to random power)
+	float v = randf(MAX_RAND_SPEED);
+	setMotorSpeed(v,v);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdStepRev(const uint8_t * args, MotorEvent * event) { // generate reverse step command for PID tuning (open loop) (step wheels to random -power)
+	float v = randf(MAX_RAND_SPEED);
+	setMotorSpeed(-v,-v);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdStepTurn(const uint8_t * args, MotorEvent * event) { // generate turning step command for PID tuning (open loop) (step  wheels to random power)
+	float v = randf(MAX_RAND_SPEED);
+	setMotorSpeed(-v,v);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdStepTurnRev(const uint8_t * args, MotorEvent * event) { // generate reverse turning step command for PID tuning (open loop) (step  wheels to random power)
+	float v = randf(MAX_RAND_SPEED);
+	setMotorSpeed(v,-v);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdClosedLoop(const uint8_t * args, MotorEvent * event) { // put PID in closed loop mode
+	setOpenLoop(&pid_left,false);
+	setOpenLoop(&pid_right,false);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdOpenLoop(const uint8_t * args, MotorEvent * event) { // put PID in open loop mode (bypass PID)
+	setOpenLoop(&pid_left,true);
+	setOpenLoop(&pid_right,true);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdForward(const uint8_t * args, MotorEvent * event) { // drive both wheels forward at 1/2 max speed
+	drive(MAX_LIN_VEL/2.0f,0.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdBackward(const uint8_t * args, MotorEvent * event) { // drive both wheels backward at 1/2 max speed
+	drive(-MAX_LIN_VEL/2.0f,0.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdRight(const uint8_t * args, MotorEvent * event) { // turn (rotate) right at 1/4 max speed
+	drive(0.0f,-MAX_ANG_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdLeft(const uint8_t * args, MotorEvent * event) { // turn (rotate) left at 1/4 max speed
+	drive(0.0f,MAX_ANG_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdTurnLeft45(const uint8_t * args, MotorEvent * event) { // turn to (rotate 45 Deg) left at 1/4 max speed
+	turnTo(M_PI/4.0f,MAX_ANG_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdTurnRight45(const uint8_t * args, MotorEvent * event) { // turn to (rotate 45 Deg) right at 1/4 max speed
+	turnTo(-M_PI/4.0f,MAX_ANG_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdForward300(const uint8_t * args, MotorEvent * event) { // Drive forwards 300mm @ 1/4 max speed
+	driveTo(0.3f,MAX_LIN_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdBackward300(const uint8_t * args, MotorEvent * event) { // Drive backwards 300mm @ 1/4 max speed
+	driveTo(-0.3f,MAX_LIN_VEL/4.0f);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdGripperUp(const uint8_t * args, MotorEvent * event) { // move gripper up
+	setGripper(GRIPPER_UP);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdGripperDown(const uint8_t * args, MotorEvent * event) { // move gripper down
+	setGripper(GRIPPER_DOWN);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdLevel1(const uint8_t * args, MotorEvent * event) { // return event to start controller in table top challenge level 1 mode
+	*event |= CE_M1;
+	return UI_ACK;
+}
+
+static UI_STATUS cmdLevel2(const uint8_t * args, MotorEvent * event) { // return event to start controller in table top challenge level 2 mode
+	*event |= CE_M2;
+	return UI_ACK;
+}
+
+static UI_STATUS cmdLevel3(const uint8_t * args, MotorEvent * event) { // return event to start controller in table top challenge level 3 mode
+	*event |= CE_M3;
+	return UI_ACK;
+}
+
+
+// commands with parameters
+
+static UI_STATUS cmdDrive(const uint8_t * args, MotorEvent * event) {
+
+	float lin_vel = getFloat(args);
+	float ang_vel = getFloat(args+4);
+
+	if(!inRange(lin_vel,-MAX_LIN_VEL,MAX_LIN_VEL) || !inRange(ang_vel,-MAX_ANG_VEL,MAX_ANG_VEL)) {
+		return UI_NACK_RANGE;
+	}
+
+	streamVelocity(lin_vel,ang_vel); // applied at the next motion update
+	return UI_ACK;
+}
 
+static UI_STATUS cmdDriveTo(const uint8_t * args, MotorEvent * event) {
 
-	uint8_t c=packet[0]; // just use first character in input packet as the command
-
-#if 0
-		// debug commands to manually control wheel speed
-		if(c=='+') { // accelerate left wheel
-		  if(speed_l < MAX_SPEED) {
-			 speed_l+=SPEED_CHANGE;
-		  }
-		}
-
-		if(c=='-') { // decelerate left wheel
-		  if(speed_l > -MAX_SPEED) {
-			 speed_l-=SPEED_CHANGE;
-		  }
-		}
-
-		if(c=='>') { // accelerate right wheel
-		  if(speed_r < MAX_SPEED) {
-			 speed_r+=SPEED_CHANGE;
-		  }
-		}
+	float dist = getFloat(args);
+	float lin_vel = getFloat(args+4);
 
-		if(c=='<') { // decelerate right wheel
-		  if(speed_r > -MAX_SPEED) {
-			 speed_r-=SPEED_CHANGE;
-		  }
-		}
-#endif
-		if(c==' ') { // stop both motors
-			STOP();
-			*event |= ME_STOP;
-		}
+	if(!isfinite(dist) || !inRange(lin_vel,0.0f,MAX_LIN_VEL) || lin_vel == 0.0f) {
+		return UI_NACK_RANGE;
+	}
 
-		if(c=='t') { // generate step command for PID tuning (open loop) (step  wheels to random power)
-			float v = randf(MAX_RAND_SPEED);
-			setMotorSpeed(v,v);
-		}
+	driveTo(dist,lin_vel);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdTurnTo(const uint8_t * args, MotorEvent * event) {
+
+	float angle = getFloat(args);
+	float ang_vel = getFloat(args+4);
+
+	if(!isfinite(angle) || !inRange(ang_vel,0.0f,MAX_ANG_VEL) || ang_vel == 0.0f) {
+		return UI_NACK_RANGE;
+	}
+
+	turnTo(angle,ang_vel);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdGripper(const uint8_t * args, MotorEvent * event) {
+
+	uint16_t pos = getU16(args);
+
+	if(pos < GRIPPER_UP || pos > GRIPPER_DOWN) {
+		return UI_NACK_RANGE;
+	}
+
+	setGripper(pos);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdPIDGains(const uint8_t * args, MotorEvent * event) {
+
+	float kp = getFloat(args);
+	float ki = getFloat(args+4);
+
+	if(!isfinite(kp) || !isfinite(ki) || kp < 0.0f || ki < 0.0f) {
+		return UI_NACK_RANGE;
+	}
+
+	pid_left.kp = pid_right.kp = kp;
+	pid_left.ki = pid_right.ki = ki;
+	return UI_ACK;
+}
+
+static UI_STATUS cmdPIDFeedForward(const uint8_t * args, MotorEvent * event) {
 
-		if(c=='T') { // generate reverse step command for PID tuning (open loop) (step wheels to random -power)
-			float v = randf(MAX_RAND_SPEED);
-			setMotorSpeed(-v,-v);
+	float kf = getFloat(args);
+	float deadband = getFloat(args+4);
+	float slew = getFloat(args+8);
 
-		}
+	if(!isfinite(kf) || !isfinite(deadband) || !isfinite(slew) || kf < 0.0f || deadband < 0.0f || deadband > 1.0f || slew < 0.0f) {
+		return UI_NACK_RANGE;
+	}
+
+	pid_left.kf = pid_right.kf = kf;
+	pid_left.deadband = pid_right.deadband = deadband;
+	pid_left.slew = pid_right.slew = slew;
+	return UI_ACK;
+}
 
-		if(c=='p') { // generate turning step command for PID tuning (open loop) (step  wheels to random power)
-			float v = randf(MAX_RAND_SPEED);
-			setMotorSpeed(-v,v);
-		}
+static UI_STATUS cmdSetOpenLoop(const uint8_t * args, MotorEvent * event) {
 
-		if(c=='P') { // generate reverse turning step command for PID tuning (open loop) (step  wheels to random power)
-			float v = randf(MAX_RAND_SPEED);
-			setMotorSpeed(v,-v);
-		}
+	if(args[0] > 1) {
+		return UI_NACK_RANGE;
+	}
 
-		if(c=='o') { // put PID in closed loop mode
-			setOpenLoop(&pid_left,false);
-			setOpenLoop(&pid_right,false);
-			//printf("Motors In Closed Loop Mode\n");
-		}
+	setOpenLoop(&pid_left,args[0]);
+	setOpenLoop(&pid_right,args[0]);
+	return UI_ACK;
+}
 
-		if(c=='O') { // put PID in open loop mode (bypass PID)
-			setOpenLoop(&pid_left,true);
-			setOpenLoop(&pid_right,true);
-			//printf("Motors In Open Loop Mode\n");
-		}
 
-		if(c=='w') { // drive both wheels forward at 1/2 max speed
-			drive(MAX_LIN_VEL/2.0f,0.0f);
-		}
+static UI_STATUS cmdStreamTimeout(const uint8_t * args, MotorEvent * event) {
 
-		if(c=='z') {  // drive both wheels backward at 1/2 max speed
-			drive(-MAX_LIN_VEL/2.0f,0.0f);
-		}
+	uint16_t ms = getU16(args);
 
-		if(c=='s') {  //  turn (rotate) right at 1/4 max speed
-			drive(0.0f,-MAX_ANG_VEL/4.0f);
+	if(ms < STREAM_TIMEOUT_MIN_MS || ms > STREAM_TIMEOUT_MAX_MS) {
+		return UI_NACK_RANGE;
+	}
 
-		}
-		if(c=='a') {  //  turn (rotate) left at 1/4 max speed
-			drive(0.0f,MAX_ANG_VEL/4.0f);
-		}
+	setStreamTimeout(ms);
+	return UI_ACK;
+}
 
-		if(c=='l') {  //  turn to (rotate 45 Deg) left at 1/4 max speed
-			turnTo(M_PI/4.0f,MAX_ANG_VEL/4.0f);
-		}
+static UI_STATUS cmdSetPose(const uint8_t * args, MotorEvent * event) {
 
-		if(c=='r') {  //  turn to (rotate 45 Deg) right at 1/4 max speed
-			turnTo(-M_PI/4.0f,MAX_ANG_VEL/4.0f);
-		}
+	float x = getFloat(args);
+	float y = getFloat(args+4);
+	float heading = getFloat(args+8);
 
-		if(c=='f') {  //  Drive forwards 300mm @ 1/4 max speed
-			driveTo(0.3f,MAX_LIN_VEL/4.0f);
-		}
+	if(!isfinite(x) || !isfinite(y) || !isfinite(heading)) {
+		return UI_NACK_RANGE;
+	}
 
-		if(c=='b') {  //  Drive backwards 300mm @ 1/4 max speed
-			driveTo(-0.3f,MAX_LIN_VEL/4.0f);
-		}
+	setPose(x,y,heading);
+	return UI_ACK;
+}
 
-		if(c=='G') {  //  move gripper up
-			setGripper(GRIPPER_UP);
-		}
+static UI_STATUS cmdMoveLimits(const uint8_t * args, MotorEvent * event) {
 
-		if(c=='g') {  // move gripper down
-			setGripper(GRIPPER_DOWN);
-		}
+	float lin_acc = getFloat(args);
+	float lin_jerk = getFloat(args+4);
+	float ang_acc = getFloat(args+8);
+	float ang_jerk = getFloat(args+12);
 
-		if(c=='1') { // return event to start controller in table top challenge level 1 mode
-			*event |= CE_M1;
-		}
+	if(!isfinite(lin_acc) || !isfinite(lin_jerk) || !isfinite(ang_acc) || !isfinite(ang_jerk) ||
+			lin_acc <= 0.0f || lin_jerk < 0.0f || ang_acc <= 0.0f || ang_jerk < 0.0f) {
+		return UI_NACK_RANGE;
+	}
 
-		if(c=='2') { // return event to start controller in table top challenge level 2 mode
-			*event |= CE_M2;
-		}
+	setMoveLimits(lin_acc,lin_jerk,ang_acc,ang_jerk);
+	return UI_ACK;
+}
 
-		if(c=='3') { // return event to start controller in table top challenge level 3 mode
-			*event |= CE_M3;
-		}
+static UI_STATUS cmdHeadingHold(const uint8_t * args, MotorEvent * event) {
 
+	float kh = getFloat(args);
+	float ky = getFloat(args+4);
 
+	if(!isfinite(kh) || !isfinite(ky) || kh < 0.0f || ky < 0.0f) {
+		return UI_NACK_RANGE;
+	}
 
+	setHeadingHold(kh,ky);
+	return UI_ACK;
 }
 
+static UI_STATUS cmdWaypoint(const uint8_t * args, MotorEvent * event) {
+
+	float x = getFloat(args);
+	float y = getFloat(args+4);
+
+	if(!isfinite(x) || !isfinite(y) || !pathAdd(x,y)) {
+		return UI_NACK_RANGE;
+	}
+
+	return UI_ACK;
+}
+
+static UI_STATUS cmdFollowPath(const uint8_t * args, MotorEvent * event) {
+
+	float lin_vel = getFloat(args);
+	float lookahead = getFloat(args+4);
+
+	if(!inRange(lin_vel,0.0f,MAX_LIN_VEL) || lin_vel == 0.0f || !isfinite(lookahead) || lookahead <= 0.0f) {
+		return UI_NACK_RANGE;
+	}
 
-// send the current telemetry info out the UART (data encoded in a slip packet)
+	followPath(lin_vel,lookahead);
+	return UI_ACK;
+}
+
+static UI_STATUS cmdClearPath(const uint8_t * args, MotorEvent * event) {
+	pathClear();
+	return UI_ACK;
+}
+
+static UI_STATUS cmdProbe(const uint8_t * args, MotorEvent * event) {
+
+	if(args[0] >= NUM_PROBES || args[1] > 1) {
+		return UI_NACK_RANGE;
+	}
+
+	uint8_t packet[PROBE_PACKET_SIZE];
+	int len = probeEncode(args[0],packet);
+	slipEncode(packet,len,false);
+
+	if(args[1]) {
+		probeReset(args[0]);
+	}
+	return UI_ACK;
+}
+
+
+// command dispatch table, indexed by opcode
+static const UI_COMMAND ui_commands[UI_NUM_OPCODES] = {
+
+	[' '] = { UI_ARGS_ANY, cmdStop },
+	['t'] = { UI_ARGS_ANY, cmdStepFwd },
+	['T'] = { UI_ARGS_ANY, cmdStepRev },
+	['p'] = { UI_ARGS_ANY, cmdStepTurn },
+	['P'] = { UI_ARGS_ANY, cmdStepTurnRev },
+	['o'] = { UI_ARGS_ANY, cmdClosedLoop },
+	['O'] = { UI_ARGS_ANY, cmdOpenLoop },
+	['w'] = { UI_ARGS_ANY, cmdForward },
+	['z'] = { UI_ARGS_ANY, cmdBackward },
+	['s'] = { UI_ARGS_ANY, cmdRight },
+	['a'] = { UI_ARGS_ANY, cmdLeft },
+	['l'] = { UI_ARGS_ANY, cmdTurnLeft45 },
+	['r'] = { UI_ARGS_ANY, cmdTurnRight45 },
+	['f'] = { UI_ARGS_ANY, cmdForward300 },
+	['b'] = { UI_ARGS_ANY, cmdBackward300 },
+	['G'] = { UI_ARGS_ANY, cmdGripperUp },
+	['g'] = { UI_ARGS_ANY, cmdGripperDown },
+	['1'] = { UI_ARGS_ANY, cmdLevel1 },
+	['2'] = { UI_ARGS_ANY, cmdLevel2 },
+	['3'] = { UI_ARGS_ANY, cmdLevel3 },
+
+	[UI_OP_DRIVE]     = { 8, cmdDrive },
+	[UI_OP_DRIVE_TO]  = { 8, cmdDriveTo },
+	[UI_OP_TURN_TO]   = { 8, cmdTurnTo },
+	[UI_OP_GRIPPER]   = { 2, cmdGripper },
+	[UI_OP_PID_GAINS] = { 8, cmdPIDGains },
+	[UI_OP_OPEN_LOOP] = { 1, cmdSetOpenLoop },
+	[UI_OP_STREAM_TIMEOUT] = { 2, cmdStreamTimeout },
+	[UI_OP_PID_FF]    = { 12, cmdPIDFeedForward },
+	[UI_OP_SET_POSE]  = { 12, cmdSetPose },
+	[UI_OP_MOVE_LIMITS] = { 16, cmdMoveLimits },
+	[UI_OP_HEADING_HOLD] = { 8, cmdHeadingHold },
+	[UI_OP_WAYPOINT]  = { 8, cmdWaypoint },
+	[UI_OP_FOLLOW_PATH] = { 8, cmdFollowPath },
+	[UI_OP_CLEAR_PATH] = { 0, cmdClearPath },
+	[UI_OP_PROBE]     = { 2, cmdProbe },
+};
+
+
+// called from main loop to process UI commands
+//
+// packet :  pointer to input command received from UART (opcode followed by the command parameters)
+// len    :  length of input packet
+// event  : pointer to MotorEvent to return to be sent to the Controller State Machine
+//
+// the command is looked up in the dispatch table by opcode and a response packet is sent with the result
+void doUI(uint8_t * packet, int len, MotorEvent *event) {
+
+	uint8_t op=packet[0];
+	UI_STATUS status;
+
+	const UI_COMMAND * cmd = (op < UI_NUM_OPCODES)?&ui_commands[op]:NULL;
+
+	if(cmd == NULL || cmd->handler == NULL) {
+		status = UI_NACK_UNKNOWN;
+	}
+	else if(cmd->args_len != UI_ARGS_ANY && cmd->args_len != len-1) {
+		status = UI_NACK_LENGTH;
+	}
+	else {
+		status = cmd->handler(packet+1,event);
+	}
+
+	uint8_t response[3] = { UI_TYPE_RESPONSE, op, status };
+	slipEncode(response,sizeof(response),false); // responses must not be replaced by telemetry
+}
+
+
+// send the current telemetry info out the UART (packed into a status frame, encoded in a slip packet)
 void sendTelemetry(void) {
-	slipEncode((uint8_t*)&telemetry,sizeof(telemetry));
+
+	uint8_t frame[TLM_FRAME_SIZE];
+
+	int len = tlmEncode(&telemetry,telemetry_seq++,HAL_GetTick(),frame);
+	slipEncode(frame,len,true); // only the latest telemetry matters, so it can replace a frame still waiting to be sent
 }
 
 
@@ -212,6 +478,13 @@ void setIRRangeState(float range_long, float range_short) {
 	telemetry.ir_range_short=range_short;
 }
 
+// Update PID loop timing in the current telemetry
+void setSchedulerState(const SCHED_STATS * pid_stats) {
+	telemetry.pid_overruns=pid_stats->overruns;
+	telemetry.pid_jitter_min=pid_stats->jitter_min_us;
+	telemetry.pid_jitter_max=pid_stats->jitter_max_us;
+}
+
 // Generate random float from 0-max
 float randf(float max) {
 	return max *  ((float)rand())/((float)RAND_MAX);
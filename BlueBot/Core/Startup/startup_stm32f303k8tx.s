@@ -45,6 +45,13 @@ defined in linker script */
 .word	_sbss
 /* end address for the .bss section. defined in linker script */
 .word	_ebss
+/* start address for the initialization values of the .ccmram section.
+defined in linker script */
+.word	_siccmram
+/* start address for the .ccmram section. defined in linker script */
+.word	_sccmram
+/* end address for the .ccmram section. defined in linker script */
+.word	_eccmram
 
 .equ  BootRAM,        0xF1E0F85F
 /**
@@ -78,6 +85,23 @@ LoopCopyDataInit:
 	adds	r2, r0, r1
 	cmp	r2, r3
 	bcc	CopyDataInit
+
+/* Copy the control loop code and data from flash to CCMRAM (see App/Inc/ccmram.h) */
+  movs	r1, #0
+  b	LoopCopyCcmramInit
+
+CopyCcmramInit:
+	ldr	r3, =_siccmram
+	ldr	r3, [r3, r1]
+	str	r3, [r0, r1]
+	adds	r1, r1, #4
+
+LoopCopyCcmramInit:
+	ldr	r0, =_sccmram
+	ldr	r3, =_eccmram
+	adds	r2, r0, r1
+	cmp	r2, r3
+	bcc	CopyCcmramInit
 	ldr	r2, =_sbss
 	b	LoopFillZerobss
 /* Zero fill the bss segment. */
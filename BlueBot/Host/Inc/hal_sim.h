@@ -0,0 +1,48 @@
+/*
+ * hal_sim.h
+ *
+ *  Host simulation of the peripherals used by the App modules
+ *
+ *  The simulation owns the peripheral handles (htim1, huart1, hadc1 ...) that CubeMX
+ *  generates in Core/Src on the target, and provides functions to drive their inputs
+ *  (encoder counts, edge sensor pins, ADC readings, UART receive bytes) and inspect their
+ *  outputs (PWM compare values, transmitted UART bytes).
+ */
+
+#ifndef HOST_HAL_SIM_H_
+#define HOST_HAL_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+#define SIM_UART_BUF_SIZE 4096 // size of the simulated UART RX queue and TX capture buffer
+
+void simReset(void); // reset all simulated peripherals to power on state
+
+// simulated time only moves when the simulation advances it
+// timers with update interrupts enabled count with the simulated time and run their ISR callback
+void simAdvanceMicros(uint32_t us);
+void simAdvanceTick(uint32_t ms);
+uint32_t simMicros(void); // simulated time since reset (us)
+
+// encoder timers
+// move encoder counter by counts (wraps at ARR like the hardware), one count at a time when the EXTI line of the
+// encoder's A channel is enabled, running HAL_GPIO_EXTI_Callback at each A edge (every 2 counts) as the ISR would.
+// Sets the direction bit and runs HAL_TIM_PeriodElapsedCallback at each wrap if the update interrupt is enabled
+void simMoveEncoder(TIM_HandleTypeDef *htim, int32_t counts);
+
+// GPIO inputs, runs HAL_GPIO_EXTI_Callback if the pin's EXTI line is enabled for the edge
+void simSetPin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+// ADC - store a new conversion result and run the conversion complete ISR callback
+void simAdcConvert(ADC_HandleTypeDef *hadc, uint32_t value);
+
+// UART
+int simUartPushRx(UART_HandleTypeDef *huart, const uint8_t *data, int len); // receive bytes (into the DMA buffer if DMA reception is running), returns number received
+int simUartRxPending(UART_HandleTypeDef *huart); // bytes queued for polled reads but not yet read by the App
+void simUartTxComplete(UART_HandleTypeDef *huart); // finish any DMA transmit in progress (runs HAL_UART_TxCpltCallback)
+uint32_t simUartTxCount(UART_HandleTypeDef *huart); // total bytes transmitted since reset
+int simUartTxRead(UART_HandleTypeDef *huart, uint8_t *data, int size); // read (and remove) captured TX bytes, returns count (data may be NULL to discard)
+
+#endif /* HOST_HAL_SIM_H_ */
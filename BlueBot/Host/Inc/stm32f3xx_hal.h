@@ -0,0 +1,344 @@
+/*
+ * stm32f3xx_hal.h
+ *
+ *  Host stand-in for the STM32F3 HAL
+ *
+ *  Only the parts of the HAL used by the App modules are provided. Peripheral
+ *  registers are plain structs in host memory so the App sources compile unmodified,
+ *  and the simulation (hal_sim.c) drives them (timer counters, GPIO pins, ADC values,
+ *  UART byte queues).
+ *
+ *  The real Core/Inc headers (main.h, tim.h, usart.h ...) are used as-is and pick this
+ *  file up in place of the vendor HAL because Host/Inc is first on the include path.
+ */
+
+#ifndef HOST_STM32F3XX_HAL_H_
+#define HOST_STM32F3XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+
+typedef enum {
+	HAL_OK      = 0x00U,
+	HAL_ERROR   = 0x01U,
+	HAL_BUSY    = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+	HAL_UNLOCKED = 0x00U,
+	HAL_LOCKED   = 0x01U
+} HAL_LockTypeDef;
+
+typedef enum {
+	RESET = 0U,
+	SET = !RESET
+} FlagStatus, ITStatus;
+
+#define UNUSED(X) (void)X
+
+
+// ---------------------------------------------------------------------------------
+// GPIO
+// ---------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t IDR;  // input pin levels (driven by the simulation)
+	__IO uint32_t ODR;  // output pin levels (driven by the App)
+} GPIO_TypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0U,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_0  ((uint16_t)0x0001)
+#define GPIO_PIN_1  ((uint16_t)0x0002)
+#define GPIO_PIN_2  ((uint16_t)0x0004)
+#define GPIO_PIN_3  ((uint16_t)0x0008)
+#define GPIO_PIN_4  ((uint16_t)0x0010)
+#define GPIO_PIN_5  ((uint16_t)0x0020)
+#define GPIO_PIN_6  ((uint16_t)0x0040)
+#define GPIO_PIN_7  ((uint16_t)0x0080)
+#define GPIO_PIN_8  ((uint16_t)0x0100)
+#define GPIO_PIN_9  ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+extern GPIO_TypeDef sim_gpioa;
+extern GPIO_TypeDef sim_gpiob;
+#define GPIOA (&sim_gpioa)
+#define GPIOB (&sim_gpiob)
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_IRQHandler(uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+
+// ---------------------------------------------------------------------------------
+// EXTI and NVIC
+// ---------------------------------------------------------------------------------
+typedef struct {
+	uint32_t Line;
+} EXTI_HandleTypeDef;
+
+typedef struct {
+	uint32_t Line;
+	uint32_t Mode;
+	uint32_t Trigger;
+	uint32_t GPIOSel;
+} EXTI_ConfigTypeDef;
+
+// lines are just the line number (the vendor HAL also encodes the register and line type)
+#define EXTI_LINE_0  0U
+#define EXTI_LINE_7  7U
+#define EXTI_LINE_9  9U
+#define EXTI_LINE_11 11U
+
+#define EXTI_MODE_INTERRUPT         0x00000001U
+#define EXTI_TRIGGER_RISING         0x00000001U
+#define EXTI_TRIGGER_FALLING        0x00000002U
+#define EXTI_TRIGGER_RISING_FALLING (EXTI_TRIGGER_RISING | EXTI_TRIGGER_FALLING)
+#define EXTI_GPIOA                  0x00000000U
+#define EXTI_GPIOB                  0x00000001U
+
+HAL_StatusTypeDef HAL_EXTI_SetConfigLine(EXTI_HandleTypeDef *hexti, EXTI_ConfigTypeDef *pExtiConfig);
+
+typedef enum {
+	EXTI0_IRQn   = 6,
+	EXTI9_5_IRQn = 23,
+	TIM1_UP_TIM16_IRQn = 25,
+	EXTI15_10_IRQn = 40
+} IRQn_Type;
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+
+
+// ---------------------------------------------------------------------------------
+// Timers
+// ---------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t CR1;
+	__IO uint32_t DIER;
+	__IO uint32_t SR;
+	__IO uint32_t CNT;
+	__IO uint32_t PSC;
+	__IO uint32_t ARR;
+	__IO uint32_t CCR1;
+	__IO uint32_t CCR2;
+	__IO uint32_t CCR3;
+	__IO uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct {
+	uint32_t Prescaler;
+	uint32_t CounterMode;
+	uint32_t Period;
+	uint32_t ClockDivision;
+	uint32_t RepetitionCounter;
+	uint32_t AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct {
+	TIM_TypeDef *Instance;
+	TIM_Base_InitTypeDef Init;
+} TIM_HandleTypeDef;
+
+#define TIM_CHANNEL_1   0x00000000U
+#define TIM_CHANNEL_2   0x00000004U
+#define TIM_CHANNEL_3   0x00000008U
+#define TIM_CHANNEL_4   0x0000000CU
+#define TIM_CHANNEL_ALL 0x0000003CU
+
+#define __HAL_TIM_GET_COUNTER(__HANDLE__)  ((__HANDLE__)->Instance->CNT)
+#define __HAL_TIM_SET_COUNTER(__HANDLE__, __COUNTER__)  ((__HANDLE__)->Instance->CNT = (__COUNTER__))
+#define __HAL_TIM_GET_AUTORELOAD(__HANDLE__) ((__HANDLE__)->Instance->ARR)
+
+#define TIM_CR1_DIR     0x00000010U // counting down
+#define TIM_IT_UPDATE   0x00000001U
+#define TIM_FLAG_UPDATE 0x00000001U
+
+#define __HAL_TIM_ENABLE_IT(__HANDLE__, __INTERRUPT__)  ((__HANDLE__)->Instance->DIER |= (__INTERRUPT__))
+#define __HAL_TIM_DISABLE_IT(__HANDLE__, __INTERRUPT__) ((__HANDLE__)->Instance->DIER &= ~(__INTERRUPT__))
+#define __HAL_TIM_GET_FLAG(__HANDLE__, __FLAG__)   (((__HANDLE__)->Instance->SR & (__FLAG__)) == (__FLAG__))
+#define __HAL_TIM_CLEAR_FLAG(__HANDLE__, __FLAG__) ((__HANDLE__)->Instance->SR = ~(__FLAG__))
+#define __HAL_TIM_IS_TIM_COUNTING_DOWN(__HANDLE__) (((__HANDLE__)->Instance->CR1 & (TIM_CR1_DIR)) == (TIM_CR1_DIR))
+
+#define __HAL_TIM_SET_COMPARE(__HANDLE__, __CHANNEL__, __COMPARE__) \
+  (((__CHANNEL__) == TIM_CHANNEL_1) ? ((__HANDLE__)->Instance->CCR1 = (__COMPARE__)) :\
+   ((__CHANNEL__) == TIM_CHANNEL_2) ? ((__HANDLE__)->Instance->CCR2 = (__COMPARE__)) :\
+   ((__CHANNEL__) == TIM_CHANNEL_3) ? ((__HANDLE__)->Instance->CCR3 = (__COMPARE__)) :\
+   ((__HANDLE__)->Instance->CCR4 = (__COMPARE__)))
+
+#define __HAL_TIM_GET_COMPARE(__HANDLE__, __CHANNEL__) \
+  (((__CHANNEL__) == TIM_CHANNEL_1) ? ((__HANDLE__)->Instance->CCR1) :\
+   ((__CHANNEL__) == TIM_CHANNEL_2) ? ((__HANDLE__)->Instance->CCR2) :\
+   ((__CHANNEL__) == TIM_CHANNEL_3) ? ((__HANDLE__)->Instance->CCR3) :\
+   ((__HANDLE__)->Instance->CCR4))
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_Encoder_Start(TIM_HandleTypeDef *htim, uint32_t Channel);
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim);
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim);
+
+
+// ---------------------------------------------------------------------------------
+// DMA
+// ---------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t CCR;
+	__IO uint32_t CNDTR; // number of data items left to transfer
+	__IO uint32_t CPAR;
+	__IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->CNDTR)
+
+
+// ---------------------------------------------------------------------------------
+// UART
+// ---------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t CR1;
+	__IO uint32_t ISR;
+	__IO uint32_t ICR;
+	__IO uint16_t RDR;
+	__IO uint16_t TDR;
+} USART_TypeDef;
+
+typedef enum {
+	HAL_UART_STATE_RESET = 0x00U,
+	HAL_UART_STATE_READY = 0x20U,
+	HAL_UART_STATE_BUSY  = 0x24U,
+	HAL_UART_STATE_BUSY_TX = 0x21U,
+	HAL_UART_STATE_BUSY_RX = 0x22U
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct __UART_HandleTypeDef {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	__IO HAL_UART_StateTypeDef gState;
+	__IO HAL_UART_StateTypeDef RxState;
+	__IO uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+#define UART_FLAG_PE   (1U << 0)
+#define UART_FLAG_FE   (1U << 1)
+#define UART_FLAG_NE   (1U << 2)
+#define UART_FLAG_ORE  (1U << 3)
+#define UART_FLAG_IDLE (1U << 4)
+#define UART_FLAG_RXNE (1U << 5)
+#define UART_FLAG_TC   (1U << 6)
+
+#define UART_CLEAR_PEF   UART_FLAG_PE
+#define UART_CLEAR_FEF   UART_FLAG_FE
+#define UART_CLEAR_NEF   UART_FLAG_NE
+#define UART_CLEAR_OREF  UART_FLAG_ORE
+#define UART_CLEAR_IDLEF UART_FLAG_IDLE
+
+#define UART_IT_IDLE (1U << 4)
+
+#define HAL_UART_ERROR_NONE 0x00U
+#define HAL_UART_ERROR_ORE  0x08U
+#define HAL_UART_ERROR_DMA  0x10U
+
+// writes to ICR are handled by the simulation so cleared flags are reflected back in ISR
+#define __HAL_UART_GET_FLAG(__HANDLE__, __FLAG__) (((__HANDLE__)->Instance->ISR & (__FLAG__)) == (__FLAG__))
+#define __HAL_UART_CLEAR_FLAG(__HANDLE__, __FLAG__) ((__HANDLE__)->Instance->ISR &= ~(__FLAG__))
+#define __HAL_UART_CLEAR_PEFLAG(__HANDLE__)   __HAL_UART_CLEAR_FLAG((__HANDLE__), UART_CLEAR_PEF)
+#define __HAL_UART_CLEAR_FEFLAG(__HANDLE__)   __HAL_UART_CLEAR_FLAG((__HANDLE__), UART_CLEAR_FEF)
+#define __HAL_UART_CLEAR_NEFLAG(__HANDLE__)   __HAL_UART_CLEAR_FLAG((__HANDLE__), UART_CLEAR_NEF)
+#define __HAL_UART_CLEAR_OREFLAG(__HANDLE__)  __HAL_UART_CLEAR_FLAG((__HANDLE__), UART_CLEAR_OREF)
+#define __HAL_UART_CLEAR_IDLEFLAG(__HANDLE__) __HAL_UART_CLEAR_FLAG((__HANDLE__), UART_CLEAR_IDLEF)
+#define __HAL_UART_ENABLE_IT(__HANDLE__, __INTERRUPT__)  ((__HANDLE__)->Instance->CR1 |= (__INTERRUPT__))
+#define __HAL_UART_DISABLE_IT(__HANDLE__, __INTERRUPT__) ((__HANDLE__)->Instance->CR1 &= ~(__INTERRUPT__))
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+
+
+// ---------------------------------------------------------------------------------
+// ADC
+// ---------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t DR;
+} ADC_TypeDef;
+
+typedef struct {
+	ADC_TypeDef *Instance;
+} ADC_HandleTypeDef;
+
+#define ADC_SINGLE_ENDED 0x00000000U
+
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc, uint32_t SingleDiff);
+HAL_StatusTypeDef HAL_ADC_Start_IT(ADC_HandleTypeDef *hadc);
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc);
+
+
+// ---------------------------------------------------------------------------------
+// System
+// ---------------------------------------------------------------------------------
+uint32_t HAL_GetTick(void);
+void HAL_IncTick(void);
+
+extern uint32_t SystemCoreClock; // core clock (Hz), 64MHz as on the robot
+
+// DWT cycle counter, counts at SystemCoreClock from the host's monotonic clock (not the simulated time)
+// once CYCCNTENA is set, so code timed on the host reports in the same units as on the robot
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk     (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+DWT_Type * simDWT(void); // updates CYCCNT from the host clock on each access
+extern CoreDebug_Type sim_core_debug;
+
+#define DWT       (simDWT())
+#define CoreDebug (&sim_core_debug)
+
+#define __disable_irq() ((void)0)
+#define __enable_irq()  ((void)0)
+#define __DMB()         __sync_synchronize()
+
+#endif /* HOST_STM32F3XX_HAL_H_ */
@@ -0,0 +1,2457 @@
+/*
+ * bench.c
+ *
+ *  Micro-benchmarks for the App hot path functions, run on the host against the simulated HAL
+ *
+ *  Each benchmark case has an optional setup function (run once, untimed) and a run function
+ *  that is timed over many iterations. Results are reported as ns/iteration and host CPU
+ *  cycles/iteration. Host numbers are not target numbers, but they are reproducible and
+ *  track relative changes in the cost of the control loop code.
+ *
+ *  Cases with a report function also print statistics gathered by the run (e.g. simulated timing).
+ *
+ *  usage: bench [iterations] [name filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "hal_sim.h"
+#include "tim.h"
+#include "usart.h"
+#include "adc.h"
+
+#include "pid.h"
+#include "encoder.h"
+#include "motors.h"
+#include "coms.h"
+#include "ui.h"
+#include "controler.h"
+#include "ir_range.h"
+#include "edge_sensor.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "path.h"
+#include "events.h"
+#include "probe.h"
+#include "fast_math.h"
+
+#define DEFAULT_ITERATIONS 200000
+#define BENCH_DT 0.02f // PID update period used by the benchmarks (s)
+
+// define a benchmark case
+typedef struct BENCH_CASE_t {
+	const char * name;         // name reported in results
+	void (*setup)(void);       // called once before timing starts (may be NULL)
+	void (*run)(uint32_t i);   // timed function, i is the iteration number
+	void (*report)(void);      // called after timing to print extra results (may be NULL)
+} BENCH_CASE;
+
+static volatile float sink_f; // stop the compiler discarding results
+static volatile int sink_i;
+
+// pre-encoded SLIP frame used by the decoder benchmarks
+static uint8_t slip_frame[256];
+static int slip_frame_len=0;
+
+
+// ---------------------------------------------------------------------------------
+// timing helpers
+// ---------------------------------------------------------------------------------
+
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t nowCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return nowNs(); // no cycle counter available, report ns
+#endif
+}
+
+
+// ---------------------------------------------------------------------------------
+// benchmark cases
+// ---------------------------------------------------------------------------------
+
+static void setupSim(void) {
+	simReset();
+	setSpeedLoopRate(0); // benchmarks call updateEncoder themselves every BENCH_DT unless they start the speed loop
+	encoderSetPeriod(BENCH_DT);
+	encoderInit();
+	resetPose();
+	comsInit();
+	STOP();
+	controlerInit();
+}
+
+static void runPidUpdate(uint32_t i) {
+	sink_f = pidUpdate((i & 0x100)?10.0f:-10.0f,(float)(i & 0xFF)*0.05f,&pid_left);
+}
+
+// simulated motor (first order, PID_PLANT_GAIN rad/s at full duty, time constant PID_PLANT_TAU)
+#define PID_PLANT_GAIN 30.0f
+#define PID_PLANT_TAU  0.08f
+#define PID_PLANT_DEADBAND 0.05f // duty needed to start the motor moving
+
+static float plantUpdate(float vel, float duty) {
+	return vel + (PID_PLANT_GAIN*duty - vel)*(BENCH_DT/PID_PLANT_TAU);
+}
+
+// motor with a deadband, no torque until the duty overcomes the static friction
+static float plantDeadbandUpdate(float vel, float duty) {
+
+	float drive = 0.0f;
+	if(duty > PID_PLANT_DEADBAND) {
+		drive = duty - PID_PLANT_DEADBAND;
+	}
+	else if(duty < -PID_PLANT_DEADBAND) {
+		drive = duty + PID_PLANT_DEADBAND;
+	}
+	return plantUpdate(vel,drive);
+}
+
+static void runUpdateEncoder(uint32_t i) {
+	simMoveEncoder(&htim2,(int32_t)(i & 0x1F) - 8);
+	updateEncoder(&enc_left);
+}
+
+static void runUpdateMotorsMotion(uint32_t i) {
+	simMoveEncoder(&htim2,-12);
+	simMoveEncoder(&htim1,12);
+	sink_i = updateMotors(true,BENCH_DT);
+}
+
+static void setupSpeedLoop(void) {
+	setupSim();
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	setMotorSpeed(10.0f,10.0f);
+}
+
+static void runUpdateSpeedLoop(uint32_t i) {
+	simMoveEncoder(&htim2,-2);
+	simMoveEncoder(&htim1,2);
+	updateSpeedLoop();
+}
+
+static void runUpdateMotorsIdle(uint32_t i) {
+	sink_i = updateMotors(false,BENCH_DT);
+}
+
+static void setupDriveTo(void) {
+	setupSim();
+	driveTo(1.0e6f,MAX_LIN_VEL); // long drive so the move stays active for the whole run
+}
+
+static void setupTurnTo(void) {
+	setupSim();
+	turnTo(1.0e6f,MAX_ANG_VEL);
+}
+
+static void runUpdateMotorsTurn(uint32_t i) {
+	simMoveEncoder(&htim2,12);
+	simMoveEncoder(&htim1,12);
+	sink_i = updateMotors(true,BENCH_DT);
+}
+
+static void runUpdateControler(uint32_t i) {
+	eventPost(ME_DONE_TURN); // ignored when idle
+	updateControler();
+}
+
+static void runUpdateIRSensors(uint32_t i) {
+	simAdcConvert(&hadc1,1000 + (i & 0x3FF));
+	simAdcConvert(&hadc2,1500 + (i & 0x3FF));
+	updateIRSensors();
+}
+
+static void runSlipEncode(uint32_t i) {
+	static uint8_t data[100];
+	data[i % sizeof(data)] = (uint8_t)i; // includes special characters that need escaping
+	slipEncode(data,sizeof(data),true);
+	simUartTxComplete(&huart1);
+	simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE); // discard captured output
+}
+
+static void setupSlipDecode(void) {
+
+	uint8_t data[100];
+	for(unsigned int i=0; i < sizeof(data); i++) {
+		data[i]=(uint8_t)(i*7);
+	}
+
+	setupSim();
+	slipEncode(data,sizeof(data),true); // use the encoder to build the test frame
+	slip_frame_len = simUartTxRead(&huart1,slip_frame,sizeof(slip_frame));
+	simUartTxComplete(&huart1);
+}
+
+static void runSlipDecode(uint32_t i) {
+	static SLIP_DECODER dec;
+	static uint8_t packet[128+COMS_FRAME_OVERHEAD];
+	int len=0;
+	for(int n=0; n < slip_frame_len; n++) {
+		if(slipDecode(&dec,slip_frame[n],sizeof(packet),packet,&len)) {
+			sink_i = slipCheckFrame(packet,len);
+		}
+	}
+}
+
+static void runDoComs(uint32_t i) {
+	static const uint8_t idle=0x55; // a byte that is not part of a packet
+	simUartPushRx(&huart1,&idle,1);
+	sink_i = doComs();
+}
+
+// command dispatch, cycles through a velocity setpoint, a single key command and an unknown opcode
+static uint8_t ui_packets[3][9];
+static const int ui_packet_len[3] = { 9, 1, 1 };
+
+static void setupDoUI(void) {
+
+	float v[2] = { 0.25f, -1.0f };
+
+	setupSim();
+	ui_packets[0][0] = UI_OP_DRIVE;
+	memcpy(&ui_packets[0][1],v,sizeof(v)); // host is little endian like the target
+	ui_packets[1][0] = 'o';
+	ui_packets[2][0] = 0x7F;
+}
+
+static void runDoUI(uint32_t i) {
+
+	MotorEvent event=0;
+	int n = i % 3;
+
+	doUI(ui_packets[n],ui_packet_len[n],&event);
+	sink_i = event;
+
+	simUartTxComplete(&huart1); // discard the response
+	simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE);
+}
+
+// simulate the host streaming commands at the full line rate
+// each pass of the main loop takes 1-5ms (1 pass in 50 stalls for up to 10ms more) and the bytes
+// that arrive on the UART in that time are pushed into the DMA ring before doComs() is called
+#define LINE_BYTES_PER_MS 46 // 460800 baud, 10 bits per byte
+
+static uint8_t coms_cmd[16];  // stop command, has no side effects when repeated
+static uint8_t coms_frame[SLIP_MAX_ENCODED(sizeof(coms_cmd)+COMS_FRAME_OVERHEAD)]; // encoded command frame
+static int coms_frame_len=0;
+static int coms_frame_pos=0;
+static uint8_t coms_seq=0;
+static uint32_t coms_pushed=0;        // bytes pushed into the UART
+static uint32_t coms_injected=0;      // receive overruns injected
+static bool coms_inject=false;        // inject a receive overrun part way through 1 pass in 20
+
+static void setupDoComsLineRate(void) {
+
+	memset(coms_cmd,0,sizeof(coms_cmd));
+	coms_cmd[0]=' ';
+
+	setupSim();
+	coms_seq=0;
+	coms_frame_len = slipEncodeFrame(coms_cmd,sizeof(coms_cmd),coms_seq++,0,coms_frame);
+	coms_frame_pos=0;
+	coms_pushed=0;
+	coms_injected=0;
+	coms_inject=false;
+
+	srand(1);
+}
+
+static void setupDoComsRestart(void) {
+	setupDoComsLineRate();
+	coms_inject=true;
+}
+
+static void runDoComsLineRate(uint32_t i) {
+
+	uint32_t work_us = 1000 + (uint32_t)(rand() % 4000);
+	if(rand() % 50 == 0) {
+		work_us += (uint32_t)(rand() % 10000);
+	}
+
+	uint32_t bytes = work_us*LINE_BYTES_PER_MS/1000;
+	uint32_t error_at = (coms_inject && rand() % 20 == 0)?bytes/2:UINT32_MAX;
+	coms_pushed += bytes;
+	while(bytes--) {
+		if(bytes == error_at) { // overrun, the HAL aborts the DMA reception and reports the error
+			huart1.ErrorCode = HAL_UART_ERROR_ORE;
+			huart1.RxState = HAL_UART_STATE_READY;
+			HAL_UART_ErrorCallback(&huart1);
+			coms_injected++;
+		}
+		simUartPushRx(&huart1,&coms_frame[coms_frame_pos++],1);
+		if(coms_frame_pos == coms_frame_len) { // start the next frame
+			coms_frame_len = slipEncodeFrame(coms_cmd,sizeof(coms_cmd),coms_seq++,0,coms_frame);
+			coms_frame_pos = 0;
+		}
+	}
+	simAdvanceMicros(work_us);
+
+	sink_i = doComs();
+
+	simUartTxComplete(&huart1); // discard the command responses
+	simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE);
+}
+
+static void reportDoComs(void) {
+
+	const COMS_STATS * st = comsGetStats();
+
+	printf("    simulated %.1f s\n",simMicros()*1.0e-6);
+	printf("    rx bytes=%u lost=%u overruns=%u errors=%u idle=%u\n",
+			st->rx_bytes,st->rx_lost,st->rx_overruns,st->rx_errors,st->rx_idle);
+	printf("    rx frames=%u crc errors=%u seq gaps=%u\n",st->rx_frames,st->rx_crc_errors,st->rx_seq_gaps);
+	printf("    bytes/pass avg=%.1f max=%u\n",st->rx_passes?(double)st->rx_bytes/st->rx_passes:0.0,st->rx_max_pass);
+	if(coms_inject) {
+		printf("    overruns injected=%u, bytes read + lost = pushed: %s\n",coms_injected,
+				(st->rx_overruns == coms_injected && st->rx_bytes + st->rx_lost == coms_pushed)?"PASS":"FAIL");
+	}
+	else {
+		printf("    no bytes lost at the line rate: %s\n",(st->rx_lost == 0 && st->rx_crc_errors == 0 && st->rx_seq_gaps == 0)?"PASS":"FAIL");
+	}
+}
+
+static void runSendTelemetry(uint32_t i) {
+	sendTelemetry();
+	simUartTxComplete(&huart1);
+	simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE); // discard captured output
+}
+
+// simulate telemetry being sent faster than the line can carry it
+// each pass of the loop takes 0.2-3ms and sends a telemetry frame, the UART takes ~2ms to send each frame
+// (10 bits per byte at 460800 baud) so frames queue and coalesce. The captured output is decoded to check
+// that every frame sent arrives intact
+#define LINE_US_PER_BYTE (10.0e6/460800)
+
+static uint32_t tx_started=0;   // bytes the UART had been asked to send at the last check
+static double tx_end_us=0;      // simulated time the frame being sent finishes
+static uint32_t tx_decoded=0;   // frames decoded from the captured output
+static uint32_t tx_bad=0;       // decoded frames with the wrong length or CRC
+static int telemetry_len=0;     // length of the first decoded frame
+
+static void checkTxStarted(void) {
+
+	uint32_t count = simUartTxCount(&huart1);
+	if(count != tx_started) {
+		tx_end_us = simMicros() + (count - tx_started)*LINE_US_PER_BYTE;
+		tx_started = count;
+	}
+}
+
+static void decodeTx(void) {
+
+	static SLIP_DECODER dec;
+	static uint8_t packet[128+COMS_FRAME_OVERHEAD];
+	uint8_t c;
+	int len;
+
+	while(simUartTxRead(&huart1,&c,1)) {
+		if(slipDecode(&dec,c,sizeof(packet),packet,&len)) {
+			tx_decoded++;
+			if(telemetry_len == 0) {
+				telemetry_len = len;
+			}
+			if(len != telemetry_len || !slipCheckFrame(packet,len)) {
+				tx_bad++;
+			}
+		}
+	}
+}
+
+static void setupTelemetryStream(void) {
+
+	setupSim();
+	srand(1);
+	tx_started=0;
+	tx_end_us=0;
+	tx_decoded=0;
+	tx_bad=0;
+	telemetry_len=0;
+}
+
+static void runTelemetryStream(uint32_t i) {
+
+	uint32_t work_us = 200 + (uint32_t)(rand() % 2800);
+
+	sendTelemetry();
+	checkTxStarted();
+
+	uint32_t end_us = simMicros() + work_us;
+
+	while(huart1.gState == HAL_UART_STATE_BUSY_TX && tx_end_us <= end_us) { // frames that finish during this pass
+		simAdvanceMicros((uint32_t)tx_end_us - simMicros());
+		simUartTxComplete(&huart1);
+		checkTxStarted();
+	}
+
+	simAdvanceMicros(end_us - simMicros());
+	decodeTx();
+}
+
+static void reportTelemetryStream(void) {
+
+	const COMS_STATS * st = comsGetStats();
+
+	printf("    simulated %.1f s, %.0f bytes/s (line max %.0f)\n",simMicros()*1.0e-6,
+			simUartTxCount(&huart1)/(simMicros()*1.0e-6),1.0e6/LINE_US_PER_BYTE);
+	printf("    tx frames=%u coalesced=%u dropped=%u decoded=%u bad=%u\n",
+			st->tx_frames,st->tx_coalesced,st->tx_dropped,tx_decoded,tx_bad);
+}
+
+// telemetry frame packing
+// the report round trips a known state through the encoder and decoder, checks the encoded bytes
+// against the documented layout and shows the precision lost to the packed fields
+static TELEMETRY tlm_sample;
+static uint8_t tlm_frame[TLM_FRAME_SIZE];
+
+// size of the TELEMETRY struct the robot sent as raw memory before the packed frame
+// (PID_STATE x2, encoder pos and vel x2, IR ranges, clifs)
+#define TLM_RAW_SIZE (2*sizeof(PID_STATE) + 4*sizeof(float) + 2*sizeof(float) + sizeof(uint32_t))
+
+static const uint8_t tlm_golden[TLM_FRAME_SIZE] = {
+	0x01,0x03,0x34,0x12,0x78,0x56,0x34,0x12,  // header: type, version, seq, ticks
+	0x40,0x4a,0x2f,0x4a,0xe1,0x38,0x6f,0x42,  // pid_left
+	0x40,0xc7,0x66,0xc7,0x9a,0xb5,0x25,0x96,  // pid_right
+	0x87,0xd6,0x12,0x00,0x2f,0x4a,            // enc_left
+	0x4c,0x3b,0xfb,0xff,0x66,0xc7,            // enc_right
+	0xae,0x00,0xff,0xff,                      // ir short, long
+	0x02,                                     // clifs
+	0xff,0xff,0x3e,0xfe,0xff,0x7f             // pid_overruns, jitter min, max
+};
+
+static void setupTlmEncode(void) {
+
+	memset(&tlm_sample,0,sizeof(tlm_sample));
+
+	tlm_sample.pid_left = (PID_STATE){ .ref=12.5f, .fb=12.37f, .u=0.61f, .I=3.217f };
+	tlm_sample.pid_left.error = tlm_sample.pid_left.ref - tlm_sample.pid_left.fb;
+	tlm_sample.pid_right = (PID_STATE){ .ref=-7.25f, .fb=-7.4f, .u=-0.35f, .I=-1.5e-3f };
+	tlm_sample.pid_right.error = tlm_sample.pid_right.ref - tlm_sample.pid_right.fb;
+	tlm_sample.enc_left = (ENCODER_STATE){ .pos=1.234567f, .vel=12.37f };
+	tlm_sample.enc_right = (ENCODER_STATE){ .pos=-0.3125f, .vel=-7.4f };
+	tlm_sample.ir_range_short = 17.36f;
+	tlm_sample.ir_range_long = NAN;
+	tlm_sample.clifs = BUMP_BIT_RIGHT;
+	tlm_sample.pid_overruns = 70000;
+	tlm_sample.pid_jitter_min = -450;
+	tlm_sample.pid_jitter_max = 40000;
+}
+
+static void runTlmEncode(uint32_t i) {
+	tlm_sample.enc_left.vel = (float)(i & 0xFF)*0.1f;
+	sink_i = tlmEncode(&tlm_sample,(uint16_t)i,i,tlm_frame);
+}
+
+static void reportTlmEncode(void) {
+
+	TLM_HEADER hdr;
+	TELEMETRY out;
+
+	setupTlmEncode();
+	int len = tlmEncode(&tlm_sample,0x1234,0x12345678,tlm_frame);
+
+	bool ok = tlmDecode(tlm_frame,len,&hdr,&out);
+	bool layout = (len == TLM_FRAME_SIZE) && (memcmp(tlm_frame,tlm_golden,sizeof(tlm_golden)) == 0);
+
+	printf("    frame %d bytes (raw struct the robot used to send %u bytes), decode %s, layout %s\n",
+			len,(unsigned int)TLM_RAW_SIZE,ok?"ok":"FAILED",layout?"ok":"CHANGED");
+	printf("    seq=%#x ticks=%#x\n",hdr.seq,hdr.ticks);
+	printf("    pid_left  ref %g->%g fb %g->%g u %g->%g I %g->%g\n",
+			tlm_sample.pid_left.ref,out.pid_left.ref,tlm_sample.pid_left.fb,out.pid_left.fb,
+			tlm_sample.pid_left.u,out.pid_left.u,tlm_sample.pid_left.I,out.pid_left.I);
+	printf("    pid_right ref %g->%g fb %g->%g u %g->%g I %g->%g\n",
+			tlm_sample.pid_right.ref,out.pid_right.ref,tlm_sample.pid_right.fb,out.pid_right.fb,
+			tlm_sample.pid_right.u,out.pid_right.u,tlm_sample.pid_right.I,out.pid_right.I);
+	printf("    enc pos %g->%g %g->%g vel %g->%g %g->%g\n",
+			tlm_sample.enc_left.pos,out.enc_left.pos,tlm_sample.enc_right.pos,out.enc_right.pos,
+			tlm_sample.enc_left.vel,out.enc_left.vel,tlm_sample.enc_right.vel,out.enc_right.vel);
+	printf("    ir %g->%g %g->%g clifs %u overruns %u->%u jitter [%d,%d]->[%d,%d]\n",
+			tlm_sample.ir_range_short,out.ir_range_short,tlm_sample.ir_range_long,out.ir_range_long,
+			out.clifs,tlm_sample.pid_overruns,out.pid_overruns,
+			tlm_sample.pid_jitter_min,tlm_sample.pid_jitter_max,out.pid_jitter_min,out.pid_jitter_max);
+
+	if(!layout) {
+		printf("    encoded:");
+		for(int n=0; n < len; n++) {
+			printf(" %02x",tlm_frame[n]);
+		}
+		printf("\n");
+	}
+}
+
+// simulate the app_main loop running under the scheduler
+// each pass takes a random amount of simulated time, up to 3ms (the main loop probe measures well under 1ms on the
+// host), so the reported jitter shows how the rate groups hold up under load and none should overrun
+// the stall sim also makes 1 pass in 20 take up to 25ms, longer than the group periods. A group can only overrun
+// in a pass longer than its period, the report shows the overruns against the number of those passes
+static const uint32_t sched_sim_period_us[NUM_SCHED_GROUPS] = { 20000, 10000, 20000, 500000 }; // as scheduler.c
+
+static bool sched_sim_stalls;                     // make 1 pass in 20 stall
+static uint32_t sched_sim_long[NUM_SCHED_GROUPS]; // passes at least as long as the period of each group
+
+static void setupScheduler(void) {
+	setupSim();
+	srand(1);
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	schedInit();
+	sched_sim_stalls = false;
+	memset(sched_sim_long,0,sizeof(sched_sim_long));
+}
+
+static void setupSchedulerStalls(void) {
+	setupScheduler();
+	sched_sim_stalls = true;
+}
+
+static void runScheduler(uint32_t i) {
+
+	uint32_t work_us = 50 + (uint32_t)(rand() % 3000);
+	if(sched_sim_stalls && rand() % 20 == 0) {
+		work_us += (uint32_t)(rand() % 22000);
+	}
+	for(int g=0; g < NUM_SCHED_GROUPS; g++) {
+		if(work_us >= sched_sim_period_us[g]) {
+			sched_sim_long[g]++;
+		}
+	}
+
+	if(schedDue(SG_LED)) {
+		HAL_GPIO_TogglePin(LED_GPIO_Port,LED_Pin);
+	}
+	if(schedDue(SG_DEBOUNCE)) {
+		updateEdgeSensors();
+	}
+	bool pid_update = schedDue(SG_MOTION);
+	sink_i = updateMotors(pid_update,schedDT(SG_MOTION));
+	if(schedDue(SG_TELEMETRY)) {
+		sendTelemetry();
+		simUartTxComplete(&huart1);
+		simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE);
+	}
+
+	simAdvanceMicros(work_us); // time taken by the rest of the loop
+}
+
+static void reportScheduler(void) {
+
+	static const char * names[NUM_SCHED_GROUPS] = { "MOTION", "DEBOUNCE", "TELEMETRY", "LED" };
+
+	printf("    simulated %.1f s\n",simMicros()*1.0e-6);
+	uint32_t overruns = 0;
+	bool stalled = true; // every overrun was in a pass longer than the period
+	for(int g=0; g < NUM_SCHED_GROUPS; g++) {
+		const SCHED_STATS * st = schedGetStats(g);
+		printf("    %-10s runs=%-8u overruns=%-6u passes longer than the period=%-6u jitter=[%d,%d]us max latency=%uus\n",
+				names[g],st->runs,st->overruns,sched_sim_long[g],st->jitter_min_us,st->jitter_max_us,st->latency_max_us);
+		overruns += st->overruns;
+		stalled = stalled && st->overruns <= sched_sim_long[g];
+	}
+	if(!sched_sim_stalls) {
+		printf("    no overruns under load: %s\n",(overruns == 0)?"PASS":"FAIL");
+		return;
+	}
+	printf("    overruns only in passes longer than the period: %s\n",stalled?"PASS":"FAIL");
+
+	// time read just after the counter wrapped but before the tick ISR has counted it (e.g. from a higher priority ISR)
+	uint32_t before = schedMicros();
+	uint32_t cnt = htim17.Instance->CNT;
+	htim17.Instance->CNT = 5;
+	htim17.Instance->SR |= TIM_FLAG_UPDATE;
+	uint32_t wrapped = schedMicros();
+	htim17.Instance->SR &= ~TIM_FLAG_UPDATE;
+	htim17.Instance->CNT = cnt;
+	printf("    schedMicros with the tick pending: %uus after %uus %s\n",wrapped,before,
+			(wrapped - before == SCHED_TICK_US - cnt + 5)?"PASS":"FAIL");
+}
+
+// run the app_main loop with its probes, each pass followed by 200us of simulated time (the speed loop probe runs
+// in the tick callback). The host HAL runs the cycle counter from the host clock at 64MHz, so the probe times read
+// the same way as the robot's (telemetry and UI_OP_PROBE) and the ns/iter of the single function benchmarks
+#define PROBE_SIM_PASS_US 200
+#define PROBE_OVERHEAD_RUNS 100000
+
+static void setupProbeSim(void) {
+	setupSim();
+	srand(1);
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	setMotorSpeed(5.0f,5.0f);
+	probeInit();
+	schedInit();
+}
+
+static void runProbeSim(uint32_t i) {
+
+	uint32_t loop_start = probeStart();
+
+	if(schedDue(SG_DEBOUNCE)) {
+		updateEdgeSensors();
+	}
+	bool motion_update = schedDue(SG_MOTION);
+	PROBE(PROBE_IR,updateIRSensors());
+	setIRRangeState(getLongRangeIR(),getShortRangeIR());
+	PROBE(PROBE_MOTORS,eventPost(updateMotors(motion_update,schedDT(SG_MOTION))));
+	if(motion_update) {
+		setPIDState(&pid_left.state,&pid_right.state);
+		setEncoderState(&enc_left.state,&enc_right.state);
+		setSchedulerState(schedGetStats(SG_MOTION));
+	}
+	PROBE(PROBE_COMS,eventPost(doComs()));
+	PROBE(PROBE_CONTROLER,updateControler());
+	if(schedDue(SG_TELEMETRY)) {
+		PROBE(PROBE_TELEMETRY,sendTelemetry());
+		simUartTxComplete(&huart1);
+		simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE);
+	}
+
+	probeEnd(PROBE_LOOP,loop_start);
+
+	simMoveEncoder(&htim1,(rand() % 3) - 1);
+	simAdvanceMicros(PROBE_SIM_PASS_US);
+}
+
+static void reportProbeSim(void) {
+
+	printf("    probe        runs      min cycles  mean cycles  max cycles   mean (us)  histogram (runs under 2^%d cycles, then per power of 2)\n",
+			PROBE_BUCKET_SHIFT+1);
+	for(int id=0; id < NUM_PROBES; id++) {
+		const PROBE_STATS * st = probeGetStats(id);
+		if(st->runs == 0) {
+			continue;
+		}
+		double mean = (double)st->total/st->runs;
+		printf("    %-11s %8u %11u %12.0f %11u %11.2f  ",probeName(id),st->runs,st->min,mean,st->max,probeCyclesToUs(mean));
+		for(int n=0; n < PROBE_BUCKETS; n++) {
+			printf((st->hist[n] > 0)?" %u":" .",st->hist[n]);
+		}
+		printf("\n");
+	}
+
+	// packet sent for UI_OP_PROBE
+	uint8_t packet[PROBE_PACKET_SIZE];
+	PROBE_ID id;
+	PROBE_STATS out;
+	int len = probeEncode(PROBE_MOTORS,packet);
+	const PROBE_STATS * st = probeGetStats(PROBE_MOTORS);
+	bool ok = probeDecode(packet,len,&id,&out) && id == PROBE_MOTORS && out.runs == st->runs && out.max == st->max &&
+			memcmp(out.hist,st->hist,sizeof(out.hist)) == 0;
+	printf("    probe packet %d bytes, decode %s\n",len,ok?"ok":"FAILED");
+
+	// cost of an empty probe (reading the host clock twice, on the robot it is two reads of CYCCNT)
+	probeReset(PROBE_CONTROLER);
+	for(int n=0; n < PROBE_OVERHEAD_RUNS; n++) {
+		PROBE(PROBE_CONTROLER,);
+	}
+	st = probeGetStats(PROBE_CONTROLER);
+	printf("    empty probe %.0f cycles (min %u) on the host clock\n",(double)st->total/st->runs,st->min);
+	probeReset(PROBE_CONTROLER);
+
+	STOP();
+}
+
+// fast maths against libm, the inputs sweep the range each function is used over
+#define FM_GOLDEN 0.6180339887498949 // spreads the samples evenly over each range
+
+static float fmInput(uint32_t i, float min, float max) {
+	double f = (double)i*FM_GOLDEN;
+	return min + (max - min)*(float)(f - floor(f));
+}
+
+static void runFastSinCos(uint32_t i) {
+	float s, c;
+	fastSinCos(fmInput(i,-FM_PI,FM_PI),&s,&c);
+	sink_f = s + c;
+}
+
+static void runLibmSinCos(uint32_t i) {
+	float x = fmInput(i,-FM_PI,FM_PI);
+	sink_f = sinf(x) + cosf(x);
+}
+
+// max errors of each function over its range
+#define FM_CHECKS 2
+static const char * fm_check_names[FM_CHECKS] = { "fastSinCos |x|<=2pi", "fastSinCos |x|<=1000" };
+static const char * fm_check_units[FM_CHECKS] = { "abs", "abs" };
+static double fm_max_err[FM_CHECKS];
+
+static void setupFastMath(void) {
+	memset(fm_max_err,0,sizeof(fm_max_err));
+}
+
+static void fmError(int check, double err) {
+	err = fabs(err);
+	if(err > fm_max_err[check]) {
+		fm_max_err[check] = err;
+	}
+}
+
+static void runFastMath(uint32_t i) {
+
+	float s, c;
+
+	float x = fmInput(i,-2.0f*FM_PI,2.0f*FM_PI);
+	fastSinCos(x,&s,&c);
+	fmError(0,fmax(fabs(s - sin(x)),fabs(c - cos(x))));
+
+	x = fmInput(i,-1000.0f,1000.0f);
+	fastSinCos(x,&s,&c);
+	fmError(1,fmax(fabs(s - sin(x)),fabs(c - cos(x))));
+}
+
+static void reportFastMath(void) {
+
+	printf("    function               max error\n");
+	for(int n=0; n < FM_CHECKS; n++) {
+		printf("    %-22s %9.2e %s\n",fm_check_names[n],fm_max_err[n],fm_check_units[n]);
+	}
+}
+
+// IR sensor calibration tables against the fitted curves they were made from (dist = a * volts^b + c)
+// each iteration checks one ADC code on both sensors, codes whose curve distance is outside the sensor's
+// valid range are not scored (they read as NAN), the limit is the telemetry resolution (0.1cm)
+#define IR_CODES (1 << IR_ADC_BITS)
+#define IR_TABLE_TOL 0.1
+
+typedef struct IR_CHECK_t {
+	const char * name;
+	const IR_TABLE * table;
+	float a, b, c;
+	float min, max;   // valid range (cm)
+	double max_err;   // table vs curve (cm)
+	float max_err_at; // distance of the largest error
+	uint32_t codes;   // codes in the valid range checked
+} IR_CHECK;
+
+static IR_CHECK ir_checks[NUM_IR_SENSORS] = {
+	{ "long range",  &ir_table_long,  LR_A, LR_B, LR_C, MIN_LR, MAX_LR },
+	{ "short range", &ir_table_short, SR_A, SR_B, SR_C, MIN_SR, MAX_SR },
+};
+static bool ir_code_seen[IR_CODES];
+
+static void runIRTableDistance(uint32_t i) {
+	sink_f = irTableDistance(&ir_table_long,(i*2654435761u) >> (32 - IR_ADC_BITS));
+}
+
+static void setupIRTable(void) {
+	for(int s=0; s < NUM_IR_SENSORS; s++) {
+		ir_checks[s].max_err = 0.0;
+		ir_checks[s].max_err_at = 0.0f;
+		ir_checks[s].codes = 0;
+	}
+	memset(ir_code_seen,0,sizeof(ir_code_seen));
+}
+
+static void runIRTable(uint32_t i) {
+
+	uint32_t code = i % IR_CODES;
+	if(ir_code_seen[code]) {
+		return;
+	}
+	ir_code_seen[code] = true;
+
+	for(int s=0; s < NUM_IR_SENSORS; s++) {
+		IR_CHECK * chk = &ir_checks[s];
+		float v = (float)code*IR_ADC_SCALE;
+		double d = chk->a*pow(v,chk->b) + chk->c;
+		if(!(d >= chk->min && d <= chk->max)) {
+			continue;
+		}
+
+		double err = fabs(irTableDistance(chk->table,code) - d);
+		if(err > chk->max_err) {
+			chk->max_err = err;
+			chk->max_err_at = (float)d;
+		}
+		chk->codes++;
+	}
+}
+
+static void reportIRTable(void) {
+
+	printf("    sensor        range cm   codes  table max err  (limit %.2fcm)\n",IR_TABLE_TOL);
+	for(int s=0; s < NUM_IR_SENSORS; s++) {
+		IR_CHECK * chk = &ir_checks[s];
+		printf("    %-12s %4.0f-%-4.0f  %5u  %8.4fcm at %5.1fcm  %s\n",chk->name,chk->min,chk->max,chk->codes,
+				chk->max_err,chk->max_err_at,(chk->codes > 0 && chk->max_err <= IR_TABLE_TOL)?"PASS":"FAIL");
+		printf("                 table: %s\n",chk->table->source);
+	}
+	printf("    table size %u entries (%u bytes of flash per sensor)\n",IR_TABLE_SIZE,(unsigned)sizeof(((IR_TABLE *)0)->dist));
+}
+
+// drive the right encoder with synthetic edges from a wheel turning at a set of true speeds (with a 5% 3Hz
+// ripple), 1 iteration = 1 PID period, and compare the velocity estimates with the true speed
+// the original estimator (counts in the period averaged with the last period) is computed alongside
+#define ENC_SIM_SPEEDS   7
+#define ENC_SIM_PERIODS  100 // PID periods at each speed
+#define ENC_SIM_SETTLE   5   // periods after a speed change that are not scored
+#define ENC_SIM_RIPPLE   0.05f
+#define ENC_SIM_RIPPLE_HZ 3.0f
+
+static const float enc_sim_speeds[ENC_SIM_SPEEDS] = { 0.5f, 1.0f, 2.86f, -2.86f, 5.0f, 10.0f, 15.0f }; // rad/s (2.86 = 0.1m/s)
+
+static double enc_sim_pos;       // true wheel position (counts)
+static int32_t enc_sim_count;    // counts output to the timer
+static int32_t enc_sim_last_count;
+static int32_t enc_sim_last_diff;
+static float enc_sim_w;          // true speed at the end of the period
+
+static struct {
+	double sq_m, sq_mt; // sum of squared errors
+	float max_m, max_mt;
+	uint32_t n;
+} enc_sim_err[ENC_SIM_SPEEDS];
+
+static void setupEncoderSim(void) {
+	setupSim();
+	schedInit();
+	enc_right.state.vel = 0.0f;
+	enc_right.edge_valid = false;
+	encoderReset(&enc_right);
+	enc_sim_pos = 0.0;
+	enc_sim_count = 0;
+	enc_sim_last_count = 0;
+	enc_sim_last_diff = 0;
+	memset(enc_sim_err,0,sizeof(enc_sim_err));
+}
+
+// turn the wheel at w rad/s for 1ms, stepping the encoder at the exact time of each count
+static void encSimMs(float w) {
+
+	double step = w/ENCODER_RAD_PER_COUNT*1.0e-3; // counts this ms
+	double start = enc_sim_pos;
+	double end = enc_sim_pos + step;
+	uint32_t t=0;
+
+	while(step != 0.0) {
+		double next = (step > 0.0)?floor(enc_sim_pos)+1.0:ceil(enc_sim_pos)-1.0;
+		if((step > 0.0)?(next > end):(next < end)) {
+			break;
+		}
+		uint32_t tc = (uint32_t)((next-start)/step*1000.0);
+		simAdvanceMicros(tc-t);
+		t = tc;
+		simMoveEncoder(&htim1,(step > 0.0)?1:-1);
+		enc_sim_count += (step > 0.0)?1:-1;
+		enc_sim_pos = next;
+	}
+
+	simAdvanceMicros(1000-t);
+	enc_sim_pos = end;
+}
+
+static void runEncoderSim(uint32_t i) {
+
+	int s = (i/ENC_SIM_PERIODS) % ENC_SIM_SPEEDS;
+	float w0 = enc_sim_speeds[s];
+
+	for(int ms=0; ms < (int)(BENCH_DT*1000.0f); ms++) {
+		enc_sim_w = w0*(1.0f + ENC_SIM_RIPPLE*sinf(2.0f*(float)M_PI*ENC_SIM_RIPPLE_HZ*simMicros()*1.0e-6f));
+		encSimMs(enc_sim_w);
+	}
+
+	updateEncoder(&enc_right);
+
+	int32_t diff = enc_sim_count - enc_sim_last_count;
+	float vel_m = ENCODER_VEL_SCALE*(float)(diff + enc_sim_last_diff)/2.0f; // original estimator
+	enc_sim_last_count = enc_sim_count;
+	enc_sim_last_diff = diff;
+
+	if((i % ENC_SIM_PERIODS) >= ENC_SIM_SETTLE) {
+		float err_m = fabsf(vel_m - enc_sim_w);
+		float err_mt = fabsf(enc_right.state.vel - enc_sim_w);
+		enc_sim_err[s].sq_m += err_m*err_m;
+		enc_sim_err[s].sq_mt += err_mt*err_mt;
+		if(err_m > enc_sim_err[s].max_m) {
+			enc_sim_err[s].max_m = err_m;
+		}
+		if(err_mt > enc_sim_err[s].max_mt) {
+			enc_sim_err[s].max_mt = err_mt;
+		}
+		enc_sim_err[s].n++;
+	}
+}
+
+static void reportEncoderSim(void) {
+
+	printf("    speed(rad/s) counts/period  rms error M / M-T (rad/s)  max error M / M-T (rad/s)\n");
+	for(int s=0; s < ENC_SIM_SPEEDS; s++) {
+		if(enc_sim_err[s].n == 0) {
+			continue;
+		}
+		printf("    %8.2f %12.1f %14.3f / %-8.3f %14.3f / %-8.3f\n",enc_sim_speeds[s],
+				enc_sim_speeds[s]*BENCH_DT/ENCODER_RAD_PER_COUNT,
+				sqrt(enc_sim_err[s].sq_m/enc_sim_err[s].n),sqrt(enc_sim_err[s].sq_mt/enc_sim_err[s].n),
+				enc_sim_err[s].max_m,enc_sim_err[s].max_mt);
+	}
+}
+
+// hammer the encoder count wrap boundaries
+// both wheels start just below the count where their timer wraps (32 bits for TIM2, 16 bits for TIM1) and move
+// back and forth across it with small random moves, with a large move (more than the 20000 counts the original
+// 16 bit wrap check allowed between updates) every ENC_WRAP_BIG_EVERY updates. The tick count must match the
+// true movement exactly after every update. The original wrap check is run alongside for comparison.
+#define ENC_WRAP_START     16     // counts below the wrap the wheels start at
+#define ENC_WRAP_JITTER    40     // largest small move (counts)
+#define ENC_WRAP_BIG_EVERY 256    // updates between large moves
+#define ENC_WRAP_BIG_MIN   20001  // size of the large moves (counts)
+#define ENC_WRAP_BIG_MAX   40000
+#define ENC_DRIFT_UPDATES  180000 // 1 hour of updates at 50Hz
+#define ENC_DRIFT_COUNTS   55     // counts per update at 0.5m/s
+
+typedef struct ENC_WRAP_SIM_t {
+	ENCODER * enc;
+	TIM_HandleTypeDef * htim;
+	const char * name;
+	int64_t start;      // timer count at the start
+	int64_t true_pos;   // true movement since the start (counts)
+	int16_t old_last;   // state of the original 16 bit wrap check
+	int64_t old_ticks;
+	uint32_t updates;
+	uint32_t wraps;      // updates in which the timer wrapped
+	uint32_t errors;     // updates where the tick count did not match the true movement
+	uint32_t old_errors; // same for the original wrap check
+} ENC_WRAP_SIM;
+
+static ENC_WRAP_SIM enc_wrap[2];
+
+static int64_t floorDiv(int64_t a, int64_t b) {
+	return (a >= 0)?a/b:(a - b + 1)/b;
+}
+
+static void setupEncoderWrap(void) {
+
+	setupSim();
+	srand(1);
+
+	enc_wrap[0] = (ENC_WRAP_SIM){ &enc_left, &htim2, "left (TIM2, 32 bit)" };
+	enc_wrap[1] = (ENC_WRAP_SIM){ &enc_right, &htim1, "right (TIM1, 16 bit)" };
+
+	for(int w=0; w < 2; w++) {
+		ENC_WRAP_SIM * sim = &enc_wrap[w];
+		simMoveEncoder(sim->htim,-ENC_WRAP_START); // underflows to just below the wrap
+		encoderReset(sim->enc);
+		sim->start = (int64_t)__HAL_TIM_GET_COUNTER(sim->htim);
+		sim->old_last = (int16_t)(sim->enc->dir*(int16_t)__HAL_TIM_GET_COUNTER(sim->htim));
+	}
+}
+
+static void runEncoderWrap(uint32_t i) {
+
+	for(int w=0; w < 2; w++) {
+		ENC_WRAP_SIM * sim = &enc_wrap[w];
+		ENCODER * enc = sim->enc;
+		int64_t range = (int64_t)__HAL_TIM_GET_AUTORELOAD(sim->htim) + 1;
+		int32_t move;
+
+		if(i % ENC_WRAP_BIG_EVERY == 0) {
+			move = ENC_WRAP_BIG_MIN + rand() % (ENC_WRAP_BIG_MAX - ENC_WRAP_BIG_MIN + 1);
+			if(rand() & 1) {
+				move = -move;
+			}
+		}
+		else { // random move that drifts back across the wrap
+			move = rand() % (2*ENC_WRAP_JITTER + 1) - ENC_WRAP_JITTER - (int32_t)((sim->true_pos - ENC_WRAP_START)/4);
+		}
+
+		int64_t before = floorDiv(sim->start + sim->true_pos,range);
+		simMoveEncoder(sim->htim,move);
+		sim->true_pos += move;
+		updateEncoder(enc);
+
+		sim->updates++;
+		if(floorDiv(sim->start + sim->true_pos,range) != before) {
+			sim->wraps++;
+		}
+		if(enc->ticks != enc->dir*sim->true_pos || enc->state.pos != (float)enc->ticks*ENCODER_DIST_SCALE) {
+			sim->errors++;
+		}
+
+		// original wrap check
+		int16_t pos16 = (int16_t)(enc->dir*(int16_t)__HAL_TIM_GET_COUNTER(sim->htim));
+		int32_t diff = (int32_t)pos16 - sim->old_last;
+		if(abs(sim->old_last) > 20000) {
+			if(pos16 < 0 && sim->old_last >= 0) {
+				diff += (int32_t)0x10000;
+			}
+			else if(pos16 >= 0 && sim->old_last < 0) {
+				diff -= (int32_t)0x10000;
+			}
+		}
+		sim->old_last = pos16;
+		sim->old_ticks += diff;
+		if(sim->old_ticks != enc->dir*sim->true_pos) {
+			sim->old_errors++;
+			sim->old_ticks = enc->dir*sim->true_pos; // count each error once
+		}
+	}
+}
+
+static void reportEncoderWrap(void) {
+
+	for(int w=0; w < 2; w++) {
+		ENC_WRAP_SIM * sim = &enc_wrap[w];
+		printf("    %-22s updates=%u wraps=%u tick errors=%u %s (original 16 bit wrap check errors=%u)\n",sim->name,
+				sim->updates,sim->wraps,sim->errors,(sim->errors == 0)?"PASS":"FAIL",sim->old_errors);
+	}
+
+	// position error after a long run, accumulating the float distance each update vs converting the tick count
+	float acc_pos = 0.0f;
+	int64_t ticks = 0;
+	for(int n=0; n < ENC_DRIFT_UPDATES; n++) {
+		acc_pos += ENC_DRIFT_COUNTS*ENCODER_DIST_SCALE;
+		ticks += ENC_DRIFT_COUNTS;
+	}
+	double exact = (double)ticks/5456.740906;
+	printf("    1 hour at 0.5m/s (%.0fm): position error accumulated %.1fmm, from ticks %.3fmm\n",exact,
+			(acc_pos - exact)*1.0e3,((float)ticks*ENCODER_DIST_SCALE - exact)*1.0e3);
+}
+
+// replay scripted wheel tick sequences through updateMotors() and report the odometry closure error
+// each path drives out and then retraces its steps backwards, so the wheels return to their starting ticks and the
+// true pose is back at the origin. The original odometry (filtered wheel speeds times DT, heading updated before
+// the x/y step, float) is run alongside on the same encoder states for comparison.
+#define ODOM_PATHS          3
+#define ODOM_RANDOM_UPDATES 5000 // 100s out and 100s back
+#define ODOM_RANDOM_MAX     60   // largest random wheel move per update (counts, ~0.55m/s)
+#define ODOM_LONG_UPDATES   180000 // straight run of 1 hour
+#define ODOM_LONG_COUNTS    55       // wheel counts per update on the straight run (~0.5m/s)
+#define ODOM_WHEEL_BASE     0.087f      // as motors.c
+#define ODOM_WHEEL_RADIUS   (0.070f/2.0f)
+
+static const struct {
+	const char * name;
+	int updates;    // updates out (the same number back)
+	int16_t left;   // wheel counts per update going out (0,0 for a random path)
+	int16_t right;
+} odom_paths[ODOM_PATHS] = {
+	{ "arc 1.2m and back",      200, 50, 62  },
+	{ "spin 10 turns and back", 373, -40, 40 },
+	{ "random 100s and back",   ODOM_RANDOM_UPDATES, 0, 0 },
+};
+
+static int16_t odom_random[ODOM_RANDOM_UPDATES][2];
+static int odom_path;     // current path
+static int odom_update;   // update within the path
+static float odom_old_x, odom_old_y, odom_old_h; // original odometry
+static struct {
+	float err_xy, err_h;         // largest closure error (m, rad)
+	float old_err_xy, old_err_h; // same for the original odometry
+	uint32_t runs;
+} odom_err[ODOM_PATHS];
+
+static void oldPose(void) {
+	float dl = enc_left.state.vel*BENCH_DT*ODOM_WHEEL_RADIUS;
+	float dr = enc_right.state.vel*BENCH_DT*ODOM_WHEEL_RADIUS;
+	float d = (dl+dr)/2.0f;
+	odom_old_h += (dr-dl)/ODOM_WHEEL_BASE;
+	if(odom_old_h > (float)M_PI) {
+		odom_old_h -= 2.0f*(float)M_PI;
+	}
+	else if(odom_old_h <= -(float)M_PI) {
+		odom_old_h += 2.0f*(float)M_PI;
+	}
+	odom_old_x += d*cosf(odom_old_h);
+	odom_old_y += d*sinf(odom_old_h);
+}
+
+static void setupOdometry(void) {
+	setupSim();
+	srand(1);
+	for(int n=0; n < ODOM_RANDOM_UPDATES; n++) {
+		odom_random[n][0] = (int16_t)(rand() % (2*ODOM_RANDOM_MAX + 1) - ODOM_RANDOM_MAX);
+		odom_random[n][1] = (int16_t)(rand() % (2*ODOM_RANDOM_MAX + 1) - ODOM_RANDOM_MAX);
+	}
+	odom_path = 0;
+	odom_update = 0;
+	memset(odom_err,0,sizeof(odom_err));
+}
+
+static void runOdometry(uint32_t i) {
+
+	int n = odom_paths[odom_path].updates;
+	int k = (odom_update < n)?odom_update:2*n - 1 - odom_update; // step to replay, backwards on the way back
+	int sign = (odom_update < n)?1:-1;
+	int32_t left = odom_paths[odom_path].left;
+	int32_t right = odom_paths[odom_path].right;
+
+	if(odom_update == 0) {
+		resetPose();
+		odom_old_x = odom_old_y = odom_old_h = 0.0f;
+	}
+	if(left == 0 && right == 0) {
+		left = odom_random[k][0];
+		right = odom_random[k][1];
+	}
+
+	simMoveEncoder(&htim2,-sign*left); // left encoder counts down going forwards
+	simMoveEncoder(&htim1,sign*right);
+	simAdvanceMicros((uint32_t)(BENCH_DT*1.0e6f));
+	updateEncoder(&enc_left); // as the speed loop would
+	updateEncoder(&enc_right);
+	sink_i = updateMotors(true,BENCH_DT);
+	oldPose();
+
+	if(++odom_update == 2*n) { // back at the start
+		POSE pose;
+		getPose(&pose);
+		float err_xy = hypotf(pose.x,pose.y);
+		float old_err_xy = hypotf(odom_old_x,odom_old_y);
+		odom_err[odom_path].err_xy = fmaxf(odom_err[odom_path].err_xy,err_xy);
+		odom_err[odom_path].err_h = fmaxf(odom_err[odom_path].err_h,fabsf(pose.heading));
+		odom_err[odom_path].old_err_xy = fmaxf(odom_err[odom_path].old_err_xy,old_err_xy);
+		odom_err[odom_path].old_err_h = fmaxf(odom_err[odom_path].old_err_h,fabsf(odom_old_h));
+		odom_err[odom_path].runs++;
+		odom_update = 0;
+		odom_path = (odom_path + 1) % ODOM_PATHS;
+	}
+}
+
+static void reportOdometry(void) {
+	printf("    path                      runs  closure error ticks/arc       original\n");
+	for(int p=0; p < ODOM_PATHS; p++) {
+		if(odom_err[p].runs == 0) {
+			continue;
+		}
+		printf("    %-24s %5u %9.3fmm %8.4fdeg %9.1fmm %8.2fdeg\n",odom_paths[p].name,odom_err[p].runs,
+				odom_err[p].err_xy*1.0e3f,odom_err[p].err_h*180.0f/(float)M_PI,
+				odom_err[p].old_err_xy*1.0e3f,odom_err[p].old_err_h*180.0f/(float)M_PI);
+	}
+
+	// the pose x and y are float sums, check their rounding does not build up on a long run against a plain float sum
+	resetPose();
+	float plain_x = 0.0f;
+	for(int n=0; n < ODOM_LONG_UPDATES; n++) {
+		simMoveEncoder(&htim2,-ODOM_LONG_COUNTS);
+		simMoveEncoder(&htim1,ODOM_LONG_COUNTS);
+		simAdvanceMicros((uint32_t)(BENCH_DT*1.0e6f));
+		updateEncoder(&enc_left);
+		updateEncoder(&enc_right);
+		sink_i = updateMotors(true,BENCH_DT);
+		plain_x += (float)ODOM_LONG_COUNTS*ENCODER_DIST_SCALE;
+	}
+	POSE pose;
+	getPose(&pose);
+	double exact = (double)ODOM_LONG_UPDATES*ODOM_LONG_COUNTS*ENCODER_DIST_SCALE;
+	printf("    straight %.0fs (%.0fm): x error %.3fmm, heading %.4fdeg (plain float sum %.1fmm) %s\n",
+			ODOM_LONG_UPDATES*BENCH_DT,exact,(pose.x - exact)*1.0e3,pose.heading*180.0f/(float)M_PI,(plain_x - exact)*1.0e3,
+			(fabs(pose.x - exact) < 1.0e-3 && pose.heading == 0.0f)?"PASS":"FAIL");
+}
+
+// drive the robot through driveTo and turnTo moves against a motor model (PID_PLANT_* with the deadband, stepped every 1ms,
+// coasting down when the PWM is off) with four move types:
+//   original - constant speed, STOP() at the first PID update past the target (as driveTo/turnTo used to)
+//   original slow - the same at 1/MOVE_SIM_SLOW of the speed, for about the accuracy of the profiled moves
+//   trapezoid - motion profile with the acceleration limits and no jerk limit
+//   s-curve   - motion profile with the default acceleration and jerk limits
+// each move runs for MOVE_SIM_UPDATES, and the last run of each reports the time to the end of the move (the STOP),
+// the time until the wheels came to rest, the overshoot and the final error
+#define MOVE_SIM_MOVES    5
+#define MOVE_SIM_TYPES    4
+#define MOVE_SIM_UPDATES  500   // 10s per move
+#define MOVE_SIM_SLOW     4.0f
+#define MOVE_SIM_REST     0.05f // wheel speed taken as stopped (rad/s)
+#define MOVE_SIM_LIN_ACC  1.0f  // as MOVE_LIN_ACC etc in motors.c
+#define MOVE_SIM_LIN_JERK 20.0f
+#define MOVE_SIM_ANG_ACC  12.0f
+#define MOVE_SIM_ANG_JERK 240.0f
+
+static const struct {
+	const char * name;
+	bool turn;
+	float target; // m or rad
+	float vel;    // m/s or rad/s
+} move_sim_moves[MOVE_SIM_MOVES] = {
+	{ "driveTo 0.1m",      false, 0.1f,           0.3f                  },
+	{ "driveTo 0.5m",      false, 0.5f,           0.3f                  },
+	{ "driveTo -1.0m",     false, -1.0f,          MAX_LIN_VEL           },
+	{ "turnTo 90deg",      true,  (float)M_PI/2.0f, (float)M_PI         }, // MAX_ANG_VEL/2
+	{ "turnTo -180deg",    true,  -(float)M_PI,   2.0f*(float)M_PI      }, // MAX_ANG_VEL
+};
+static const char * const move_sim_types[MOVE_SIM_TYPES] = { "original", "orig slow", "trapezoid", "s-curve" };
+
+static int move_sim_trial;       // move*MOVE_SIM_TYPES + type
+static int move_sim_update;      // update within the trial
+static float move_sim_w[2];      // motor model wheel speeds, left and right (rad/s)
+static float move_sim_counts[2]; // fractional counts not yet output to the encoders
+static float move_sim_heading;   // unwrapped heading (rad)
+static float move_sim_last_heading;
+static bool move_sim_stopped;    // original move has been stopped
+static float move_sim_gain[2] = { PID_PLANT_GAIN, PID_PLANT_GAIN };         // motor model of each wheel
+static float move_sim_deadband[2] = { PID_PLANT_DEADBAND, PID_PLANT_DEADBAND };
+static float move_sim_load[2];   // load on each wheel, as the speed it takes off the wheel at the same duty (rad/s)
+typedef struct MOVE_SIM_RESULT_t {
+	float t_done;   // time the move ended (s)
+	float t_rest;   // time the wheels came to rest after the move ended (s)
+	float overshoot;
+	float error;    // final error
+	uint32_t runs;
+} MOVE_SIM_RESULT;
+static MOVE_SIM_RESULT move_sim_run; // the move running
+static MOVE_SIM_RESULT move_sim_result[MOVE_SIM_MOVES*MOVE_SIM_TYPES]; // last run of each move
+
+// distance (m) or angle (rad) moved towards the target
+static float moveSimMoved(int m) {
+	POSE pose;
+	getPose(&pose);
+	float moved = move_sim_moves[m].turn?move_sim_heading:pose.x; // starts at the origin heading along x
+	return (move_sim_moves[m].target < 0.0f)?-moved:moved;
+}
+
+// run the motor model for 1ms
+// the time is advanced to each encoder count in turn, so the A channel edges are timed as the wheels turn
+// (the speed loop uses the edge times for its velocity estimate)
+static void moveSimMs(void) {
+
+	float duty[2] = {
+		((float)__HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_1) - (float)__HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_2))/MTR_PWM_PERIOD,
+		((float)__HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_4) - (float)__HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_3))/MTR_PWM_PERIOD
+	};
+
+	for(int w=0; w < 2; w++) {
+		float drive = 0.0f;
+		if(duty[w] > move_sim_deadband[w]) {
+			drive = duty[w] - move_sim_deadband[w];
+		}
+		else if(duty[w] < -move_sim_deadband[w]) {
+			drive = duty[w] + move_sim_deadband[w];
+		}
+		move_sim_w[w] += (move_sim_gain[w]*drive - move_sim_load[w] - move_sim_w[w])*(1.0e-3f/PID_PLANT_TAU);
+	}
+
+	float rate[2] = { // counts per us
+		move_sim_w[0]*1.0e-6f/ENCODER_RAD_PER_COUNT,
+		move_sim_w[1]*1.0e-6f/ENCODER_RAD_PER_COUNT
+	};
+
+	uint32_t us = 0;
+	while(us < 1000) {
+
+		uint32_t step = 1000 - us; // time to the next count of either wheel, or the end of the ms
+		for(int w=0; w < 2; w++) {
+			if(rate[w] != 0.0f) {
+				float t = (((rate[w] > 0.0f)?1.0f:-1.0f) - move_sim_counts[w])/rate[w];
+				if(t < (float)step) {
+					step = (t < 1.0f)?1:(uint32_t)ceilf(t);
+				}
+			}
+		}
+
+		simAdvanceMicros(step);
+		us += step;
+
+		for(int w=0; w < 2; w++) {
+			move_sim_counts[w] += rate[w]*(float)step;
+			int32_t counts = (int32_t)move_sim_counts[w];
+			if(counts != 0) {
+				move_sim_counts[w] -= (float)counts;
+				if(w == 0) {
+					simMoveEncoder(&htim2,-counts); // left encoder counts down going forwards
+				}
+				else {
+					simMoveEncoder(&htim1,counts);
+				}
+			}
+		}
+	}
+}
+
+// stop and reset the robot, the controllers and the pose ready to start a move
+static void moveSimStart(void) {
+	STOP();
+	memset(&pid_left.state,0,sizeof(pid_left.state));
+	memset(&pid_right.state,0,sizeof(pid_right.state));
+	move_sim_w[0] = move_sim_w[1] = 0.0f;
+	resetPose();
+}
+
+// run the motor model and encoders for one PID period, then update the motors
+static MotorEvent moveSimUpdate(void) {
+	for(int ms=0; ms < 20; ms++) {
+		moveSimMs();
+	}
+	return updateMotors(true,BENCH_DT);
+}
+
+static void setupMoveSim(void) {
+	setupSim();
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	schedInit();
+	move_sim_gain[0] = move_sim_gain[1] = PID_PLANT_GAIN;
+	move_sim_deadband[0] = move_sim_deadband[1] = PID_PLANT_DEADBAND;
+	move_sim_load[0] = move_sim_load[1] = 0.0f;
+	move_sim_trial = 0;
+	move_sim_update = 0;
+	memset(move_sim_result,0,sizeof(move_sim_result));
+}
+
+static void runMoveSim(uint32_t i) {
+
+	int m = move_sim_trial/MOVE_SIM_TYPES;
+	int type = move_sim_trial%MOVE_SIM_TYPES;
+	float t = (float)(move_sim_update + 1)*BENCH_DT;
+
+	if(move_sim_update == 0) { // start the move from rest
+		moveSimStart();
+		move_sim_heading = move_sim_last_heading = 0.0f;
+		move_sim_stopped = false;
+		memset(&move_sim_run,0,sizeof(move_sim_run));
+
+		if(type <= 1) {
+			float dir = (move_sim_moves[m].target < 0.0f)?-1.0f:1.0f;
+			if(type == 1) {
+				dir /= MOVE_SIM_SLOW;
+			}
+			if(move_sim_moves[m].turn) {
+				drive(0.0f,dir*move_sim_moves[m].vel);
+			}
+			else {
+				drive(dir*move_sim_moves[m].vel,0.0f);
+			}
+		}
+		else {
+			setMoveLimits(MOVE_SIM_LIN_ACC,(type == 3)?MOVE_SIM_LIN_JERK:0.0f,MOVE_SIM_ANG_ACC,(type == 3)?MOVE_SIM_ANG_JERK:0.0f);
+			if(move_sim_moves[m].turn) {
+				turnTo(move_sim_moves[m].target,move_sim_moves[m].vel);
+			}
+			else {
+				driveTo(move_sim_moves[m].target,move_sim_moves[m].vel);
+			}
+		}
+	}
+
+	MotorEvent event = moveSimUpdate();
+
+	POSE pose;
+	getPose(&pose);
+	move_sim_heading += remainderf(pose.heading - move_sim_last_heading,2.0f*(float)M_PI);
+	move_sim_last_heading = pose.heading;
+
+	float target = fabsf(move_sim_moves[m].target);
+	float moved = moveSimMoved(m);
+	if(type <= 1 && !move_sim_stopped && moved >= target) { // original move, stop once past the target
+		STOP();
+		event = move_sim_moves[m].turn?ME_DONE_TURN:ME_DONE_DRIVE;
+		move_sim_stopped = true;
+	}
+
+	if(event & (ME_DONE_DRIVE | ME_DONE_TURN)) {
+		move_sim_run.t_done = t;
+	}
+	if(move_sim_run.t_done > 0.0f && move_sim_run.t_rest == 0.0f && fabsf(move_sim_w[0]) < MOVE_SIM_REST && fabsf(move_sim_w[1]) < MOVE_SIM_REST) {
+		move_sim_run.t_rest = t;
+	}
+	if(moved - target > move_sim_run.overshoot) {
+		move_sim_run.overshoot = moved - target;
+	}
+
+	if(++move_sim_update == MOVE_SIM_UPDATES) {
+		move_sim_run.error = moved - target;
+		move_sim_run.runs = move_sim_result[move_sim_trial].runs + 1;
+		move_sim_result[move_sim_trial] = move_sim_run;
+		move_sim_update = 0;
+		move_sim_trial = (move_sim_trial + 1)%(MOVE_SIM_MOVES*MOVE_SIM_TYPES);
+		setMoveLimits(MOVE_SIM_LIN_ACC,MOVE_SIM_LIN_JERK,MOVE_SIM_ANG_ACC,MOVE_SIM_ANG_JERK);
+	}
+}
+
+static void reportMoveSim(void) {
+	printf("    move             type        end(s) at rest(s)  overshoot  final error\n");
+	for(int r=0; r < MOVE_SIM_MOVES*MOVE_SIM_TYPES; r++) {
+		int m = r/MOVE_SIM_TYPES;
+		if(move_sim_result[r].runs == 0) {
+			continue;
+		}
+		float scale = move_sim_moves[m].turn?180.0f/(float)M_PI:1.0e3f;
+		const char * units = move_sim_moves[m].turn?"deg":"mm ";
+		printf("    %-16s %-10s %7.2f %9.2f %9.2f%s %9.2f%s\n",move_sim_moves[m].name,move_sim_types[r%MOVE_SIM_TYPES],
+				move_sim_result[r].t_done,move_sim_result[r].t_rest,move_sim_result[r].overshoot*scale,units,
+				move_sim_result[r].error*scale,units);
+	}
+}
+
+// drive straight with mismatched motors (the right one weaker, with more friction) using the move sim motor model,
+// with the heading hold off, holding the heading only, and holding the heading and the line (cross track error)
+// each drive runs for HOLD_SIM_UPDATES, and the last run of each reports the largest and final lateral error
+// from the line and the final heading error
+#define HOLD_SIM_MOVES   2
+#define HOLD_SIM_TYPES   3
+#define HOLD_SIM_UPDATES 300 // 6s per move
+#define HOLD_SIM_KH      6.0f  // as MOVE_HOLD_KH and MOVE_HOLD_KY in motors.c
+#define HOLD_SIM_KY      40.0f
+
+static const struct {
+	const char * name;
+	float dist; // m
+	float vel;  // m/s
+} hold_sim_moves[HOLD_SIM_MOVES] = {
+	{ "driveTo 1.5m at 0.3m/s",   1.5f, 0.3f },
+	{ "driveTo -1.5m at 0.5m/s", -1.5f, 0.5f },
+};
+static const char * const hold_sim_types[HOLD_SIM_TYPES] = { "off", "heading", "heading+line" };
+
+static int hold_sim_trial;  // move*HOLD_SIM_TYPES + type
+static int hold_sim_update; // update within the trial
+typedef struct HOLD_SIM_RESULT_t {
+	float t_done;      // time the move ended (s)
+	float max_lateral; // largest distance from the line (m)
+	float lateral;     // final distance from the line (m)
+	float heading;     // final heading error (rad)
+	uint32_t runs;
+} HOLD_SIM_RESULT;
+static HOLD_SIM_RESULT hold_sim_run;
+static HOLD_SIM_RESULT hold_sim_result[HOLD_SIM_MOVES*HOLD_SIM_TYPES];
+
+static void setupHoldSim(void) {
+	setupMoveSim();
+	move_sim_gain[1] = 0.8f*PID_PLANT_GAIN;
+	move_sim_deadband[1] = 1.6f*PID_PLANT_DEADBAND;
+	hold_sim_trial = 0;
+	hold_sim_update = 0;
+	memset(hold_sim_result,0,sizeof(hold_sim_result));
+}
+
+static void runHoldSim(uint32_t i) {
+
+	int m = hold_sim_trial/HOLD_SIM_TYPES;
+	int type = hold_sim_trial%HOLD_SIM_TYPES;
+
+	if(hold_sim_update == 0) {
+		moveSimStart();
+		memset(&hold_sim_run,0,sizeof(hold_sim_run));
+		setHeadingHold((type > 0)?HOLD_SIM_KH:0.0f,(type > 1)?HOLD_SIM_KY:0.0f);
+		driveTo(hold_sim_moves[m].dist,hold_sim_moves[m].vel);
+	}
+
+	MotorEvent event = moveSimUpdate();
+
+	POSE pose;
+	getPose(&pose);
+	if(event & ME_DONE_DRIVE) {
+		hold_sim_run.t_done = (float)(hold_sim_update + 1)*BENCH_DT;
+	}
+	if(fabsf(pose.y) > hold_sim_run.max_lateral) {
+		hold_sim_run.max_lateral = fabsf(pose.y);
+	}
+
+	if(++hold_sim_update == HOLD_SIM_UPDATES) {
+		hold_sim_run.lateral = pose.y;
+		hold_sim_run.heading = pose.heading;
+		hold_sim_run.runs = hold_sim_result[hold_sim_trial].runs + 1;
+		hold_sim_result[hold_sim_trial] = hold_sim_run;
+		hold_sim_update = 0;
+		hold_sim_trial = (hold_sim_trial + 1)%(HOLD_SIM_MOVES*HOLD_SIM_TYPES);
+		setHeadingHold(HOLD_SIM_KH,HOLD_SIM_KY);
+	}
+}
+
+static void reportHoldSim(void) {
+	printf("    move                     hold          end(s)  max lateral  final lateral  final heading\n");
+	for(int r=0; r < HOLD_SIM_MOVES*HOLD_SIM_TYPES; r++) {
+		if(hold_sim_result[r].runs == 0) {
+			continue;
+		}
+		printf("    %-24s %-12s %7.2f %10.1fmm %12.1fmm %11.2fdeg\n",hold_sim_moves[r/HOLD_SIM_TYPES].name,hold_sim_types[r%HOLD_SIM_TYPES],
+				hold_sim_result[r].t_done,hold_sim_result[r].max_lateral*1.0e3f,hold_sim_result[r].lateral*1.0e3f,
+				hold_sim_result[r].heading*180.0f/(float)M_PI);
+	}
+}
+
+// follow a square and a figure eight path with the move sim motor model, as a leg at a time (turnTo each waypoint then
+// driveTo it, sequenced on the ME_DONE_* events as the host would) and with followPath at three lookahead distances
+// each path runs for PATH_SIM_UPDATES, and the last run of each reports the time to the end of the path, the largest and
+// RMS distance from the path (the lines between the waypoints) to the end and the final distance from the last waypoint
+#define PATH_SIM_PATHS   2
+#define PATH_SIM_TYPES   4
+#define PATH_SIM_UPDATES 2000 // 40s per path
+#define PATH_SIM_POINTS  24   // waypoints of the figure eight
+#define PATH_SIM_VEL     0.3f // m/s
+#define PATH_SIM_TURN    ((float)M_PI) // turnTo speed of the legs (rad/s)
+
+static const char * const path_sim_names[PATH_SIM_PATHS] = { "square 0.5m", "figure eight 1m" };
+static const char * const path_sim_types[PATH_SIM_TYPES] = { "legs", "pursuit 0.05m", "pursuit 0.1m", "pursuit 0.2m" };
+static const float path_sim_lookahead[PATH_SIM_TYPES] = { 0.0f, 0.05f, 0.1f, 0.2f };
+
+static WAYPOINT path_sim_points[PATH_SIM_PATHS][PATH_SIM_POINTS]; // waypoints of each path, starting from the origin
+static int path_sim_len[PATH_SIM_PATHS];
+
+static int path_sim_trial;  // path*PATH_SIM_TYPES + type
+static int path_sim_update; // update within the trial
+static int path_sim_leg;    // waypoint the legs are heading to
+static double path_sim_err2; // sum of the squared distances from the path until it ended
+static int path_sim_samples;
+typedef struct PATH_SIM_RESULT_t {
+	float t_done;   // time the path ended (s)
+	float max_err;  // largest distance from the path (m)
+	float rms_err;  // RMS distance from the path (m)
+	float end_err;  // final distance from the last waypoint (m)
+	uint32_t runs;
+} PATH_SIM_RESULT;
+static PATH_SIM_RESULT path_sim_run;
+static PATH_SIM_RESULT path_sim_result[PATH_SIM_PATHS*PATH_SIM_TYPES];
+
+// distance (m) from a point to the path p
+static float pathSimError(int p, float x, float y) {
+	float err = INFINITY;
+	float fx = 0.0f;
+	float fy = 0.0f;
+	for(int n=0; n < path_sim_len[p]; n++) {
+		float dx = path_sim_points[p][n].x - fx;
+		float dy = path_sim_points[p][n].y - fy;
+		float t = ((x - fx)*dx + (y - fy)*dy)/(dx*dx + dy*dy);
+		t = (t < 0.0f)?0.0f:((t > 1.0f)?1.0f:t);
+		float d = hypotf(x - (fx + t*dx),y - (fy + t*dy));
+		if(d < err) {
+			err = d;
+		}
+		fx = path_sim_points[p][n].x;
+		fy = path_sim_points[p][n].y;
+	}
+	return err;
+}
+
+// start the next leg, turn to face the waypoint
+static void pathSimTurn(int p) {
+	POSE pose;
+	getPose(&pose);
+	const WAYPOINT * wp = &path_sim_points[p][path_sim_leg];
+	turnTo(remainderf(atan2f(wp->y - pose.y,wp->x - pose.x) - pose.heading,2.0f*(float)M_PI),PATH_SIM_TURN);
+}
+
+static void setupPathSim(void) {
+	setupMoveSim();
+
+	static const WAYPOINT square[] = { { 0.5f, 0.0f }, { 0.5f, 0.5f }, { 0.0f, 0.5f }, { 0.0f, 0.0f } };
+	memcpy(path_sim_points[0],square,sizeof(square));
+	path_sim_len[0] = sizeof(square)/sizeof(square[0]);
+
+	for(int n=0; n < PATH_SIM_POINTS; n++) { // lemniscate of Gerono, 1m long and 0.5m wide, through the origin at 45deg
+		float t = 2.0f*(float)M_PI*(float)(n + 1)/PATH_SIM_POINTS;
+		path_sim_points[1][n].x = 0.5f*sinf(t);
+		path_sim_points[1][n].y = 0.5f*sinf(t)*cosf(t);
+	}
+	path_sim_len[1] = PATH_SIM_POINTS;
+
+	path_sim_trial = 0;
+	path_sim_update = 0;
+	memset(path_sim_result,0,sizeof(path_sim_result));
+}
+
+static void runPathSim(uint32_t i) {
+
+	int p = path_sim_trial/PATH_SIM_TYPES;
+	int type = path_sim_trial%PATH_SIM_TYPES;
+
+	if(path_sim_update == 0) {
+		moveSimStart();
+		memset(&path_sim_run,0,sizeof(path_sim_run));
+		path_sim_err2 = 0.0;
+		path_sim_samples = 0;
+		path_sim_leg = 0;
+		pathClear();
+		if(type == 0) {
+			pathSimTurn(p);
+		}
+		else {
+			for(int n=0; n < path_sim_len[p]; n++) {
+				pathAdd(path_sim_points[p][n].x,path_sim_points[p][n].y);
+			}
+			followPath(PATH_SIM_VEL,path_sim_lookahead[type]);
+		}
+	}
+
+	MotorEvent event = moveSimUpdate();
+
+	POSE pose;
+	getPose(&pose);
+
+	if(event & ME_DONE_TURN) { // legs, drive to the waypoint
+		const WAYPOINT * wp = &path_sim_points[p][path_sim_leg];
+		driveTo(hypotf(wp->x - pose.x,wp->y - pose.y),PATH_SIM_VEL);
+	}
+	else if(event & ME_DONE_DRIVE) { // legs, on to the next waypoint
+		if(++path_sim_leg < path_sim_len[p]) {
+			pathSimTurn(p);
+		}
+		else {
+			event = ME_DONE_PATH;
+		}
+	}
+	if((event & ME_DONE_PATH) && path_sim_run.t_done == 0.0f) {
+		path_sim_run.t_done = (float)(path_sim_update + 1)*BENCH_DT;
+	}
+
+	float err = pathSimError(p,pose.x,pose.y);
+	if(err > path_sim_run.max_err) {
+		path_sim_run.max_err = err;
+	}
+	if(path_sim_run.t_done == 0.0f) {
+		path_sim_err2 += (double)err*err;
+		path_sim_samples++;
+	}
+
+	if(++path_sim_update == PATH_SIM_UPDATES) {
+		const WAYPOINT * end = &path_sim_points[p][path_sim_len[p] - 1];
+		path_sim_run.rms_err = sqrtf((float)(path_sim_err2/path_sim_samples));
+		path_sim_run.end_err = hypotf(pose.x - end->x,pose.y - end->y);
+		path_sim_run.runs = path_sim_result[path_sim_trial].runs + 1;
+		path_sim_result[path_sim_trial] = path_sim_run;
+		path_sim_update = 0;
+		path_sim_trial = (path_sim_trial + 1)%(PATH_SIM_PATHS*PATH_SIM_TYPES);
+	}
+}
+
+static void reportPathSim(void) {
+	printf("    path             type           end(s)  max error  rms error  end error\n");
+	for(int r=0; r < PATH_SIM_PATHS*PATH_SIM_TYPES; r++) {
+		if(path_sim_result[r].runs == 0) {
+			continue;
+		}
+		printf("    %-16s %-14s %6.2f %8.1fmm %8.1fmm %8.1fmm\n",path_sim_names[r/PATH_SIM_TYPES],path_sim_types[r%PATH_SIM_TYPES],
+				path_sim_result[r].t_done,path_sim_result[r].max_err*1.0e3f,path_sim_result[r].rms_err*1.0e3f,
+				path_sim_result[r].end_err*1.0e3f);
+	}
+}
+
+// compare the step response of the PI controller with its options enabled one at a time
+// each option set closes the loop round its own simulated motor (with a deadband), the target
+// steps from 0 to PID_RESP_STEP every PID_RESP_SAMPLES updates, and the last step response is reported
+// a second run holds the wheel stalled for the first PID_RESP_STALL updates of the step (e.g. caught on
+// an edge), which winds up the integral of a controller without anti-windup
+#define PID_RESP_STEP    20.0f // rad/s (saturates the output with the default gains)
+#define PID_RESP_SAMPLES 150   // 3s at 50Hz
+#define PID_RESP_STALL   25    // 0.5s
+#define PID_RESP_CONFIGS 4
+#define PID_RESP_RUNS    2     // free step, stalled step
+#define PID_RESP_BAND    0.02f // settled when within 2% of the step
+
+static const struct {
+	const char * name;
+	bool anti_windup;
+	float kf;
+	float deadband;
+	float slew;
+} pid_resp_configs[PID_RESP_CONFIGS] = {
+	{ "PI only",            false, 0.0f,                 0.0f,               0.0f   },
+	{ "+anti-windup",       true,  0.0f,                 0.0f,               0.0f   },
+	{ "+feed-forward",      true,  1.0f/PID_PLANT_GAIN,  PID_PLANT_DEADBAND, 0.0f   },
+	{ "+slew 400rad/s^2",   true,  1.0f/PID_PLANT_GAIN,  PID_PLANT_DEADBAND, 400.0f },
+};
+
+static PID pid_resp[PID_RESP_RUNS][PID_RESP_CONFIGS];
+static float pid_resp_vel[PID_RESP_RUNS][PID_RESP_CONFIGS];
+static float pid_resp_trace[PID_RESP_RUNS][PID_RESP_CONFIGS][PID_RESP_SAMPLES];
+
+static void runPidResponse(uint32_t i) {
+
+	uint32_t n = i % PID_RESP_SAMPLES;
+
+	for(int r=0; r < PID_RESP_RUNS; r++) {
+		for(int c=0; c < PID_RESP_CONFIGS; c++) {
+
+			if(n == 0) { // start a new step from rest
+				PID init = { pid_left.kp, pid_left.ki, pid_resp_configs[c].kf, pid_resp_configs[c].deadband, pid_resp_configs[c].slew,
+						BENCH_DT, false, pid_resp_configs[c].anti_windup, "Resp", {0.0f,0.0f,0.0f,0.0f,0.0f} };
+				pid_resp[r][c] = init;
+				pid_resp_vel[r][c] = 0.0f;
+			}
+
+			float duty = pidUpdate(PID_RESP_STEP,pid_resp_vel[r][c],&pid_resp[r][c]);
+			if(r == 1 && n < PID_RESP_STALL) {
+				pid_resp_vel[r][c] = 0.0f; // wheel held
+			}
+			else {
+				pid_resp_vel[r][c] = plantDeadbandUpdate(pid_resp_vel[r][c],duty);
+			}
+			pid_resp_trace[r][c][n] = pid_resp_vel[r][c];
+		}
+	}
+}
+
+static void reportPidResponse(void) {
+
+	static const char * runs[PID_RESP_RUNS] = { "free", "stalled" };
+
+	printf("    step 0->%g rad/s, kp=%g ki=%g, motor %g rad/s per duty, tau %gs, deadband %g, stall %.0fms\n",
+			PID_RESP_STEP,pid_left.kp,pid_left.ki,PID_PLANT_GAIN,PID_PLANT_TAU,PID_PLANT_DEADBAND,PID_RESP_STALL*BENCH_DT*1000.0f);
+
+	for(int k=0; k < PID_RESP_RUNS*PID_RESP_CONFIGS; k++) {
+
+		int r = k / PID_RESP_CONFIGS;
+		int c = k % PID_RESP_CONFIGS;
+		const float * v = pid_resp_trace[r][c];
+		int t10=-1, t90=-1, settle=0;
+		float peak=0.0f;
+
+		for(int n=0; n < PID_RESP_SAMPLES; n++) {
+			if(t10 < 0 && v[n] >= 0.1f*PID_RESP_STEP) {
+				t10 = n;
+			}
+			if(t90 < 0 && v[n] >= 0.9f*PID_RESP_STEP) {
+				t90 = n;
+			}
+			if(v[n] > peak) {
+				peak = v[n];
+			}
+			if(fabsf(v[n] - PID_RESP_STEP) > PID_RESP_BAND*PID_RESP_STEP) {
+				settle = n+1;
+			}
+		}
+
+		printf("    %-8s %-18s rise %4.0fms  overshoot %5.1f%%  settle(2%%) ",runs[r],pid_resp_configs[c].name,
+				(t10 >= 0 && t90 >= 0)?(t90-t10)*BENCH_DT*1000.0f:-1.0f,100.0f*(peak-PID_RESP_STEP)/PID_RESP_STEP);
+		if(settle < PID_RESP_SAMPLES) {
+			printf("%4.0fms\n",settle*BENCH_DT*1000.0f);
+		}
+		else {
+			printf(" >%.0fms\n",PID_RESP_SAMPLES*BENCH_DT*1000.0f);
+		}
+	}
+}
+
+// simulate the host streaming velocity setpoints with UI_OP_DRIVE packets, 1 iteration = 1ms of the main loop
+// the host streams every 20ms (out of phase with the PID updates) for 2s, then goes quiet for 1s so the watchdog has to stop the robot
+#define STREAM_CYCLE_MS  3000
+#define STREAM_SEND_MS   2000
+#define STREAM_PERIOD_MS 20
+#define STREAM_PHASE_MS  7 // setpoints arrive part way between PID updates
+
+static uint8_t stream_packet[9];
+static STREAM_STATS stream_start;    // stats at the start of the run
+static uint32_t stream_last_us;      // time of the last setpoint sent
+static bool stream_stopped;          // PWM has been seen at 0 since the stream went quiet
+static uint32_t stream_stops;        // number of times the watchdog stopped the robot
+static uint32_t stream_stop_min_us;  // time from the last setpoint until both motors were stopped
+static uint32_t stream_stop_max_us;
+static uint32_t stream_timeouts;     // watchdog timeouts seen
+static uint32_t stream_trip_max_us;  // longest time from the last setpoint until the watchdog tripped
+
+static bool pwmOff(void) {
+	return __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_1) == 0 && __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_2) == 0 &&
+		   __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_3) == 0 && __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_4) == 0;
+}
+
+static const float stream_vel[2] = { 0.3f, 0.5f }; // setpoint streamed (m/s, rad/s)
+
+static void setupStream(void) {
+
+	float v[2] = { stream_vel[0], stream_vel[1] };
+
+	setupSim();
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	schedInit();
+	stream_packet[0] = UI_OP_DRIVE;
+	memcpy(&stream_packet[1],v,sizeof(v));
+
+	stream_start = *getStreamStats();
+	stream_last_us = 0;
+	stream_stopped = true;
+	stream_stops = 0;
+	stream_stop_min_us = UINT32_MAX;
+	stream_stop_max_us = 0;
+	stream_timeouts = stream_start.timeouts;
+	stream_trip_max_us = 0;
+}
+
+static void runStream(uint32_t i) {
+
+	uint32_t t = i % STREAM_CYCLE_MS;
+
+	if(t < STREAM_SEND_MS && (t % STREAM_PERIOD_MS) == STREAM_PHASE_MS) {
+		MotorEvent event=0;
+		doUI(stream_packet,sizeof(stream_packet),&event);
+		simUartTxComplete(&huart1); // discard the response
+		simUartTxRead(&huart1,NULL,SIM_UART_BUF_SIZE);
+		stream_last_us = simMicros();
+		stream_stopped = false;
+	}
+
+	bool pid_update = schedDue(SG_MOTION);
+	sink_i = updateMotors(pid_update,schedDT(SG_MOTION));
+
+	if(getStreamStats()->timeouts != stream_timeouts) { // watchdog tripped and started ramping the wheels down
+		stream_timeouts = getStreamStats()->timeouts;
+		uint32_t trip_us = simMicros() - stream_last_us;
+		if(trip_us > stream_trip_max_us) {
+			stream_trip_max_us = trip_us;
+		}
+	}
+
+	simAdvanceMicros(1000); // the speed loop writes the PWM in the tick
+
+	if(!stream_stopped && t >= STREAM_SEND_MS && pwmOff()) {
+		uint32_t stop_us = simMicros() - stream_last_us;
+		stream_stopped = true;
+		stream_stops++;
+		if(stop_us < stream_stop_min_us) {
+			stream_stop_min_us = stop_us;
+		}
+		if(stop_us > stream_stop_max_us) {
+			stream_stop_max_us = stop_us;
+		}
+	}
+}
+
+static void reportStream(void) {
+
+	const STREAM_STATS * st = getStreamStats();
+
+	printf("    setpoints=%u applied=%u timeouts=%u latency to the PWM write=%uus max latency=%uus\n",
+			st->setpoints - stream_start.setpoints,st->applied - stream_start.applied,
+			st->timeouts - stream_start.timeouts,st->latency_us,st->latency_max_us);
+	if(stream_stops > 0) {
+		// bound documented in motors.h: timeout + a motion period to trip, then the ramp down from the wheel speed
+		float wheel_vel = (stream_vel[0] + fabsf(stream_vel[1])*ODOM_WHEEL_BASE/2.0f)/ODOM_WHEEL_RADIUS;
+		float bound_ms = STREAM_TIMEOUT_MS + 20.0f + 1000.0f*wheel_vel/STREAM_STOP_DECEL;
+		printf("    watchdog stops=%u, last setpoint to trip max %.1fms, to PWM off %.1f-%.1fms (timeout %dms)\n",
+				stream_stops,stream_trip_max_us*1.0e-3,stream_stop_min_us*1.0e-3,stream_stop_max_us*1.0e-3,STREAM_TIMEOUT_MS);
+		printf("    stop from %.1f rad/s within %.1fms: %s\n",wheel_vel,bound_ms,
+				(stream_stop_max_us*1.0e-3f <= bound_ms)?"PASS":"FAIL");
+	}
+}
+
+// drive at MAX_LIN_VEL with the move sim motor model, with the main loop run every 1ms (edge sensors debounced
+// every 10ms, PID every 20ms), and put the left edge sensor over an edge at each 1ms step through a PID period.
+// With the fast stop the sensor pin interrupt turns the PWM off, without it (EXTI line masked) the motors are
+// stopped by the debounced state. Reports the time and distance from the edge to the PWM off, and to the robot stopping.
+// The report also checks the fast stop is released by a glitch and by disabling the sensor, and trips again on re-enabling
+#define EDGE_SIM_PHASES  20  // edge times through the PID period (ms)
+#define EDGE_SIM_TYPES   2
+#define EDGE_SIM_MS      1200 // length of each trial
+#define EDGE_SIM_EDGE_MS 500 // time to the edge (plus the phase), at full speed by then
+
+static const char * const edge_sim_types[EDGE_SIM_TYPES] = { "fast stop", "polled" };
+
+static int edge_sim_trial; // phase*EDGE_SIM_TYPES + type
+static int edge_sim_ms;    // time within the trial
+static float edge_sim_dist; // distance from the edge, from the motor model (the pose is only updated with the PID)
+static bool edge_sim_off;
+static bool edge_sim_stopped;
+static bool edge_sim_bumped;
+typedef struct EDGE_SIM_RESULT_t {
+	float off_ms[3];   // time from the edge to the PWM off, total, max and count
+	float off_mm[3];   // distance from the edge to the PWM off
+	float stop_mm[3];  // distance from the edge to the robot stopping
+	float bump_ms[3];  // time from the edge to the bump event
+	uint32_t runs;
+	uint32_t bumps;    // runs that raised the bump event
+} EDGE_SIM_RESULT;
+static EDGE_SIM_RESULT edge_sim_result[EDGE_SIM_TYPES];
+
+// true if either motor has PWM output
+static bool edgeSimPwmOn(void) {
+	return __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_1) || __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_2) ||
+			__HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_3) || __HAL_TIM_GET_COMPARE(&htim3,TIM_CHANNEL_4);
+}
+
+// run the main loop for ms, returning the events raised
+static MotorEvent edgeSimRun(int ms) {
+	MotorEvent events = ME_NONE;
+	for(int n=0; n < ms; n++) {
+		moveSimMs();
+		if(simMicros()/1000 % 10 == 0) {
+			updateEdgeSensors();
+		}
+		events |= updateMotors(simMicros()/1000 % 20 == 0,BENCH_DT);
+	}
+	return events;
+}
+
+// clear the sensor and start driving with the fast stop on or off
+static void edgeSimStart(bool fast, float lin_vel) {
+	disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);
+	moveSimStart();
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_RESET);
+	for(int n=0; n < 4; n++) { // clear the debounce filter
+		updateEdgeSensors();
+	}
+	edgeSensorInit();
+	if(!fast) { // mask the EXTI line
+		EXTI_HandleTypeDef hexti;
+		EXTI_ConfigTypeDef config = { EXTI_LINE_11, 0, EXTI_TRIGGER_RISING, EXTI_GPIOA };
+		HAL_EXTI_SetConfigLine(&hexti,&config);
+	}
+	enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);
+	drive(lin_vel,0.0f);
+}
+
+// add to the total, max and count
+static void edgeSimMax(float * v, float x) {
+	v[0] += x;
+	if(x > v[1]) {
+		v[1] = x;
+	}
+	v[2] += 1.0f;
+}
+
+static float edgeSimAvg(const float * v) {
+	return (v[2] > 0.0f)?v[0]/v[2]:0.0f;
+}
+
+static void setupEdgeSim(void) {
+	setupMoveSim();
+	edge_sim_trial = 0;
+	edge_sim_ms = 0;
+	memset(edge_sim_result,0,sizeof(edge_sim_result));
+}
+
+static void runEdgeSim(uint32_t i) {
+
+	int type = edge_sim_trial%EDGE_SIM_TYPES;
+	int edge_ms = EDGE_SIM_EDGE_MS + edge_sim_trial/EDGE_SIM_TYPES;
+	EDGE_SIM_RESULT * r = &edge_sim_result[type];
+
+	if(edge_sim_ms == 0) {
+		edgeSimStart(type == 0,MAX_LIN_VEL);
+		edge_sim_off = false;
+		edge_sim_stopped = false;
+		edge_sim_bumped = false;
+	}
+
+	if(edge_sim_ms == edge_ms) {
+		edge_sim_dist = 0.0f;
+		simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_SET);
+		if(!edgeSimPwmOn()) { // stopped by the pin interrupt
+			edge_sim_off = true;
+			edgeSimMax(r->off_ms,0.0f);
+			edgeSimMax(r->off_mm,0.0f);
+		}
+	}
+
+	MotorEvent event = edgeSimRun(1);
+
+	if(edge_sim_ms >= edge_ms) {
+		edge_sim_dist += (move_sim_w[0] + move_sim_w[1])*0.5f*ODOM_WHEEL_RADIUS*1.0e-3f;
+		float mm = edge_sim_dist*1.0e3f;
+		if(!edge_sim_off && !edgeSimPwmOn()) {
+			edge_sim_off = true;
+			edgeSimMax(r->off_ms,(float)(edge_sim_ms - edge_ms));
+			edgeSimMax(r->off_mm,mm);
+		}
+		if((event & ME_BUMP_LEFT) && !edge_sim_bumped) {
+			edge_sim_bumped = true;
+			edgeSimMax(r->bump_ms,(float)(edge_sim_ms - edge_ms));
+		}
+		if(edge_sim_off && !edge_sim_stopped && fabsf(move_sim_w[0]) < MOVE_SIM_REST && fabsf(move_sim_w[1]) < MOVE_SIM_REST) {
+			edge_sim_stopped = true;
+			edgeSimMax(r->stop_mm,mm);
+		}
+	}
+	if(++edge_sim_ms == EDGE_SIM_MS) {
+		r->runs++;
+		r->bumps += edge_sim_bumped;
+		edge_sim_ms = 0;
+		edge_sim_trial = (edge_sim_trial + 1)%(EDGE_SIM_TYPES*EDGE_SIM_PHASES);
+	}
+}
+
+static void reportEdgeSim(void) {
+
+	printf("    type        runs  PWM off avg/max (ms)    (mm)       stopped avg/max (mm)  bump event avg/max (ms)\n");
+	for(int t=0; t < EDGE_SIM_TYPES; t++) {
+		const EDGE_SIM_RESULT * r = &edge_sim_result[t];
+		if(r->runs == 0) {
+			continue;
+		}
+		printf("    %-10s %5lu  %5.1f %5.1f       %5.1f %5.1f     %5.1f %5.1f           %5.1f %5.1f  (%lu/%lu)\n",
+				edge_sim_types[t],(unsigned long)r->runs,
+				edgeSimAvg(r->off_ms),r->off_ms[1],edgeSimAvg(r->off_mm),r->off_mm[1],edgeSimAvg(r->stop_mm),r->stop_mm[1],
+				edgeSimAvg(r->bump_ms),r->bump_ms[1],(unsigned long)r->bumps,(unsigned long)r->runs);
+	}
+
+	// a glitch trips the fast stop and is released by the debounced state, the drive carries on
+	EDGE_SENSOR_STATS before = *getEdgeSensorStats();
+	edgeSimStart(true,0.3f);
+	MotorEvent events = edgeSimRun(200);
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_SET);
+	bool off = !edgeSimPwmOn();
+	edgeSimRun(5);
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_RESET);
+	events |= edgeSimRun(60);
+	const EDGE_SENSOR_STATS * stats = getEdgeSensorStats();
+	printf("    glitch 5ms         PWM off %s, resumed %s, bump event %s  %s\n",off?"yes":"no",edgeSimPwmOn()?"yes":"no",
+			(events & ME_BUMP_LEFT)?"yes":"no",(off && edgeSimPwmOn() && !(events & ME_BUMP_LEFT) && stats->glitches > before.glitches)?"PASS":"FAIL");
+
+	// a confirmed edge raises the bump event and stays stopped until the sensor is disabled, then the robot can back up
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_SET);
+	events = edgeSimRun(60);
+	off = !edgeSimPwmOn();
+	disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);
+	drive(-0.1f,0.0f);
+	edgeSimRun(40);
+	printf("    edge, back up      PWM off %s, bump event %s, backs up %s  %s\n",off?"yes":"no",(events & ME_BUMP_LEFT)?"yes":"no",
+			edgeSimPwmOn()?"yes":"no",(off && (events & ME_BUMP_LEFT) && edgeSimPwmOn())?"PASS":"FAIL");
+
+	// a disabled sensor does not stop the robot
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_RESET);
+	events = edgeSimRun(40);
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_SET);
+	events |= edgeSimRun(40);
+	printf("    disabled           PWM on %s, bump event %s  %s\n",edgeSimPwmOn()?"yes":"no",(events & ME_BUMP_LEFT)?"yes":"no",
+			(edgeSimPwmOn() && !(events & ME_BUMP_LEFT))?"PASS":"FAIL");
+
+	// enabling a sensor that is over an edge stops the robot straight away
+	enableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);
+	off = !edgeSimPwmOn();
+	events = edgeSimRun(40);
+	printf("    enable over edge   PWM off %s, bump event %s  %s\n",off?"yes":"no",(events & ME_BUMP_LEFT)?"yes":"no",
+			(off && (events & ME_BUMP_LEFT))?"PASS":"FAIL");
+
+	stats = getEdgeSensorStats();
+	printf("    trips=%lu glitches=%lu reaction=%luus max=%luus confirm=%luus\n",(unsigned long)stats->trips,(unsigned long)stats->glitches,
+			(unsigned long)stats->reaction_us,(unsigned long)stats->reaction_max_us,(unsigned long)stats->confirm_us);
+
+	disableEdgeSensors(BUMP_BIT_LEFT | BUMP_BIT_RIGHT);
+	simSetPin(CLIFF_1_GPIO_Port,CLIFF_1_Pin,GPIO_PIN_RESET);
+	STOP();
+}
+
+// run both wheels at LOAD_SIM_SPEED against the move sim motor model and put a load step on the left wheel, with the speed
+// loop at 50Hz (as the PID ran in the main loop before), 500Hz and 1kHz, with the default gains and with higher gains.
+// Reports how far the wheel slows (dip), how long it takes to get back within LOAD_SIM_TOL of the target (recover),
+// the integral of the speed error while the load is on (IAE), the overshoot when the load comes off and the speed ripple
+// before the step. The report also times the speed loop update to give the share of the CPU it takes at each rate.
+#define LOAD_SIM_CONFIGS 6
+#define LOAD_SIM_MS      1500  // length of each run
+#define LOAD_SIM_ON_MS   500   // load applied
+#define LOAD_SIM_OFF_MS  1000  // load removed
+#define LOAD_SIM_SPEED   10.0f // wheel speed target (rad/s)
+#define LOAD_SIM_LOAD    6.0f  // load, as the speed it takes off the wheel at the same duty (rad/s)
+#define LOAD_SIM_TOL     0.5f  // recovered once back within this of the target (rad/s)
+#define LOAD_SIM_COST_RUNS 100000
+
+static const struct {
+	const char * name;
+	uint32_t ticks; // speed loop period (ms)
+	float gain;     // times the default PID gains
+} load_sim_configs[LOAD_SIM_CONFIGS] = {
+	{ "50Hz",          20, 1.0f },
+	{ "500Hz",         2,  1.0f },
+	{ "1kHz",          1,  1.0f },
+	{ "50Hz x4 gains", 20, 4.0f },
+	{ "500Hz x4 gains", 2, 4.0f },
+	{ "1kHz x4 gains", 1,  4.0f },
+};
+
+static int load_sim_config;
+static int load_sim_ms;
+static float load_sim_kp; // default gains
+static float load_sim_ki;
+typedef struct LOAD_SIM_RESULT_t {
+	float dip;        // largest drop below the target with the load on (rad/s)
+	float recover_ms; // time from the load step to the last time the wheel was outside the tolerance with the load on
+	float iae;        // integral of the absolute speed error with the load on (rad)
+	float overshoot;  // largest speed above the target after the load comes off (rad/s)
+	float ripple;     // rms speed error before the step (rad/s)
+	uint32_t runs;
+} LOAD_SIM_RESULT;
+static LOAD_SIM_RESULT load_sim_run;
+static LOAD_SIM_RESULT load_sim_result[LOAD_SIM_CONFIGS];
+
+static void setupLoadSim(void) {
+	setupMoveSim();
+	load_sim_kp = pid_left.kp;
+	load_sim_ki = pid_left.ki;
+	load_sim_config = 0;
+	load_sim_ms = 0;
+	memset(load_sim_result,0,sizeof(load_sim_result));
+}
+
+static void loadSimGains(float gain) {
+	pid_left.kp = pid_right.kp = gain*load_sim_kp;
+	pid_left.ki = pid_right.ki = gain*load_sim_ki;
+}
+
+static void runLoadSim(uint32_t i) {
+
+	if(load_sim_ms == 0) {
+		moveSimStart();
+		setSpeedLoopRate(load_sim_configs[load_sim_config].ticks);
+		loadSimGains(load_sim_configs[load_sim_config].gain);
+		move_sim_load[0] = 0.0f;
+		setMotorSpeed(LOAD_SIM_SPEED,LOAD_SIM_SPEED);
+		memset(&load_sim_run,0,sizeof(load_sim_run));
+	}
+
+	if(load_sim_ms == LOAD_SIM_ON_MS) {
+		move_sim_load[0] = LOAD_SIM_LOAD;
+	}
+	else if(load_sim_ms == LOAD_SIM_OFF_MS) {
+		move_sim_load[0] = 0.0f;
+	}
+
+	moveSimMs();
+
+	float err = move_sim_w[0] - LOAD_SIM_SPEED;
+	LOAD_SIM_RESULT * r = &load_sim_run;
+
+	if(load_sim_ms >= LOAD_SIM_ON_MS - 200 && load_sim_ms < LOAD_SIM_ON_MS) {
+		r->ripple += err*err;
+	}
+	else if(load_sim_ms >= LOAD_SIM_ON_MS && load_sim_ms < LOAD_SIM_OFF_MS) {
+		r->dip = fmaxf(r->dip,-err);
+		r->iae += fabsf(err)*1.0e-3f;
+		if(fabsf(err) > LOAD_SIM_TOL) {
+			r->recover_ms = (float)(load_sim_ms + 1 - LOAD_SIM_ON_MS);
+		}
+	}
+	else if(load_sim_ms >= LOAD_SIM_OFF_MS) {
+		r->overshoot = fmaxf(r->overshoot,err);
+	}
+
+	if(++load_sim_ms == LOAD_SIM_MS) { // keep the worst of the runs of each config
+		LOAD_SIM_RESULT * res = &load_sim_result[load_sim_config];
+		res->dip = fmaxf(res->dip,r->dip);
+		res->recover_ms = fmaxf(res->recover_ms,r->recover_ms);
+		res->iae = fmaxf(res->iae,r->iae);
+		res->overshoot = fmaxf(res->overshoot,r->overshoot);
+		res->ripple = fmaxf(res->ripple,sqrtf(r->ripple/200.0f));
+		res->runs++;
+		load_sim_ms = 0;
+		load_sim_config = (load_sim_config + 1) % LOAD_SIM_CONFIGS;
+	}
+}
+
+static void reportLoadSim(void) {
+
+	printf("    wheel at %.0f rad/s, load step of %.0f rad/s on the left wheel at %dms, off at %dms, kp=%.3g ki=%.3g\n",
+			LOAD_SIM_SPEED,LOAD_SIM_LOAD,LOAD_SIM_ON_MS,LOAD_SIM_OFF_MS,load_sim_kp,load_sim_ki);
+	printf("    speed loop        runs  dip (rad/s)  recover(%.1f)  IAE (rad)  overshoot (rad/s)  ripple (rad/s rms)\n",LOAD_SIM_TOL);
+	for(int c=0; c < LOAD_SIM_CONFIGS; c++) {
+		const LOAD_SIM_RESULT * r = &load_sim_result[c];
+		if(r->runs == 0) {
+			continue;
+		}
+		printf("    %-16s %5lu %10.2f %11.0fms %11.3f %14.2f %18.3f\n",load_sim_configs[c].name,(unsigned long)r->runs,
+				r->dip,r->recover_ms,r->iae,r->overshoot,r->ripple);
+	}
+
+	// CPU time of a speed loop update, as a share of the period at each rate
+	loadSimGains(1.0f);
+	setSpeedLoopRate(1);
+	uint64_t start_ns = nowNs();
+	uint64_t start_cycles = nowCycles();
+	for(int n=0; n < LOAD_SIM_COST_RUNS; n++) {
+		updateSpeedLoop();
+	}
+	double ns = (double)(nowNs() - start_ns)/LOAD_SIM_COST_RUNS;
+	double cycles = (double)(nowCycles() - start_cycles)/LOAD_SIM_COST_RUNS;
+	double target_us = cycles/64.0; // the same cycles at the 64MHz target clock
+	printf("    speed loop update %.0fns (%.0f cycles) on the host\n",ns,cycles);
+	printf("    %.0f cycles at 64MHz is %.1fus, %.2f%% of the CPU at 50Hz, %.1f%% at 1kHz (measure on the robot with getSpeedLoopStats)\n",
+			cycles,target_us,target_us*50.0e-4,target_us*0.1);
+
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	STOP();
+}
+
+// post events raised together in one pass of the main loop, as updateMotors then doComs would, and check the
+// state machine handles every one. Each step posts its events, runs the controller and checks the state it ends in.
+// The controller used to switch on the whole mask with exact case labels, so it ignored a step with more than one event
+// the last run also posts more events than the queue holds without running the controller, to check they are counted as dropped
+#define EVENT_SIM_STEPS 7
+#define EVENT_SIM_FLOOD (EVENT_QUEUE_SIZE + 4)
+
+static const struct {
+	const char * name;
+	MotorEvent motors; // events from updateMotors
+	MotorEvent ui;     // events from doComs
+	STATE state;       // state after the events are handled
+} event_sim_steps[EVENT_SIM_STEPS] = {
+	{ "stop",                     ME_NONE,                       ME_STOP,         ST_IDLE     },
+	{ "start level 1",            ME_NONE,                       CE_M1,           ST_M1_FWD   },
+	{ "both edges",               ME_BUMP_LEFT | ME_BUMP_RIGHT,  ME_NONE,         ST_M1_BCK_R },
+	{ "backed up, edge right",    ME_DONE_DRIVE | ME_BUMP_RIGHT, ME_NONE,         ST_M1_BCK_L },
+	{ "backed up",                ME_DONE_DRIVE,                 ME_NONE,         ST_M1_TURN  },
+	{ "turned, stop",             ME_DONE_TURN,                  ME_STOP,         ST_IDLE     },
+	{ "stop, start level 1",      ME_NONE,                       ME_STOP | CE_M1, ST_M1_FWD   },
+};
+
+typedef struct EVENT_SIM_RESULT_t {
+	uint32_t posted;  // events posted by the step
+	uint32_t handled; // events the controller took off the queue
+	STATE state;
+	uint32_t runs;
+	uint32_t fails;   // runs that ended in the wrong state
+} EVENT_SIM_RESULT;
+static EVENT_SIM_RESULT event_sim_result[EVENT_SIM_STEPS];
+static uint32_t event_sim_flood_dropped;
+
+// number of events in a mask
+static uint32_t eventSimCount(MotorEvent events) {
+	return (uint32_t)__builtin_popcount((unsigned)events);
+}
+
+static void setupEventSim(void) {
+	setupSim();
+	memset(event_sim_result,0,sizeof(event_sim_result));
+	event_sim_flood_dropped = 0;
+}
+
+static void runEventSim(uint32_t i) {
+
+	int step = i%EVENT_SIM_STEPS;
+	EVENT_SIM_RESULT * r = &event_sim_result[step];
+	const EVENT_STATS * st = eventGetStats();
+
+	uint32_t handled = st->handled;
+	eventPost(event_sim_steps[step].motors);
+	eventPost(event_sim_steps[step].ui);
+	updateControler();
+
+	r->posted = eventSimCount(event_sim_steps[step].motors) + eventSimCount(event_sim_steps[step].ui);
+	r->handled = st->handled - handled;
+	r->state = getControlerState();
+	r->runs++;
+	if(r->state != event_sim_steps[step].state || r->handled != r->posted) {
+		r->fails++;
+	}
+}
+
+static void reportEventSim(void) {
+
+	printf("    step                     events  handled  state  expected  failed runs  old switch\n");
+	for(int s=0; s < EVENT_SIM_STEPS; s++) {
+		const EVENT_SIM_RESULT * r = &event_sim_result[s];
+		if(r->runs == 0) {
+			continue;
+		}
+		printf("    %-24s %6u %8u %6d %9d %12u  %s\n",event_sim_steps[s].name,r->posted,r->handled,r->state,
+				event_sim_steps[s].state,r->fails,(r->posted > 1)?"ignored":"handled");
+	}
+
+	// fill the queue past its size without running the controller, then empty it
+	const EVENT_STATS * st = eventGetStats();
+	uint32_t dropped = st->dropped;
+	uint32_t handled = st->handled;
+	for(int n=0; n < EVENT_SIM_FLOOD; n++) {
+		eventPost(ME_DONE_TURN);
+	}
+	updateControler();
+	printf("    %d events posted at once: %u handled, %u dropped (queue holds %d), max depth %u\n",EVENT_SIM_FLOOD,
+			st->handled - handled,st->dropped - dropped,EVENT_QUEUE_SIZE,st->max_depth);
+}
+
+// run scripted event sequences through the controller state machine and check the state after each step,
+// a step either posts an event or lets time pass (for the state timeouts). Every transition taken is traced and
+// the report lists how many times each transition in the tables was taken, so untested transitions show up
+#define FSM_SIM_STEPS 25
+
+static const struct {
+	const char * name;  // name of the script starting at this step (NULL to carry on)
+	MotorEvent event;   // event posted (ME_NONE to wait)
+	uint32_t wait_ms;   // time to wait before running the controller
+	STATE state;        // state after the step
+} fsm_sim_steps[FSM_SIM_STEPS] = {
+	{ "level 1",   ME_STOP,       0,    ST_IDLE     },
+	{ NULL,        CE_M1,         0,    ST_M1_FWD   },
+	{ NULL,        ME_BUMP_LEFT,  0,    ST_M1_BCK_R },
+	{ NULL,        ME_DONE_DRIVE, 0,    ST_M1_TURN  },
+	{ NULL,        ME_DONE_TURN,  0,    ST_M1_FWD   },
+	{ NULL,        ME_BUMP_RIGHT, 0,    ST_M1_BCK_L },
+	{ NULL,        ME_DONE_DRIVE, 0,    ST_M1_TURN  },
+	{ NULL,        ME_BUMP_LEFT,  0,    ST_M1_BCK_R }, // edge while turning
+	{ NULL,        ME_BUMP_RIGHT, 0,    ST_M1_BCK_R }, // edges are ignored while backing up
+	{ NULL,        ME_STOP,       0,    ST_IDLE     },
+	{ "timeouts",  CE_M1,         0,    ST_M1_FWD   },
+	{ NULL,        ME_BUMP_RIGHT, 0,    ST_M1_BCK_L },
+	{ NULL,        ME_NONE,       4000, ST_M1_BCK_L },
+	{ NULL,        ME_NONE,       1000, ST_IDLE     }, // backup did not finish
+	{ NULL,        CE_M1,         0,    ST_M1_FWD   },
+	{ NULL,        ME_BUMP_LEFT,  0,    ST_M1_BCK_R },
+	{ NULL,        ME_DONE_DRIVE, 0,    ST_M1_TURN  },
+	{ NULL,        ME_NONE,       5000, ST_IDLE     }, // turn did not finish
+	{ "ignored",   CE_M2,         0,    ST_IDLE     },
+	{ NULL,        CE_M3,         0,    ST_IDLE     },
+	{ NULL,        ME_DONE_TURN,  0,    ST_IDLE     },
+	{ NULL,        ME_BUMP_LEFT,  0,    ST_IDLE     },
+	{ NULL,        ME_DONE_PATH,  0,    ST_IDLE     },
+	{ NULL,        CE_M1,         0,    ST_M1_FWD   },
+	{ NULL,        CE_M1,         0,    ST_M1_FWD   }, // already running level 1
+};
+
+static const char * const fsm_sim_events[] = { "TIMEOUT", "STOP", "DONE_TURN", "DONE_DRIVE", "BUMP_LEFT", "BUMP_RIGHT",
+		"M1", "M2", "M3", "DONE_PATH" }; // controller event numbers (FSM_EV_TIMEOUT then the MotorEvent flags in bit order)
+#define FSM_SIM_EVENTS ((int)(sizeof(fsm_sim_events)/sizeof(fsm_sim_events[0])))
+
+static uint32_t fsm_sim_hits[FSM_MAX_STATES][FSM_SIM_EVENTS]; // times each transition was taken, by the state holding it and event
+static uint32_t fsm_sim_fails[FSM_SIM_STEPS];
+static uint32_t fsm_sim_runs;
+
+static void fsmSimTrace(const FSM * fsm, uint8_t source, uint8_t event, uint8_t from, uint8_t to) {
+	fsm_sim_hits[source][event]++;
+}
+
+static void setupFsmSim(void) {
+	setupSim();
+	__HAL_TIM_DISABLE_IT(&htim1,TIM_IT_UPDATE); // the controller does not use the encoders, so the waits can jump straight to the end
+	setControlerTrace(fsmSimTrace);
+	memset(fsm_sim_hits,0,sizeof(fsm_sim_hits));
+	memset(fsm_sim_fails,0,sizeof(fsm_sim_fails));
+	fsm_sim_runs = 0;
+}
+
+static void runFsmSim(uint32_t i) {
+
+	int step = i%FSM_SIM_STEPS;
+
+	eventPost(fsm_sim_steps[step].event);
+	simAdvanceMicros(fsm_sim_steps[step].wait_ms*1000);
+	updateControler();
+
+	if(getControlerState() != fsm_sim_steps[step].state) {
+		fsm_sim_fails[step]++;
+	}
+	if(step == FSM_SIM_STEPS - 1) {
+		fsm_sim_runs++;
+	}
+}
+
+static void reportFsmSim(void) {
+
+	const FSM * fsm = getControlerFSM();
+
+	printf("    script runs=%u, transitions taken=%u\n",fsm_sim_runs,fsm->transitions);
+	const char * script = NULL;
+	uint32_t fails = 0;
+	for(int s=0; s <= FSM_SIM_STEPS; s++) {
+		if(s == FSM_SIM_STEPS || fsm_sim_steps[s].name != NULL) {
+			if(script != NULL) {
+				printf("    %-10s %s (%u failed steps)\n",script,(fails == 0)?"pass":"FAIL",fails);
+			}
+			if(s == FSM_SIM_STEPS) {
+				break;
+			}
+			script = fsm_sim_steps[s].name;
+			fails = 0;
+		}
+		fails += fsm_sim_fails[s];
+	}
+
+	int defined = 0;
+	int covered = 0;
+	printf("    transition coverage:\n");
+	for(int s=0; s < fsm->num_states; s++) {
+		const FSM_TRANSITION * table = fsm->states[s].transitions;
+		for(int e=0; table != NULL && e < fsm->num_events && e < FSM_SIM_EVENTS; e++) {
+			if(table[e].kind == FSM_TR_NONE) {
+				continue;
+			}
+			defined++;
+			covered += (fsm_sim_hits[s][e] > 0)?1:0;
+			printf("      %-10s %-10s -> %-10s %8u\n",fsm->states[s].name,fsm_sim_events[e],
+					(table[e].kind == FSM_TR_GOTO)?fsm->states[table[e].target].name:"(internal)",fsm_sim_hits[s][e]);
+		}
+	}
+	printf("    %d of %d transitions covered\n",covered,defined);
+	setControlerTrace(NULL);
+}
+
+static const BENCH_CASE bench_cases[] = {
+	{ "pidUpdate",             setupSim,        runPidUpdate,        NULL },
+	{ "pidUpdate(step response)", NULL,         runPidResponse,      reportPidResponse },
+	{ "updateEncoder",         setupSim,        runUpdateEncoder,    NULL },
+	{ "updateEncoder(edge sim)", setupEncoderSim, runEncoderSim,     reportEncoderSim },
+	{ "updateEncoder(wrap sim)", setupEncoderWrap, runEncoderWrap,   reportEncoderWrap },
+	{ "updatePose(odometry sim)", setupOdometry, runOdometry,        reportOdometry },
+	{ "driveTo/turnTo(move sim)", setupMoveSim, runMoveSim,         reportMoveSim },
+	{ "driveTo(heading hold sim)", setupHoldSim, runHoldSim,        reportHoldSim },
+	{ "followPath(path sim)",  setupPathSim,    runPathSim,          reportPathSim },
+	{ "edgeSensorEdge(fast stop sim)", setupEdgeSim, runEdgeSim,     reportEdgeSim },
+	{ "updateSpeedLoop(load step sim)", setupLoadSim, runLoadSim,    reportLoadSim },
+	{ "updateSpeedLoop",       setupSpeedLoop,  runUpdateSpeedLoop,  NULL },
+	{ "updateMotors(motion)",  setupSim,        runUpdateMotorsMotion, NULL },
+	{ "updateMotors(no pid)",  setupSim,        runUpdateMotorsIdle, NULL },
+	{ "updateMotors(driveTo)", setupDriveTo,    runUpdateMotorsMotion, NULL },
+	{ "updateMotors(turnTo)",  setupTurnTo,     runUpdateMotorsTurn, NULL },
+	{ "updateControler",       setupSim,        runUpdateControler,  NULL },
+	{ "updateControler(event sim)", setupEventSim, runEventSim,      reportEventSim },
+	{ "updateControler(fsm script)", setupFsmSim, runFsmSim,         reportFsmSim },
+	{ "updateIRSensors",       setupSim,        runUpdateIRSensors,  NULL },
+	{ "fastSinCos",            NULL,            runFastSinCos,       NULL },
+	{ "sinf+cosf",             NULL,            runLibmSinCos,       NULL },
+	{ "fastMath(accuracy)",    setupFastMath,   runFastMath,         reportFastMath },
+	{ "irTableDistance",       NULL,            runIRTableDistance,  NULL },
+	{ "irTable(accuracy)",     setupIRTable,    runIRTable,          reportIRTable },
+	{ "slipEncode(100B)",      setupSim,        runSlipEncode,       NULL },
+	{ "slipDecode(100B)",      setupSlipDecode, runSlipDecode,       NULL },
+	{ "doUI",                  setupDoUI,       runDoUI,             NULL },
+	{ "doComs(1B)",            setupSim,        runDoComs,           NULL },
+	{ "doComs(line rate)",     setupDoComsLineRate, runDoComsLineRate, reportDoComs },
+	{ "doComs(rx restart)",    setupDoComsRestart, runDoComsLineRate, reportDoComs },
+	{ "tlmEncode",             setupTlmEncode,  runTlmEncode,        reportTlmEncode },
+	{ "sendTelemetry",         setupSim,        runSendTelemetry,    NULL },
+	{ "sendTelemetry(stream)", setupTelemetryStream, runTelemetryStream, reportTelemetryStream },
+	{ "scheduler(loop sim)",   setupScheduler,  runScheduler,        reportScheduler },
+	{ "scheduler(stall sim)",  setupSchedulerStalls, runScheduler,   reportScheduler },
+	{ "probe(main loop sim)",  setupProbeSim,   runProbeSim,         reportProbeSim },
+	{ "stream(watchdog sim)",  setupStream,     runStream,           reportStream },
+};
+
+
+// ---------------------------------------------------------------------------------
+// benchmark driver
+// ---------------------------------------------------------------------------------
+
+static void runBench(const BENCH_CASE * bc, uint32_t iterations) {
+
+	if(bc->setup) {
+		bc->setup();
+	}
+
+	// warm up caches and branch predictors
+	for(uint32_t i=0; i < iterations/10; i++) {
+		bc->run(i);
+	}
+
+	uint64_t t0 = nowNs();
+	uint64_t c0 = nowCycles();
+
+	for(uint32_t i=0; i < iterations; i++) {
+		bc->run(i);
+	}
+
+	uint64_t c1 = nowCycles();
+	uint64_t t1 = nowNs();
+
+	printf("%-28s %10.1f ns/iter %10.1f cycles/iter\n",bc->name,
+			(double)(t1-t0)/iterations,(double)(c1-c0)/iterations);
+
+	if(bc->report) {
+		bc->report();
+	}
+}
+
+int main(int argc, char ** argv) {
+
+	uint32_t iterations = DEFAULT_ITERATIONS;
+	const char * filter = NULL;
+
+	if(argc > 1) {
+		iterations = (uint32_t)strtoul(argv[1],NULL,0);
+	}
+	if(argc > 2) {
+		filter = argv[2];
+	}
+	if(iterations == 0) {
+		iterations = DEFAULT_ITERATIONS;
+	}
+
+	printf("BlueBot App host benchmarks (%u iterations)\n",iterations);
+
+	for(unsigned int i=0; i < sizeof(bench_cases)/sizeof(bench_cases[0]); i++) {
+		if(filter == NULL || strstr(bench_cases[i].name,filter) != NULL) {
+			runBench(&bench_cases[i],iterations);
+		}
+	}
+
+	return 0;
+}
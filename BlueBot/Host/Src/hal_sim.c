@@ -0,0 +1,502 @@
+/*
+ * hal_sim.c
+ *
+ *  Host simulation of the peripherals used by the App modules
+ *
+ *  Replaces the CubeMX generated Core/Src peripheral setup and the vendor HAL drivers
+ *  when the App is built on the host.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "hal_sim.h"
+#include "tim.h"
+#include "usart.h"
+#include "adc.h"
+
+// simulated peripheral registers
+GPIO_TypeDef sim_gpioa;
+GPIO_TypeDef sim_gpiob;
+
+static TIM_TypeDef tim1_regs, tim2_regs, tim3_regs, tim6_regs, tim16_regs, tim17_regs;
+static USART_TypeDef usart1_regs, usart2_regs;
+static ADC_TypeDef adc1_regs, adc2_regs;
+static DMA_Channel_TypeDef dma1_ch4_regs, dma1_ch5_regs;
+
+// peripheral handles (on the target these are defined by the CubeMX generated code in Core/Src)
+TIM_HandleTypeDef htim1  = { &tim1_regs,  { 0, 0, 0xFFFF, 0, 0, 0 } };
+TIM_HandleTypeDef htim2  = { &tim2_regs,  { 0, 0, 0xFFFFFFFF, 0, 0, 0 } };
+TIM_HandleTypeDef htim3  = { &tim3_regs,  { 2, 0, MTR_PWM_PERIOD, 0, 0, 0 } };
+TIM_HandleTypeDef htim6  = { &tim6_regs,  { 64000, 0, 8, 0, 0, 0 } };
+TIM_HandleTypeDef htim16 = { &tim16_regs, { 64, 0, 20833, 0, 0, 0 } };
+TIM_HandleTypeDef htim17 = { &tim17_regs, { 63, 0, 999, 0, 0, 0 } };
+
+DMA_HandleTypeDef hdma_usart1_tx = { &dma1_ch4_regs };
+DMA_HandleTypeDef hdma_usart1_rx = { &dma1_ch5_regs };
+
+UART_HandleTypeDef huart1 = { &usart1_regs, { 460800 }, &hdma_usart1_tx, &hdma_usart1_rx, HAL_UART_STATE_READY, HAL_UART_STATE_READY, 0 };
+UART_HandleTypeDef huart2 = { &usart2_regs, { 115200 }, NULL, NULL, HAL_UART_STATE_READY, HAL_UART_STATE_READY, 0 };
+
+ADC_HandleTypeDef hadc1 = { &adc1_regs };
+ADC_HandleTypeDef hadc2 = { &adc2_regs };
+
+uint32_t SystemCoreClock = 64000000;
+
+// core debug registers (DWT cycle counter)
+static DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+
+#define SIM_CPU_MHZ 64 // timer input clock (MHz)
+
+// simulated system time
+static uint32_t sim_tick=0; // HAL tick (ms)
+static uint32_t sim_us=0;   // time in us
+
+// timers that can generate update interrupts, and the clock cycles left over towards their next count
+static TIM_HandleTypeDef * const it_timers[] = { &htim6, &htim16, &htim17 };
+static uint32_t it_timer_prescale[sizeof(it_timers)/sizeof(it_timers[0])];
+
+// EXTI lines with their interrupt enabled, and the pin edges they trigger on (bit per line)
+static uint32_t sim_exti_imr=0;
+static uint32_t sim_exti_rtsr=0;
+static uint32_t sim_exti_ftsr=0;
+
+// byte queue used for UART RX and captured TX data
+typedef struct SIM_QUEUE_t {
+	uint8_t buf[SIM_UART_BUF_SIZE];
+	int head; // next byte to read
+	int count; // number of bytes in queue
+} SIM_QUEUE;
+
+typedef struct SIM_UART_t {
+	SIM_QUEUE rx;
+	SIM_QUEUE tx;
+	uint32_t tx_total;
+	uint8_t *rx_dma_buf;  // circular DMA receive buffer (NULL if DMA reception not started)
+	uint16_t rx_dma_size; // size of the DMA receive buffer
+} SIM_UART;
+
+static SIM_UART sim_uart1;
+static SIM_UART sim_uart2;
+
+static SIM_UART * getSimUart(UART_HandleTypeDef *huart) {
+	return (huart == &huart1)?&sim_uart1:&sim_uart2;
+}
+
+static int queuePush(SIM_QUEUE *q, const uint8_t *data, int len) {
+	int n=0;
+	while(n < len && q->count < SIM_UART_BUF_SIZE) {
+		q->buf[(q->head + q->count) % SIM_UART_BUF_SIZE] = data[n++];
+		q->count++;
+	}
+	return n;
+}
+
+static int queuePop(SIM_QUEUE *q, uint8_t *data, int size) {
+	int n=0;
+	while(n < size && q->count > 0) {
+		if(data) {
+			data[n] = q->buf[q->head];
+		}
+		n++;
+		q->head = (q->head + 1) % SIM_UART_BUF_SIZE;
+		q->count--;
+	}
+	return n;
+}
+
+// keep the RXNE flag in step with the RX queue
+static void updateRxFlag(UART_HandleTypeDef *huart) {
+	if(getSimUart(huart)->rx.count > 0) {
+		huart->Instance->ISR |= UART_FLAG_RXNE;
+	}
+	else {
+		huart->Instance->ISR &= ~UART_FLAG_RXNE;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------
+// Simulation control
+// ---------------------------------------------------------------------------------
+
+void simReset(void) {
+
+	memset(&sim_gpioa,0,sizeof(sim_gpioa));
+	memset(&sim_gpiob,0,sizeof(sim_gpiob));
+
+	TIM_HandleTypeDef * timers[] = { &htim1, &htim2, &htim3, &htim6, &htim16, &htim17 };
+	for(unsigned int i=0; i < sizeof(timers)/sizeof(timers[0]); i++) {
+		memset(timers[i]->Instance,0,sizeof(TIM_TypeDef));
+		timers[i]->Instance->ARR = timers[i]->Init.Period;
+		timers[i]->Instance->PSC = timers[i]->Init.Prescaler;
+	}
+
+	memset(&sim_uart1,0,sizeof(sim_uart1));
+	memset(&sim_uart2,0,sizeof(sim_uart2));
+	memset(&usart1_regs,0,sizeof(usart1_regs));
+	memset(&usart2_regs,0,sizeof(usart2_regs));
+	memset(&dma1_ch4_regs,0,sizeof(dma1_ch4_regs));
+	memset(&dma1_ch5_regs,0,sizeof(dma1_ch5_regs));
+	huart1.gState = huart1.RxState = HAL_UART_STATE_READY;
+	huart2.gState = huart2.RxState = HAL_UART_STATE_READY;
+
+	adc1_regs.DR=0;
+	adc2_regs.DR=0;
+
+	sim_exti_imr=0;
+	sim_exti_rtsr=0;
+	sim_exti_ftsr=0;
+
+	memset(&sim_dwt,0,sizeof(sim_dwt));
+	memset(&sim_core_debug,0,sizeof(sim_core_debug));
+
+	sim_tick=0;
+	sim_us=0;
+	memset(it_timer_prescale,0,sizeof(it_timer_prescale));
+}
+
+// advance time one us at a time, counting any running timers with update interrupts enabled
+// and calling HAL_TIM_PeriodElapsedCallback when they reload (as the ISR would)
+// if no timer interrupts are enabled the time jumps straight there
+void simAdvanceMicros(uint32_t us) {
+
+	bool timers = false;
+	for(unsigned int i=0; i < sizeof(it_timers)/sizeof(it_timers[0]); i++) {
+		TIM_TypeDef * tim = it_timers[i]->Instance;
+		if((tim->CR1 & 1) && (tim->DIER & 1)) {
+			timers = true;
+		}
+	}
+	if(!timers) {
+		sim_tick += (sim_us % 1000 + us)/1000;
+		sim_us += us;
+		return;
+	}
+
+	while(us--) {
+
+		sim_us++;
+		if(sim_us % 1000 == 0) {
+			sim_tick++;
+		}
+
+		for(unsigned int i=0; i < sizeof(it_timers)/sizeof(it_timers[0]); i++) {
+			TIM_TypeDef * tim = it_timers[i]->Instance;
+
+			if((tim->CR1 & 1) && (tim->DIER & 1)) { // counter enabled and update interrupt enabled
+				it_timer_prescale[i] += SIM_CPU_MHZ;
+				while(it_timer_prescale[i] >= tim->PSC+1) {
+					it_timer_prescale[i] -= tim->PSC+1;
+					if(tim->CNT >= tim->ARR) {
+						tim->CNT = 0;
+						HAL_TIM_PeriodElapsedCallback(it_timers[i]);
+					}
+					else {
+						tim->CNT++;
+					}
+				}
+			}
+		}
+	}
+}
+
+void simAdvanceTick(uint32_t ms) {
+	simAdvanceMicros(ms*1000);
+}
+
+uint32_t simMicros(void) {
+	return sim_us;
+}
+
+void simMoveEncoder(TIM_HandleTypeDef *htim, int32_t counts) {
+
+	int64_t range = (int64_t)htim->Instance->ARR + 1;
+	bool update_it = (htim->Instance->DIER & TIM_IT_UPDATE) != 0;
+
+	// A channel pin and EXTI line of the encoder (see main.h)
+	uint16_t a_pin = (htim == &htim2)?ENC1_A_Pin:ENC2_A_Pin;
+	uint32_t a_line = (htim == &htim2)?EXTI_LINE_0:EXTI_LINE_9;
+
+	// in encoder mode the direction bit follows the last count
+	if(counts > 0) {
+		htim->Instance->CR1 &= ~TIM_CR1_DIR;
+	}
+	else if(counts < 0) {
+		htim->Instance->CR1 |= TIM_CR1_DIR;
+	}
+
+	if(!(sim_exti_imr & (1U << a_line)) || (htim != &htim1 && htim != &htim2)) { // no edge interrupts, move in one go
+		int64_t cnt = (int64_t)htim->Instance->CNT + counts;
+		int64_t wraps = (cnt >= 0)?cnt/range:(cnt - range + 1)/range; // overflows (+) or underflows (-)
+		htim->Instance->CNT = (uint32_t)(cnt - wraps*range);
+		if(update_it) {
+			for(int64_t n = (wraps < 0)?-wraps:wraps; n > 0; n--) {
+				HAL_TIM_PeriodElapsedCallback(htim);
+			}
+		}
+		return;
+	}
+
+	// quadrature states (A,B) 00,10,11,01 repeat every 4 counts, so A changes between an even count and the next one
+	int32_t step = (counts > 0)?1:-1;
+	while(counts != 0) {
+		uint32_t cnt = htim->Instance->CNT;
+		bool a_edge = (step > 0)?((cnt & 1) == 0):((cnt & 1) != 0);
+
+		htim->Instance->CNT = (uint32_t)(((int64_t)cnt + step + range) % range);
+		counts -= step;
+
+		if(update_it && ((step > 0 && cnt == htim->Instance->ARR) || (step < 0 && cnt == 0))) { // wrapped
+			HAL_TIM_PeriodElapsedCallback(htim);
+		}
+		if(a_edge) {
+			HAL_GPIO_EXTI_Callback(a_pin);
+		}
+	}
+}
+
+void simSetPin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+
+	bool was_set = (port->IDR & pin) != 0;
+
+	if(state == GPIO_PIN_SET) {
+		port->IDR |= pin;
+	}
+	else {
+		port->IDR &= ~pin;
+	}
+
+	// run the EXTI ISR callback if the line is enabled for this edge (lines are only mapped to port A)
+	uint32_t line = (uint32_t)__builtin_ctz(pin);
+	bool edge = (state == GPIO_PIN_SET)?(!was_set && (sim_exti_rtsr & pin)):(was_set && (sim_exti_ftsr & pin));
+	if(port == GPIOA && edge && (sim_exti_imr & (1U << line))) {
+		HAL_GPIO_EXTI_Callback(pin);
+	}
+}
+
+void simAdcConvert(ADC_HandleTypeDef *hadc, uint32_t value) {
+	hadc->Instance->DR = value;
+	HAL_ADC_ConvCpltCallback(hadc);
+}
+
+int simUartPushRx(UART_HandleTypeDef *huart, const uint8_t *data, int len) {
+
+	SIM_UART * sim = getSimUart(huart);
+
+	if(sim->rx_dma_buf && huart->RxState == HAL_UART_STATE_BUSY_RX) { // DMA reception running, write into the circular buffer
+		DMA_Channel_TypeDef * dma = huart->hdmarx->Instance;
+		for(int n=0; n < len; n++) {
+			sim->rx_dma_buf[sim->rx_dma_size - dma->CNDTR] = data[n];
+			if(--dma->CNDTR == sim->rx_dma_size/2) {
+				HAL_UART_RxHalfCpltCallback(huart);
+			}
+			else if(dma->CNDTR == 0) {
+				dma->CNDTR = sim->rx_dma_size; // circular mode reloads the count
+				HAL_UART_RxCpltCallback(huart);
+			}
+		}
+		if(len > 0) {
+			huart->Instance->ISR |= UART_FLAG_IDLE; // line goes idle after each burst
+		}
+		return len;
+	}
+
+	int n = queuePush(&sim->rx,data,len);
+	updateRxFlag(huart);
+	return n;
+}
+
+int simUartRxPending(UART_HandleTypeDef *huart) {
+	return getSimUart(huart)->rx.count;
+}
+
+void simUartTxComplete(UART_HandleTypeDef *huart) {
+	if(huart->gState == HAL_UART_STATE_BUSY_TX) {
+		huart->gState = HAL_UART_STATE_READY;
+		if(huart->hdmatx) {
+			huart->hdmatx->Instance->CNDTR = 0;
+		}
+		HAL_UART_TxCpltCallback(huart);
+	}
+}
+
+uint32_t simUartTxCount(UART_HandleTypeDef *huart) {
+	return getSimUart(huart)->tx_total;
+}
+
+int simUartTxRead(UART_HandleTypeDef *huart, uint8_t *data, int size) {
+	return queuePop(&getSimUart(huart)->tx,data,size);
+}
+
+
+// ---------------------------------------------------------------------------------
+// HAL stand-in
+// ---------------------------------------------------------------------------------
+
+uint32_t HAL_GetTick(void) {
+	return sim_tick;
+}
+
+void HAL_IncTick(void) {
+	sim_tick++;
+}
+
+void Error_Handler(void) {
+}
+
+DWT_Type * simDWT(void) {
+
+	if((sim_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) && (sim_core_debug.DEMCR & CoreDebug_DEMCR_TRCENA_Msk)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		uint64_t ns = (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+		sim_dwt.CYCCNT = (uint32_t)(ns*(SystemCoreClock/1000000)/1000);
+	}
+	return &sim_dwt;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	return (GPIOx->IDR & GPIO_Pin)?GPIO_PIN_SET:GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+	if(PinState == GPIO_PIN_SET) {
+		GPIOx->ODR |= GPIO_Pin;
+	}
+	else {
+		GPIOx->ODR &= ~GPIO_Pin;
+	}
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	GPIOx->ODR ^= GPIO_Pin;
+}
+
+void HAL_GPIO_EXTI_IRQHandler(uint16_t GPIO_Pin) {
+	HAL_GPIO_EXTI_Callback(GPIO_Pin);
+}
+
+HAL_StatusTypeDef HAL_EXTI_SetConfigLine(EXTI_HandleTypeDef *hexti, EXTI_ConfigTypeDef *pExtiConfig) {
+	hexti->Line = pExtiConfig->Line;
+	uint32_t bit = 1U << pExtiConfig->Line;
+	if(pExtiConfig->Mode & EXTI_MODE_INTERRUPT) {
+		sim_exti_imr |= bit;
+	}
+	else {
+		sim_exti_imr &= ~bit;
+	}
+	sim_exti_rtsr = (pExtiConfig->Trigger & EXTI_TRIGGER_RISING)?(sim_exti_rtsr | bit):(sim_exti_rtsr & ~bit);
+	sim_exti_ftsr = (pExtiConfig->Trigger & EXTI_TRIGGER_FALLING)?(sim_exti_ftsr | bit):(sim_exti_ftsr & ~bit);
+	return HAL_OK;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) {
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t Channel) {
+	htim->Instance->CR1 |= 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Encoder_Start(TIM_HandleTypeDef *htim, uint32_t Channel) {
+	htim->Instance->CR1 |= 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 |= 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT(TIM_HandleTypeDef *htim) {
+	htim->Instance->CR1 |= 1;
+	htim->Instance->DIER |= 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+
+	SIM_UART * sim = getSimUart(huart);
+	queuePush(&sim->tx,pData,Size);
+	sim->tx_total += Size;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+
+	int n = queuePop(&getSimUart(huart)->rx,pData,Size);
+	updateRxFlag(huart);
+	return (n == Size)?HAL_OK:HAL_TIMEOUT;
+}
+
+// the transfer is captured immediately, but the UART stays busy until simUartTxComplete() is called
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+
+	if(huart->gState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+
+	HAL_UART_Transmit(huart,pData,Size,0);
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	if(huart->hdmatx) {
+		huart->hdmatx->Instance->CNDTR = Size;
+	}
+	return HAL_OK;
+}
+
+// reception is always circular (as CubeMX sets up USART1 RX), bytes pushed by simUartPushRx() go straight into pData
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+
+	if(huart->RxState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if(!huart->hdmarx || !pData || Size == 0) {
+		return HAL_ERROR;
+	}
+
+	SIM_UART * sim = getSimUart(huart);
+	sim->rx_dma_buf = pData;
+	sim->rx_dma_size = Size;
+	huart->hdmarx->Instance->CNDTR = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc, uint32_t SingleDiff) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start_IT(ADC_HandleTypeDef *hadc) {
+	return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef *hadc) {
+	return hadc->Instance->DR;
+}
+
+// default callbacks (the App overrides the ones it uses)
+__attribute__((weak)) void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
+}
+
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+}
+
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+}
+
+__attribute__((weak)) void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+}
+
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+}
+
+__attribute__((weak)) void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+}
+__attribute__((weak)) void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc) {
+}
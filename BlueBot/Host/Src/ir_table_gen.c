@@ -0,0 +1,193 @@
+/*
+ * ir_table_gen.c
+ *
+ *  Generate the Sharp IR sensor calibration tables (App/Src/ir_tables.c)
+ *
+ *  Each table holds the distance at every 2^IR_TABLE_SHIFT'th ADC code (see ir_range.h). By default the
+ *  distances come from the sensor's fitted curve dist = a * volts^b + c (the SR_* and LR_* coefficients in
+ *  ir_range.h), evaluated in double precision. A sensor can instead be given a file of its own measured
+ *  calibration points, one "<volts> <cm>" pair per line (lines starting with # are comments), which are
+ *  interpolated linearly. Below the lowest measured voltage the table reads IR_TABLE_MAX_CM (out of range),
+ *  above the highest it holds the distance of the highest point.
+ *
+ *  The table is written to stdout, the Host Makefile regenerates App/Src/ir_tables.c with it when ir_range.h
+ *  or this file change (make ir_tables IR_LR_POINTS=<file> IR_SR_POINTS=<file> to use measured points).
+ *
+ *  usage: ir_table_gen [-l <long range points file>] [-s <short range points file>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ir_range.h"
+
+#define MAX_POINTS 256
+
+typedef struct CAL_POINT_t {
+	double volts;
+	double cm;
+} CAL_POINT;
+
+// calibration source for one sensor table
+typedef struct IR_CAL_t {
+	const char * name;    // table name
+	const char * desc;    // sensor description
+	double a, b, c;       // fitted curve
+	const char * file;    // measured points file (NULL to use the curve)
+	CAL_POINT points[MAX_POINTS];
+	int num_points;
+} IR_CAL;
+
+static IR_CAL cals[NUM_IR_SENSORS] = {
+	[LR_IR] = { "ir_table_long",  "long range",  LR_A, LR_B, LR_C, NULL },
+	[SR_IR] = { "ir_table_short", "short range", SR_A, SR_B, SR_C, NULL },
+};
+
+static int comparePoints(const void * a, const void * b) {
+	double va = ((const CAL_POINT *)a)->volts;
+	double vb = ((const CAL_POINT *)b)->volts;
+	return (va > vb) - (va < vb);
+}
+
+// read the measured points of a sensor, sorted by voltage
+static int readPoints(IR_CAL * cal) {
+
+	FILE * f = fopen(cal->file,"r");
+	if(!f) {
+		fprintf(stderr,"ir_table_gen: cannot open %s\n",cal->file);
+		return -1;
+	}
+
+	char line[256];
+	int line_no = 0;
+	cal->num_points = 0;
+	while(fgets(line,sizeof(line),f)) {
+		line_no++;
+		char * p = line + strspn(line," \t");
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == 0) {
+			continue;
+		}
+
+		CAL_POINT pt;
+		if(sscanf(p,"%lf %lf",&pt.volts,&pt.cm) != 2 || !(pt.volts > 0.0) || !(pt.cm > 0.0)) {
+			fprintf(stderr,"ir_table_gen: %s:%d: expected <volts> <cm>\n",cal->file,line_no);
+			fclose(f);
+			return -1;
+		}
+		if(cal->num_points == MAX_POINTS) {
+			fprintf(stderr,"ir_table_gen: %s: more than %d points\n",cal->file,MAX_POINTS);
+			fclose(f);
+			return -1;
+		}
+		cal->points[cal->num_points++] = pt;
+	}
+	fclose(f);
+
+	if(cal->num_points < 2) {
+		fprintf(stderr,"ir_table_gen: %s: need at least 2 points\n",cal->file);
+		return -1;
+	}
+
+	qsort(cal->points,cal->num_points,sizeof(CAL_POINT),comparePoints);
+	return 0;
+}
+
+// distance (cm) at a voltage from the measured points
+static double pointsDistance(const IR_CAL * cal, double v) {
+
+	const CAL_POINT * pt = cal->points;
+	int n = cal->num_points;
+
+	if(v < pt[0].volts) {
+		return IR_TABLE_MAX_CM;
+	}
+	if(v >= pt[n-1].volts) {
+		return pt[n-1].cm;
+	}
+
+	int i = 0;
+	while(v >= pt[i+1].volts) {
+		i++;
+	}
+	return pt[i].cm + (pt[i+1].cm - pt[i].cm)*(v - pt[i].volts)/(pt[i+1].volts - pt[i].volts);
+}
+
+// distance (cm) at a voltage from the fitted curve
+static double curveDistance(const IR_CAL * cal, double v) {
+	return (v > 0.0)?cal->a*pow(v,cal->b) + cal->c:INFINITY;
+}
+
+static void writeTable(const IR_CAL * cal) {
+
+	char source[256];
+	if(cal->file) {
+		snprintf(source,sizeof(source),"measured points %s",cal->file);
+	}
+	else {
+		snprintf(source,sizeof(source),"%.7g * v^%.7g %+.7g",cal->a,cal->b,cal->c);
+	}
+
+	printf("\n// %s sensor: %s\n",cal->desc,source);
+	printf("const IR_TABLE %s = {\n",cal->name);
+	printf("\t\"%s\",\n",source);
+	printf("\t{\n");
+
+	for(int n=0; n < IR_TABLE_SIZE; n++) {
+
+		double v = (double)(n << IR_TABLE_SHIFT)*IR_ADC_SCALE;
+		double d = cal->file?pointsDistance(cal,v):curveDistance(cal,v);
+		if(!(d < IR_TABLE_MAX_CM)) {
+			d = IR_TABLE_MAX_CM;
+		}
+
+		if(n % 8 == 0) {
+			printf("\t\t");
+		}
+		printf("%#.7gf,",d); // # keeps the decimal point so the f suffix is valid
+		printf((n % 8 == 7 || n == IR_TABLE_SIZE-1)?"\n":" ");
+	}
+
+	printf("\t}\n");
+	printf("};\n");
+}
+
+int main(int argc, char ** argv) {
+
+	for(int n=1; n < argc; n++) {
+		if(n+1 < argc && strcmp(argv[n],"-l") == 0) {
+			cals[LR_IR].file = argv[++n];
+		}
+		else if(n+1 < argc && strcmp(argv[n],"-s") == 0) {
+			cals[SR_IR].file = argv[++n];
+		}
+		else {
+			fprintf(stderr,"usage: ir_table_gen [-l <long range points file>] [-s <short range points file>]\n");
+			return 1;
+		}
+	}
+
+	for(int s=0; s < NUM_IR_SENSORS; s++) {
+		if(cals[s].file && readPoints(&cals[s]) != 0) {
+			return 1;
+		}
+	}
+
+	printf("/*\n");
+	printf(" * ir_tables.c\n");
+	printf(" *\n");
+	printf(" *  Sharp IR sensor calibration tables, distance (cm) every %d ADC codes\n",1 << IR_TABLE_SHIFT);
+	printf(" *\n");
+	printf(" *  Generated by Host/Src/ir_table_gen.c, do not edit\n");
+	printf(" *  (run make ir_tables in Host/ to regenerate)\n");
+	printf(" */\n");
+	printf("\n");
+	printf("#include \"ir_range.h\"\n");
+
+	for(int s=0; s < NUM_IR_SENSORS; s++) {
+		writeTable(&cals[s]);
+	}
+
+	return 0;
+}
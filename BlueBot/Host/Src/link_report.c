@@ -0,0 +1,360 @@
+/*
+ * link_report.c
+ *
+ *  Replay a captured coms link byte stream and report frame loss, corruption and command to ack latency
+ *
+ *  The capture is a text file with one line per burst of bytes seen at the host end of the link:
+ *
+ *    <time us> H <hex bytes ...>   bytes sent by the host to the robot
+ *    <time us> R <hex bytes ...>   bytes received by the host from the robot
+ *
+ *  Lines starting with # are comments. Both streams are SLIP decoded using the App's decoder. Robot
+ *  frames are CRC checked and their sequence numbers checked for gaps. Each host frame is timed until
+ *  a robot frame acks its sequence number. A host frame that is never acked was lost (or was superseded
+ *  by a later frame before the robot replied).
+ *
+ *  The simulate mode runs the App against the simulated HAL with a noisy link, writes the capture
+ *  (if a file is given) and reports on it, along with the link statistics the robot kept.
+ *
+ *  usage: link_report <capture file>
+ *         link_report -s <seconds> <byte error rate> [capture file to write]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hal_sim.h"
+#include "usart.h"
+
+#include "coms.h"
+#include "motors.h"
+#include "edge_sensor.h"
+#include "scheduler.h"
+#include "ui.h"
+
+#define MAX_LATENCIES 100000
+
+// state of the analysis of one direction of the link
+typedef struct LINK_DIR_t {
+	SLIP_DECODER dec;
+	uint8_t frame[COMS_PACKET_SIZE+COMS_FRAME_OVERHEAD];
+	uint32_t frames;     // frames decoded
+	uint32_t crc_errors; // frames with a bad CRC
+	uint32_t gaps;       // frames missing from the sequence
+	uint8_t last_seq;
+	bool seq_valid;
+} LINK_DIR;
+
+static LINK_DIR host_dir;  // host -> robot
+static LINK_DIR robot_dir; // robot -> host
+
+// host frames waiting for an ack, indexed by seq
+static struct {
+	bool pending;
+	uint32_t time_us;
+} host_sent[256];
+
+static uint32_t acked=0;
+static uint32_t not_acked=0;
+
+static uint32_t latencies[MAX_LATENCIES];
+static uint32_t num_latencies=0;
+
+
+// ---------------------------------------------------------------------------------
+// analysis
+// ---------------------------------------------------------------------------------
+
+static void resetAnalysis(void) {
+	memset(&host_dir,0,sizeof(host_dir));
+	memset(&robot_dir,0,sizeof(robot_dir));
+	memset(host_sent,0,sizeof(host_sent));
+	acked=0;
+	not_acked=0;
+	num_latencies=0;
+}
+
+// check the sequence number of a frame, returns the seq
+static uint8_t checkSeq(LINK_DIR * dir) {
+
+	uint8_t seq = dir->frame[0];
+	if(dir->seq_valid) {
+		dir->gaps += (uint8_t)(seq - dir->last_seq - 1);
+	}
+	dir->last_seq = seq;
+	dir->seq_valid = true;
+	return seq;
+}
+
+static void hostFrame(uint32_t time_us, int len) {
+
+	host_dir.frames++;
+	if(!slipCheckFrame(host_dir.frame,len)) { // host's own frames should always be good
+		host_dir.crc_errors++;
+		return;
+	}
+
+	uint8_t seq = checkSeq(&host_dir);
+
+	if(host_sent[seq].pending) { // seq has wrapped round without an ack for the old frame
+		not_acked++;
+	}
+	host_sent[seq].pending = true;
+	host_sent[seq].time_us = time_us;
+}
+
+static void robotFrame(uint32_t time_us, int len) {
+
+	robot_dir.frames++;
+	if(!slipCheckFrame(robot_dir.frame,len)) {
+		robot_dir.crc_errors++;
+		return;
+	}
+
+	checkSeq(&robot_dir);
+
+	uint8_t ack = robot_dir.frame[1];
+	if(host_sent[ack].pending) {
+		host_sent[ack].pending = false;
+		acked++;
+		if(num_latencies < MAX_LATENCIES) {
+			latencies[num_latencies++] = time_us - host_sent[ack].time_us;
+		}
+	}
+}
+
+// add bytes seen on the link
+static void addBytes(uint32_t time_us, char dir, const uint8_t * data, int len) {
+
+	LINK_DIR * d = (dir == 'H')?&host_dir:&robot_dir;
+	int frame_len;
+
+	for(int n=0; n < len; n++) {
+		if(slipDecode(&d->dec,data[n],sizeof(d->frame),d->frame,&frame_len)) {
+			if(dir == 'H') {
+				hostFrame(time_us,frame_len);
+			}
+			else {
+				robotFrame(time_us,frame_len);
+			}
+		}
+	}
+}
+
+static int cmpU32(const void * a, const void * b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void report(void) {
+
+	for(int s=0; s < 256; s++) { // frames still waiting at the end of the capture
+		if(host_sent[s].pending) {
+			not_acked++;
+		}
+	}
+
+	// frames that failed the CRC also show up as gaps in the sequence
+	uint32_t robot_good = robot_dir.frames - robot_dir.crc_errors;
+	uint32_t robot_lost = (robot_dir.gaps > robot_dir.crc_errors)?robot_dir.gaps - robot_dir.crc_errors:0;
+	uint32_t robot_total = robot_good + robot_dir.gaps;
+
+	printf("robot -> host: frames=%u good=%u crc errors=%u lost=%u (%.2f%% corrupt, %.2f%% lost)\n",
+			robot_dir.frames,robot_good,robot_dir.crc_errors,robot_lost,
+			robot_total?100.0*robot_dir.crc_errors/robot_total:0.0,robot_total?100.0*robot_lost/robot_total:0.0);
+
+	uint32_t host_total = acked + not_acked;
+	printf("host -> robot: frames=%u acked=%u not acked=%u (%.2f%% lost)\n",
+			host_dir.frames,acked,not_acked,host_total?100.0*not_acked/host_total:0.0);
+
+	if(num_latencies > 0) {
+		qsort(latencies,num_latencies,sizeof(latencies[0]),cmpU32);
+
+		uint64_t sum=0;
+		for(uint32_t n=0; n < num_latencies; n++) {
+			sum += latencies[n];
+		}
+
+		printf("command to ack latency: min=%.1fms avg=%.1fms p50=%.1fms p99=%.1fms max=%.1fms\n",
+				latencies[0]*1.0e-3,(double)sum/num_latencies*1.0e-3,latencies[num_latencies/2]*1.0e-3,
+				latencies[(num_latencies*99)/100]*1.0e-3,latencies[num_latencies-1]*1.0e-3);
+	}
+}
+
+// read and analyze a capture file
+static int replay(const char * name) {
+
+	FILE * f = fopen(name,"r");
+	if(!f) {
+		perror(name);
+		return 1;
+	}
+
+	char line[4096];
+	int line_no=0;
+	uint8_t data[sizeof(line)/2];
+
+	while(fgets(line,sizeof(line),f)) {
+
+		line_no++;
+
+		char * p = line;
+		while(isspace((unsigned char)*p)) {
+			p++;
+		}
+		if(*p == '#' || *p == 0) {
+			continue;
+		}
+
+		unsigned long time_us;
+		char dir;
+		int used;
+		if(sscanf(p,"%lu %c%n",&time_us,&dir,&used) != 2 || (dir != 'H' && dir != 'R')) {
+			fprintf(stderr,"%s:%d: bad line\n",name,line_no);
+			continue;
+		}
+		p += used;
+
+		int len=0;
+		unsigned int byte;
+		while(sscanf(p," %2x%n",&byte,&used) == 1) {
+			data[len++] = (uint8_t)byte;
+			p += used;
+		}
+
+		addBytes((uint32_t)time_us,dir,data,len);
+	}
+
+	fclose(f);
+	report();
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------
+// simulation
+// ---------------------------------------------------------------------------------
+
+#define SIM_CMD_PERIOD_MS 100 // host sends a command every 100ms
+
+static FILE * capture=NULL;
+static double byte_error_rate=0;
+
+// log bytes seen at the host and add them to the analysis
+static void seen(char dir, const uint8_t * data, int len) {
+
+	if(len == 0) {
+		return;
+	}
+
+	if(capture) {
+		fprintf(capture,"%u %c",simMicros(),dir);
+		for(int n=0; n < len; n++) {
+			fprintf(capture," %02x",data[n]);
+		}
+		fprintf(capture,"\n");
+	}
+
+	addBytes(simMicros(),dir,data,len);
+}
+
+// flip a random bit in bytes picked at the byte error rate
+static void addNoise(uint8_t * data, int len) {
+	for(int n=0; n < len; n++) {
+		if((double)rand()/RAND_MAX < byte_error_rate) {
+			data[n] ^= (uint8_t)(1 << (rand() % 8));
+		}
+	}
+}
+
+// one pass of the app_main loop
+static void robotLoop(void) {
+
+	if(schedDue(SG_DEBOUNCE)) {
+		updateEdgeSensors();
+	}
+	MotorEvent event = doComs();
+	bool pid_update = schedDue(SG_MOTION);
+	event |= updateMotors(pid_update,schedDT(SG_MOTION));
+	if(schedDue(SG_TELEMETRY)) {
+		sendTelemetry();
+	}
+	(void)event;
+}
+
+static int simulate(uint32_t seconds, double ber, const char * capture_name) {
+
+	if(capture_name) {
+		capture = fopen(capture_name,"w");
+		if(!capture) {
+			perror(capture_name);
+			return 1;
+		}
+		fprintf(capture,"# simulated link, byte error rate %g\n",ber);
+	}
+
+	byte_error_rate = ber;
+	srand(1);
+
+	simReset();
+	comsInit();
+	setSpeedLoopRate(SPEED_LOOP_TICKS);
+	schedInit();
+	STOP();
+
+	uint8_t host_seq=0;
+	uint8_t buf[SIM_UART_BUF_SIZE];
+
+	for(uint32_t ms=0; ms < seconds*1000; ms++) {
+
+		if(ms % SIM_CMD_PERIOD_MS == 0) { // host sends a command (put PID in closed loop mode, harmless to repeat)
+			static const uint8_t cmd[] = { 'o' };
+			int len = slipEncodeFrame(cmd,sizeof(cmd),host_seq++,robot_dir.last_seq,buf);
+			seen('H',buf,len);
+			addNoise(buf,len);
+			simUartPushRx(&huart1,buf,len);
+		}
+
+		robotLoop();
+
+		simAdvanceMicros(1000);
+		simUartTxComplete(&huart1); // telemetry frames take ~1.2ms to send, so are done by the next 50Hz frame
+
+		int len = simUartTxRead(&huart1,buf,sizeof(buf));
+		addNoise(buf,len);
+		seen('R',buf,len);
+	}
+
+	if(capture) {
+		fclose(capture);
+	}
+
+	report();
+
+	const COMS_STATS * st = comsGetStats();
+	printf("robot link stats: rx frames=%u crc errors=%u seq gaps=%u, tx frames=%u coalesced=%u dropped=%u\n",
+			st->rx_frames,st->rx_crc_errors,st->rx_seq_gaps,st->tx_frames,st->tx_coalesced,st->tx_dropped);
+
+	return 0;
+}
+
+
+int main(int argc, char ** argv) {
+
+	resetAnalysis();
+
+	if(argc >= 4 && strcmp(argv[1],"-s") == 0) {
+		return simulate((uint32_t)strtoul(argv[2],NULL,0),strtod(argv[3],NULL),(argc > 4)?argv[4]:NULL);
+	}
+
+	if(argc == 2) {
+		return replay(argv[1]);
+	}
+
+	fprintf(stderr,"usage: %s <capture file>\n"
+			"       %s -s <seconds> <byte error rate> [capture file to write]\n",argv[0],argv[0]);
+	return 2;
+}